@@ -29,6 +29,7 @@ lidarFileExt=".asc"
 lidarFileBuiltinImageExt=".jpg"
 overlay=true
 builtinImage=false
+terrainOverlay=""
 xDim=0
 yDim=0
 imageX=0
@@ -70,21 +71,25 @@ outputFile=$1.sh
 echo "#! /bin/bash" > $outputFile
 echo "" >> $outputFile
 
-# Copy the LiDAR files
-echo "Copy LiDAR files ..."
-echo "# Copy LiDAR files" >> $outputFile
-for i in "${lidarFiles[@]}"; do
-	echo "cp $lidarDataPath/$i$lidarFileExt ." >> $outputFile
-done
+# The LiDAR files ( .asc or .asc.gz ) are read directly from $lidarDataPath
+
+# A terrain overlay ( hillshade, slope, aspect or flow ) is made by lidar2ply
+# itself, so no image files are needed
+lidar2plyOptions="-m"
+if [ -n "$terrainOverlay" ]; then
+	overlay=false
+	lidar2plyOptions="-m -o $terrainOverlay"
+fi
 
 # Download image files if necessary
 if [ "$overlay" = true ]; then
 	if [ "$builtinImage" = true ]; then
-		echo "Copy the built in image files ..."
-		echo "# Copy LiDAR image files" >> $outputFile
+		# lidar2ply reads PNG files
+		echo "Convert the built in image files ..."
+		echo "# Convert LiDAR image files" >> $outputFile
 		for i in "${lidarFiles[@]}"; do
-			echo "cp $lidarDataPath/$i$lidarFileBuiltinImageExt ." >> $outputFile
-			imageFilesList+=($i$lidarFileBuiltinImageExt)
+			echo "convert $lidarDataPath/$i$lidarFileBuiltinImageExt $i.png" >> $outputFile
+			imageFilesList+=($i.png)
 		done
 	else
 		# Fetch the OSM data
@@ -103,21 +108,10 @@ if [ "$overlay" = true ]; then
 		echo "cd "$osm2pngDir >> $outputFile
 		echo "./osm2png.py "$thisDir"/"$1".osm -o "$thisDir"/"$1".png -z "$zoomLevel" -s "$(($xDim*$imageX))"x"$(($yDim*$imageY))" -r style.mapcss" >> $outputFile
 		echo "cd "$thisDir >> $outputFile
-		echo "convert "$1".png -crop "$imageX"x"$imageY" +repage %d.png" >> $outputFile
-		# Build image file list
-		for ((id=0;id<$(($xDim*$yDim));id++))
-		{
-			f=$id".png"
-			imageFilesList+=($f)
-		}
+		# lidar2ply reads the whole image once and spreads it over the
+		# LiDAR files, so it isn't cut up into one image per file
+		lidar2plyOptions="$lidar2plyOptions -g $thisDir/$1.png"
 	fi
-
-	# Convert the image files
-	echo "Convert the image files ..."
-  echo "# Convert the image files" >> $outputFile
-	for i in "${imageFilesList[@]}"; do
-		echo "convert "$i" "$i".txt" >> $outputFile
-	done
 fi
 
 # Create the list file
@@ -126,8 +120,12 @@ echo "Creating the list file ..."
 echo "# Created by build file on "`date` > plyListFile
 for ((id=0;id<${#lidarFiles[@]};id++))
 {
-	echo ${lidarFiles[id]}$lidarFileExt" "${imageFilesList[id]}".txt" >> plyListFile
+	if [ ${#imageFilesList[@]} -gt 0 ]; then
+		echo $lidarDataPath/${lidarFiles[id]}$lidarFileExt" "${imageFilesList[id]} >> plyListFile
+	else
+		echo $lidarDataPath/${lidarFiles[id]}$lidarFileExt >> plyListFile
+	fi
 }
 
 echo "# Run PLY list file" >> $outputFile
-echo $lidar2plyExec" -l plyListFile -m" >> $outputFile
+echo $lidar2plyExec" -l plyListFile "$lidar2plyOptions >> $outputFile
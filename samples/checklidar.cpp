@@ -0,0 +1,872 @@
+// checklidar.cpp - check the LiDAR library against known results
+// Copyright (C) 2018 John Davies
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Usage: checklidar <test20x20.asc> <gzip copy of test20x20.asc>
+// The results for test20x20.asc were worked out by hand. The grid is 20 x 20
+// cells of 1m, rising 1m a row from 4 at the south edge to 1, then to 9 and
+// back down to 1 at the north edge. There are 12 NODATA cells, 8 at the
+// north east corner and 4 in the middle of the ridge. Other files ( GeoTIFF,
+// LAS, PNG, small grids ) are written to the current directory and removed.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <stdexcept>
+#include <cstdint>
+#include "lidarlib.hpp"
+#include "lidarimage.hpp"
+#include "lidarterrain.hpp"
+#include "lidarcontour.hpp"
+#include "lidarviewshed.hpp"
+#include "lidarvolume.hpp"
+#include "lidardrainage.hpp"
+#include "lodepng.h"
+
+using namespace std;
+
+// Sample grid, and what is known about it
+string sampleFile;
+string gzipFile;
+const unsigned int sampleSize = 20;
+const UINT64 sampleNODATA = 12;
+
+// Number of checks that failed
+unsigned int failures = 0;
+
+//=========================================================================
+
+void check( bool pass, string description )
+{
+  if( pass == false )
+  {
+    cout << "FAIL " << description << endl;
+    failures++;
+  }
+}
+
+bool near( double value, double expected, double tolerance = 1e-4 )
+{
+  return fabs( value - expected ) <= tolerance;
+}
+
+// Height of a cell of the sample grid, -9999 for NODATA
+float sampleValue( unsigned int col, unsigned int row )
+{
+  if( ( ( row >= 16 ) && ( col >= 18 ) ) || ( ( ( row == 10 ) || ( row == 11 ) )
+   && ( ( col == 9 ) || ( col == 10 ) ) ) )
+  {
+    return -9999.0f;
+  }
+  return ( row <= 3 ) ? 4 - row : ( ( row <= 11 ) ? row - 2 : 20 - row );
+}
+
+// Check that every cell of a grid matches the sample grid
+bool matchesSample( lidar& grid )
+{
+  if( ( grid.getNoColumns() != sampleSize ) || ( grid.getNoRows() != sampleSize ) )
+  {
+    return false;
+  }
+  for( unsigned int r = 0; r < sampleSize; r++ )
+  {
+    for( unsigned int c = 0; c < sampleSize; c++ )
+    {
+      float value;
+      if( ( grid.getValue( c, r, value ) == false ) || ( value != sampleValue( c, r ) ) )
+      {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Write a small ASCII grid, "lines" are the rows from the north edge down
+void writeGrid( string fileName, unsigned int columns, const vector<string>& lines )
+{
+  ofstream file( fileName );
+  file << "ncols " << columns << "\nnrows " << lines.size()
+       << "\nxllcorner 0\nyllcorner 0\ncellsize 1\nNODATA_value -9999\n";
+  for( auto& line : lines )
+  {
+    file << line << "\n";
+  }
+}
+
+//=========================================================================
+// File formats
+
+void checkAscii( void )
+{
+  lidar grid;
+  struct returnResult res = grid.readFromFile( sampleFile );
+  check( res.result, "ASCII read: " + res.reason );
+  check( ( grid.getXllcorner() == 0 ) && ( grid.getYllcorner() == 0 )
+         && ( grid.getCellsize() == 1.0f ) && ( grid.getNODATA_value() == -9999.0f ),
+         "ASCII header" );
+  check( matchesSample( grid ), "ASCII values" );
+  check( grid.getNODATACount() == sampleNODATA, "ASCII NODATA count" );
+  check( ( grid.getMinValue() == 1.0f ) && ( grid.getMaxValue() == 9.0f )
+         && near( grid.getMeanValue(), 1746.0 / 388.0 ), "ASCII statistics" );
+  check( grid.isNODATA( 9, 10 ) && grid.isNODATA( 19, 19 ) && !grid.isNODATA( 17, 19 ),
+         "ASCII NODATA mask" );
+
+  lidar header;
+  res = header.readHeader( sampleFile );
+  check( res.result && ( header.getNoColumns() == sampleSize ) && ( header.getNoRows() == sampleSize ),
+         "ASCII header only" );
+
+  // Gzip copy
+  lidar gzipped;
+  res = gzipped.readFromFile( gzipFile );
+  check( res.result && matchesSample( gzipped ), "Gzip read: " + res.reason );
+  res = header.readHeader( gzipFile );
+  check( res.result && ( header.getNoColumns() == sampleSize ), "Gzip header only" );
+}
+
+// --------------------------------------------------------------------
+
+void checkNumbers( void )
+{
+  // Values half way between two floats, and just either side, written with
+  // 15 to 25 significant digits. The parser must round them as strtof does.
+  const unsigned int columns = 50;
+  const unsigned int rows = 100;
+  vector<string> lines;
+  vector<string> values;
+  unsigned int seed = 1;
+  while( values.size() < columns * rows )
+  {
+    seed = seed * 1103515245 + 12345;
+    float f = ( ( seed >> 8 ) + 1.0f ) * powf( 10.0f, (int)( seed % 13 ) - 10 );
+    double middle = ( (double)f + (double)nextafterf( f, INFINITY ) ) / 2.0;
+    const char* formats[] = { "%.15g", "%.16g", "%.17g", "%.19g", "%.25g" };
+    for( const char* format : formats )
+    {
+      for( double v : { middle, nextafter( middle, 0.0 ), nextafter( middle, INFINITY ) } )
+      {
+        char text[64];
+        snprintf( text, sizeof( text ), format, ( seed & 256 ) ? -v : v );
+        values.push_back( text );
+      }
+    }
+  }
+  values.resize( columns * rows );
+  for( unsigned int r = 0; r < rows; r++ )
+  {
+    string line;
+    for( unsigned int c = 0; c < columns; c++ )
+    {
+      line += values[ r * columns + c ] + " ";
+    }
+    lines.push_back( line );
+  }
+
+  string fileName = "checklidar.tmp.asc";
+  writeGrid( fileName, columns, lines );
+  lidar grid;
+  struct returnResult res = grid.readFromFile( fileName );
+  remove( fileName.c_str() );
+  check( res.result, "Number parsing: " + res.reason );
+
+  unsigned int wrong = 0;
+  for( unsigned int r = 0; r < rows && res.result; r++ )
+  {
+    for( unsigned int c = 0; c < columns; c++ )
+    {
+      // The first line is the northern row
+      float value;
+      grid.getValue( c, rows - 1 - r, value );
+      wrong += ( value != strtof( values[ r * columns + c ].c_str(), NULL ) ) ? 1 : 0;
+    }
+  }
+  check( wrong == 0, "Number parsing matches strtof, " + to_string( wrong ) + " values differ" );
+}
+
+// --------------------------------------------------------------------
+
+void checkCache( void )
+{
+  // Work on a copy so the cache isn't left beside the sample
+  string copy = "checklidar.tmp.asc";
+  {
+    ifstream in( sampleFile, ios::binary );
+    ofstream out( copy, ios::binary );
+    out << in.rdbuf();
+  }
+
+  lidar first;
+  first.setCacheEnabled( true );
+  struct returnResult res = first.readFromFile( copy );
+  check( res.result && matchesSample( first ), "Cache first read: " + res.reason );
+  check( ifstream( copy + ".lgc" ).good(), "Cache file written" );
+
+  lidar second;
+  second.setCacheEnabled( true );
+  res = second.readFromFile( copy );
+  check( res.result && matchesSample( second ), "Cache round trip: " + res.reason );
+  check( second.getNODATACount() == sampleNODATA, "Cache NODATA count" );
+
+  struct lidarWindow window = { 2, 3, 5, 4 };
+  lidar part;
+  part.setCacheEnabled( true );
+  res = part.readFromFile( copy, window );
+  float value;
+  check( res.result && ( part.getNoColumns() == 5 ) && part.getValue( 4, 3, value )
+         && ( value == sampleValue( 6, 6 ) ), "Cache windowed read" );
+
+  remove( ( copy + ".lgc" ).c_str() );
+  remove( copy.c_str() );
+}
+
+// --------------------------------------------------------------------
+
+void checkWindow( void )
+{
+  struct lidarWindow window = { 2, 3, 5, 4 };
+  lidar grid;
+  struct returnResult res = grid.readFromFile( sampleFile, window );
+  check( res.result, "Window read: " + res.reason );
+  check( ( grid.getNoColumns() == 5 ) && ( grid.getNoRows() == 4 )
+         && ( grid.getXllcorner() == 2 ) && ( grid.getYllcorner() == 3 ), "Window extent" );
+  bool match = true;
+  for( unsigned int r = 0; r < 4; r++ )
+  {
+    for( unsigned int c = 0; c < 5; c++ )
+    {
+      float value;
+      match = match && grid.getValue( c, r, value ) && ( value == sampleValue( c + 2, r + 3 ) );
+    }
+  }
+  check( match, "Window values" );
+
+  // Clipped to the grid, NODATA corner included
+  struct lidarWindow corner = { 15, 15, 10, 10 };
+  res = grid.readFromFile( sampleFile, corner );
+  check( res.result && ( grid.getNoColumns() == 5 ) && ( grid.getNoRows() == 5 )
+         && ( grid.getNODATACount() == 8 ), "Window clipped to the grid" );
+
+  // Area in metres
+  res = grid.readFromFile( sampleFile, 4.5, 5.5, 7.5, 6.5 );
+  check( res.result && ( grid.getXllcorner() == 4 ) && ( grid.getYllcorner() == 5 )
+         && ( grid.getNoColumns() == 4 ) && ( grid.getNoRows() == 2 ), "Area read extent" );
+}
+
+// --------------------------------------------------------------------
+
+void checkDecimation( unsigned int factor, enum lidarPooling pooling, string name )
+{
+  lidar grid;
+  grid.setDecimation( factor, pooling );
+  struct returnResult res = grid.readFromFile( sampleFile );
+  unsigned int size = ( sampleSize + factor - 1 ) / factor;
+  check( res.result && ( grid.getNoColumns() == size ) && ( grid.getNoRows() == size )
+         && ( grid.getCellsize() == factor ), "Decimation " + name + " extent" );
+
+  // Blocks start at the south west corner, the north and east ones are partial
+  bool match = true;
+  UINT64 nodata = 0;
+  for( unsigned int r = 0; r < size; r++ )
+  {
+    for( unsigned int c = 0; c < size; c++ )
+    {
+      double sum = 0.0;
+      float highest = -9999.0f;
+      unsigned int count = 0;
+      for( unsigned int y = r * factor; y < min( ( r + 1 ) * factor, sampleSize ); y++ )
+      {
+        for( unsigned int x = c * factor; x < min( ( c + 1 ) * factor, sampleSize ); x++ )
+        {
+          float v = sampleValue( x, y );
+          if( v != -9999.0f )
+          {
+            sum += v;
+            highest = max( highest, v );
+            count++;
+          }
+        }
+      }
+      float expected = ( count == 0 ) ? -9999.0f
+                     : ( ( pooling == POOL_MAX ) ? highest : sum / count );
+      nodata += ( count == 0 ) ? 1 : 0;
+      float value;
+      match = match && grid.getValue( c, r, value ) && near( value, expected );
+    }
+  }
+  check( match, "Decimation " + name + " values" );
+  check( grid.getNODATACount() == nodata, "Decimation " + name + " NODATA count" );
+}
+
+// --------------------------------------------------------------------
+
+// TIFF directory entry, values of up to 4 bytes are held in the entry
+static void tiffEntry( vector<unsigned char>& ifd, vector<unsigned char>& extra, size_t extraStart,
+                       unsigned int tag, unsigned int type, unsigned int count, const void* data,
+                       unsigned int size )
+{
+  unsigned char entry[12] = { 0 };
+  memcpy( entry, &tag, 2 );
+  memcpy( entry + 2, &type, 2 );
+  memcpy( entry + 4, &count, 4 );
+  if( size <= 4 )
+  {
+    memcpy( entry + 8, data, size );
+  }
+  else
+  {
+    UINT32 offset = extraStart + extra.size();
+    memcpy( entry + 8, &offset, 4 );
+    extra.insert( extra.end(), (const unsigned char*)data, (const unsigned char*)data + size );
+  }
+  ifd.insert( ifd.end(), entry, entry + 12 );
+}
+
+void checkGeoTiff( void )
+{
+  // Uncompressed little endian single strip, this only runs on little endian machines
+  string fileName = "checklidar.tmp.tif";
+  vector<float> values;
+  for( unsigned int r = sampleSize; r-- > 0; )
+  {
+    for( unsigned int c = 0; c < sampleSize; c++ )
+    {
+      values.push_back( sampleValue( c, r ) );
+    }
+  }
+  UINT32 width = sampleSize, dataBytes = values.size() * 4, dataOffset = 8;
+  uint16_t bits = 32, one = 1, floatFormat = 3;
+  double scale[3] = { 1.0, 1.0, 0.0 };
+  double tiepoint[6] = { 0.0, 0.0, 0.0, 0.0, (double)sampleSize, 0.0 };
+  const char nodata[] = "-9999";
+
+  // Directory after the data, then the values that don't fit in an entry
+  size_t ifdStart = dataOffset + dataBytes;
+  size_t extraStart = ifdStart + 2 + ( 11 * 12 ) + 4;
+  vector<unsigned char> ifd, extra;
+  tiffEntry( ifd, extra, extraStart, 256, 4, 1, &width, 4 );
+  tiffEntry( ifd, extra, extraStart, 257, 4, 1, &width, 4 );
+  tiffEntry( ifd, extra, extraStart, 258, 3, 1, &bits, 2 );
+  tiffEntry( ifd, extra, extraStart, 259, 3, 1, &one, 2 );
+  tiffEntry( ifd, extra, extraStart, 273, 4, 1, &dataOffset, 4 );
+  tiffEntry( ifd, extra, extraStart, 278, 4, 1, &width, 4 );
+  tiffEntry( ifd, extra, extraStart, 279, 4, 1, &dataBytes, 4 );
+  tiffEntry( ifd, extra, extraStart, 339, 3, 1, &floatFormat, 2 );
+  tiffEntry( ifd, extra, extraStart, 33550, 12, 3, scale, sizeof( scale ) );
+  tiffEntry( ifd, extra, extraStart, 33922, 12, 6, tiepoint, sizeof( tiepoint ) );
+  tiffEntry( ifd, extra, extraStart, 42113, 2, sizeof( nodata ), nodata, sizeof( nodata ) );
+
+  {
+    ofstream file( fileName, ios::binary );
+    UINT32 ifdOffset = ifdStart;
+    uint16_t entries = ifd.size() / 12;
+    UINT32 next = 0;
+    file.write( "II*\0", 4 );
+    file.write( (const char*)&ifdOffset, 4 );
+    file.write( (const char*)&values[0], dataBytes );
+    file.write( (const char*)&entries, 2 );
+    file.write( (const char*)&ifd[0], ifd.size() );
+    file.write( (const char*)&next, 4 );
+    file.write( (const char*)&extra[0], extra.size() );
+  }
+
+  lidar grid;
+  struct returnResult res = grid.readFromFile( fileName );
+  check( res.result && matchesSample( grid ), "GeoTIFF read: " + res.reason );
+  check( grid.getNODATACount() == sampleNODATA, "GeoTIFF NODATA count" );
+
+  struct lidarWindow window = { 2, 3, 5, 4 };
+  res = grid.readFromFile( fileName, window );
+  float value;
+  check( res.result && ( grid.getYllcorner() == 3 ) && grid.getValue( 4, 3, value )
+         && ( value == sampleValue( 6, 6 ) ), "GeoTIFF windowed read" );
+
+  remove( fileName.c_str() );
+}
+
+// --------------------------------------------------------------------
+
+void checkLas( void )
+{
+  // LAS 1.2, point format 0, coordinates in mm
+  struct {
+    double x, y, z;
+    unsigned char returns;      // return number and number of returns
+    bool withheld;
+  } points[] = {
+    { 100.2, 200.3, 2.0, 0x11, false },   // cell ( 0, 0 ), first of two returns
+    { 100.7, 200.6, 7.0, 0x11, false },
+    { 100.5, 200.5, 6.0, 0x12, false },   // last of two returns
+    { 102.5, 201.5, 4.0, 0x09, false },   // cell ( 2, 1 ), only return
+    { 101.5, 200.5, 9.0, 0x09, true }     // withheld, cell ( 1, 0 ) stays NODATA
+  };
+  const unsigned int count = sizeof( points ) / sizeof( points[0] );
+  string fileName = "checklidar.tmp.las";
+
+  unsigned char header[227] = { 0 };
+  memcpy( header, "LASF", 4 );
+  header[24] = 1;
+  header[25] = 2;
+  uint16_t headerSize = sizeof( header ), recordLength = 20;
+  UINT32 pointOffset = sizeof( header ), pointCount = count;
+  double scale[3] = { 0.001, 0.001, 0.001 };
+  double offset[3] = { 0.0, 0.0, 0.0 };
+  double bounds[6] = { 102.5, 100.2, 201.5, 200.3, 9.0, 2.0 };
+  memcpy( header + 94, &headerSize, 2 );
+  memcpy( header + 96, &pointOffset, 4 );
+  memcpy( header + 105, &recordLength, 2 );
+  memcpy( header + 107, &pointCount, 4 );
+  memcpy( header + 131, scale, sizeof( scale ) );
+  memcpy( header + 155, offset, sizeof( offset ) );
+  memcpy( header + 179, bounds, sizeof( bounds ) );
+  {
+    ofstream file( fileName, ios::binary );
+    file.write( (const char*)header, sizeof( header ) );
+    for( unsigned int i = 0; i < count; i++ )
+    {
+      unsigned char record[20] = { 0 };
+      int32_t xyz[3] = { (int32_t)lround( points[i].x * 1000.0 ), (int32_t)lround( points[i].y * 1000.0 ),
+                       (int32_t)lround( points[i].z * 1000.0 ) };
+      memcpy( record, xyz, sizeof( xyz ) );
+      record[14] = points[i].returns;
+      record[15] = 2 | ( points[i].withheld ? 0x80 : 0 );
+      file.write( (const char*)record, sizeof( record ) );
+    }
+  }
+
+  lidar header3x2;
+  struct returnResult res = header3x2.readHeader( fileName );
+  check( res.result && ( header3x2.getNoColumns() == 3 ) && ( header3x2.getNoRows() == 2 )
+         && ( header3x2.getXllcorner() == 100 ) && ( header3x2.getYllcorner() == 200 ),
+         "LAS header: " + res.reason );
+
+  enum lidarBinning rules[] = { BIN_MIN, BIN_MAX, BIN_MEAN, BIN_LAST_RETURN };
+  float expected[] = { 2.0f, 7.0f, 5.0f, 6.0f };
+  for( unsigned int i = 0; i < 4; i++ )
+  {
+    lidar grid;
+    grid.setPointCloudOptions( 1.0f, rules[i] );
+    res = grid.readFromFile( fileName );
+    float value, other;
+    check( res.result && grid.getValue( 0, 0, value ) && near( value, expected[i] )
+           && grid.getValue( 2, 1, other ) && near( other, 4.0 )
+           && ( grid.getNODATACount() == 4 ), "LAS binning rule " + to_string( i ) );
+  }
+
+  remove( fileName.c_str() );
+}
+
+//=========================================================================
+// Processing
+
+void checkFillGaps( void )
+{
+  lidar grid;
+  grid.readFromFile( sampleFile );
+  check( grid.fillGaps( 0 ) == sampleNODATA, "fillGaps count" );
+  check( grid.getNODATACount() == 0, "fillGaps NODATA left" );
+
+  // Filled values lie between the surrounding heights
+  bool inRange = true;
+  for( unsigned int r = 0; r < sampleSize; r++ )
+  {
+    for( unsigned int c = 0; c < sampleSize; c++ )
+    {
+      float value;
+      grid.getValue( c, r, value );
+      if( ( r >= 16 ) && ( c >= 18 ) )
+      {
+        inRange = inRange && ( value >= 1.0f ) && ( value <= 5.0f );
+      }
+      else if( sampleValue( c, r ) == -9999.0f )
+      {
+        inRange = inRange && ( value >= 7.0f ) && ( value <= 9.0f );
+      }
+      else
+      {
+        inRange = inRange && ( value == sampleValue( c, r ) );
+      }
+    }
+  }
+  check( inRange, "fillGaps values" );
+
+  // All but the three cells at the end of column 19 are next to data
+  lidar limited;
+  limited.readFromFile( sampleFile );
+  check( limited.fillGaps( 1 ) == 9, "fillGaps within 1 cell" );
+}
+
+// --------------------------------------------------------------------
+
+void checkResample( void )
+{
+  lidar grid;
+  grid.readFromFile( sampleFile );
+
+  lidar fine = grid.resample( 0.5f, INTERPOLATE_BILINEAR );
+  check( ( fine.getNoColumns() == 40 ) && ( fine.getNoRows() == 40 ) && ( fine.getCellsize() == 0.5f ),
+         "Resample extent" );
+  // Centre of cell ( 10, 3 ) is at 5.25, 1.75, a quarter of the way from 3 to 2
+  float value;
+  check( fine.getValue( 10, 3, value ) && near( value, 2.75 ), "Resample bilinear value" );
+  check( grid.interpolate( 5.25, 1.75, value ) && near( value, 2.75 ), "Interpolate value" );
+  check( !grid.interpolate( 19.5, 19.5, value ), "Interpolate NODATA" );
+  check( !grid.interpolate( 25.0, 5.0, value ), "Interpolate outside the grid" );
+
+  lidar same = grid.resample( 1.0f, INTERPOLATE_BICUBIC );
+  check( matchesSample( same ), "Resample bicubic at the same cell size" );
+
+  lidar coarse = grid.resample( 2.0f, INTERPOLATE_BILINEAR );
+  check( ( coarse.getNoColumns() == 10 ) && coarse.getValue( 2, 0, value ) && near( value, 3.5 ),
+         "Resample to 2m" );
+
+  bool thrown = false;
+  try
+  {
+    grid.resample( 0.0f, INTERPOLATE_BILINEAR );
+  }
+  catch( const std::invalid_argument& )
+  {
+    thrown = true;
+  }
+  check( thrown, "Resample rejects a cell size of 0" );
+}
+
+// --------------------------------------------------------------------
+
+void checkTerrain( void )
+{
+  lidar grid;
+  grid.readFromFile( sampleFile );
+  lidarTerrain terrain;
+
+  // Cell ( 5, 1 ) is on a plane falling 1m a row to the north
+  float value;
+  lidar slope = terrain.slope( grid );
+  check( slope.getValue( 5, 1, value ) && near( value, 45.0, 1e-3 ), "Slope" );
+  check( slope.getNODATACount() == sampleNODATA, "Slope NODATA count" );
+
+  lidar aspect = terrain.aspect( grid );
+  check( aspect.getValue( 5, 1, value ) && ( near( value, 0.0, 1e-3 ) || near( value, 360.0, 1e-3 ) ),
+         "Aspect facing north" );
+  check( aspect.getValue( 5, 6, value ) && near( value, 180.0, 1e-3 ), "Aspect facing south" );
+
+  // Sun in the north west at 45 degrees: 255 * ( cos 45 cos 45 + sin 45 sin 45 cos 315 )
+  lidar shade = terrain.hillshade( grid );
+  check( shade.getValue( 5, 1, value ) && near( value, 255.0 * ( 0.5 + 0.5 * sqrt( 0.5 ) ), 0.5 ),
+         "Hillshade" );
+
+  string fileName = "checklidar.tmp.png";
+  struct returnResult res = lidarTerrain::writePng( shade, 0.0f, 255.0f, fileName );
+  vector<unsigned char> rgba;
+  unsigned int width = 0, height = 0;
+  bool decoded = res.result && ( lodepng::decode( rgba, width, height, fileName ) == 0 );
+  // Cell ( 19, 19 ) is the top right pixel
+  check( decoded && ( width == sampleSize ) && ( height == sampleSize )
+         && ( rgba[ ( sampleSize - 1 ) * 4 + 3 ] == 0 ) && ( rgba[ 3 ] == 255 ), "Terrain PNG" );
+  remove( fileName.c_str() );
+}
+
+// --------------------------------------------------------------------
+
+void checkContours( void )
+{
+  lidar grid;
+  grid.readFromFile( sampleFile );
+  lidarContour contour;
+  contour.setLevels( 1.0f, 0.5f );
+  vector<struct contourLine> lines = contour.extract( grid );
+
+  // Every level from 1.5 to 8.5 appears and every point lies on its level
+  bool levels[8] = { false };
+  bool onLevel = true;
+  for( auto& line : lines )
+  {
+    int level = lround( line.level - 1.5f );
+    if( ( level >= 0 ) && ( level < 8 ) && ( near( line.level - 1.5f, level ) ) )
+    {
+      levels[ level ] = true;
+    }
+    else
+    {
+      onLevel = false;
+    }
+    for( auto& point : line.points )
+    {
+      // Points are measured from the centre of the lower left cell
+      float value;
+      onLevel = onLevel && grid.interpolate( point.x + 0.5, point.y + 0.5, value )
+                && near( value, line.level, 1e-3 );
+    }
+  }
+  bool allLevels = true;
+  for( int i = 0; i < 8; i++ )
+  {
+    allLevels = allLevels && levels[i];
+  }
+  check( allLevels, "Contour levels" );
+  check( onLevel, "Contour points on their level" );
+}
+
+// --------------------------------------------------------------------
+
+void checkViewshed( void )
+{
+  lidar grid;
+  grid.readFromFile( sampleFile );
+  lidarViewshed viewshed;
+  lidar visible;
+
+  // From the valley floor the near side of the ridge is visible but not the far side
+  struct returnResult res = viewshed.compute( grid, 5.5, 3.5, visible );
+  check( res.result, "Viewshed: " + res.reason );
+  float value;
+  check( visible.getValue( 5, 3, value ) && ( value == 1.0f ), "Viewshed observer cell" );
+  check( visible.getValue( 5, 8, value ) && ( value == 1.0f ), "Viewshed near side of ridge" );
+  check( visible.getValue( 5, 16, value ) && ( value == 0.0f ), "Viewshed far side of ridge" );
+  check( visible.getNODATACount() == sampleNODATA, "Viewshed NODATA count" );
+
+  res = viewshed.compute( grid, 30.0, 3.5, visible );
+  check( res.result == false, "Viewshed observer outside the grid" );
+}
+
+// --------------------------------------------------------------------
+
+void checkVolumes( void )
+{
+  lidar grid;
+  grid.readFromFile( sampleFile );
+
+  // Against a level of 5m
+  lidarVolume volume;
+  lidar differences;
+  struct returnResult res = volume.add( grid, 5.0, 0.0, 0.0, &differences );
+  check( res.result, "Volume: " + res.reason );
+  check( near( volume.getCut(), 306.0 ) && near( volume.getFill(), 500.0 ), "Volume cut and fill" );
+  check( near( volume.getCutArea(), 136.0 ) && near( volume.getFillArea(), 212.0 )
+         && near( volume.getArea(), 388.0 ), "Volume areas" );
+  float value;
+  check( differences.getValue( 5, 11, value ) && near( value, 4.0 )
+         && ( differences.getNODATACount() == sampleNODATA ), "Volume differences" );
+
+  // The grid against itself, then totals carried over a second tile
+  volume.reset();
+  lidar other;
+  other.readFromFile( sampleFile );
+  res = volume.add( grid, other );
+  check( res.result && near( volume.getCut(), 0.0 ) && near( volume.getFill(), 0.0 )
+         && near( volume.getArea(), 388.0 ), "Volume between grids" );
+  volume.add( grid, 5.0 );
+  check( near( volume.getCut(), 306.0 ) && near( volume.getArea(), 776.0 ), "Volume totals" );
+}
+
+// --------------------------------------------------------------------
+
+void checkProfiles( void )
+{
+  // A line up column 0, sampled from two tiles that meet at row 10
+  vector< pair<double, double> > line = { { 0.5, 0.5 }, { 0.5, 19.5 } };
+  vector< vector<struct lidarProfilePoint> > profiles( 1, lidar::profilePoints( line, 1.0 ) );
+  check( profiles[0].size() == sampleSize, "Profile point count" );
+
+  struct lidarWindow south = { 0, 0, sampleSize, 10 };
+  struct lidarWindow north = { 0, 10, sampleSize, 10 };
+  lidar tile;
+  tile.readFromFile( sampleFile, south );
+  tile.sampleProfiles( profiles );
+  tile.readFromFile( sampleFile, north );
+  tile.sampleProfiles( profiles );
+  lidar::finishProfiles( profiles );
+
+  bool match = true;
+  for( unsigned int i = 0; i < profiles[0].size(); i++ )
+  {
+    struct lidarProfilePoint& p = profiles[0][i];
+    match = match && p.valid && near( p.distance, i ) && near( p.z, sampleValue( 0, i ) );
+  }
+  check( match, "Profile values" );
+
+  // Through the NODATA corner
+  line = { { 19.5, 0.5 }, { 19.5, 19.5 } };
+  profiles.assign( 1, lidar::profilePoints( line, 1.0 ) );
+  tile.readFromFile( sampleFile );
+  tile.sampleProfiles( profiles );
+  lidar::finishProfiles( profiles );
+  check( profiles[0][15].valid && !profiles[0][17].valid, "Profile NODATA" );
+}
+
+// --------------------------------------------------------------------
+
+void checkDrainage( void )
+{
+  // A pit in a bowl that drains through the middle of the south edge
+  string fileName = "checklidar.tmp.asc";
+  writeGrid( fileName, 5, { "10 10 10 10 10", "10 5 5 5 10", "10 5 1 5 10", "10 5 5 5 10",
+                            "10 10 4 10 10" } );
+  lidar bowl;
+  struct returnResult res = bowl.readFromFile( fileName );
+  remove( fileName.c_str() );
+  check( res.result, "Drainage grid: " + res.reason );
+
+  // The pit is raised just above the floor of the bowl, nothing is lowered
+  lidarDrainage drainage;
+  lidar filled = drainage.fillDepressions( bowl );
+  float value, before;
+  bool raised = filled.getValue( 2, 2, value ) && ( value > 5.0f ) && ( value < 5.001f );
+  for( unsigned int r = 0; r < 5; r++ )
+  {
+    for( unsigned int c = 0; c < 5; c++ )
+    {
+      bowl.getValue( c, r, before );
+      filled.getValue( c, r, value );
+      raised = raised && ( value >= before ) && ( ( value < 5.001f ) || ( value == before ) );
+    }
+  }
+  check( raised, "Depression filled" );
+
+  lidar direction = drainage.flowDirection( filled );
+  check( direction.getValue( 2, 1, value ) && ( value == 6.0f )
+         && direction.getValue( 2, 0, value ) && ( value == -1.0f ), "Flow direction to the outlet" );
+
+  // Every cell drains through the outlet
+  lidar accumulation = drainage.flowAccumulation( direction );
+  check( accumulation.getValue( 2, 0, value ) && ( value == 25.0f ), "Flow accumulation" );
+
+  // NODATA cells stay NODATA
+  lidar grid;
+  grid.readFromFile( sampleFile );
+  lidar sampleFilled = drainage.fillDepressions( grid );
+  lidar sampleDirection = drainage.flowDirection( sampleFilled );
+  check( ( sampleFilled.getNODATACount() == sampleNODATA )
+         && ( sampleDirection.getNODATACount() == sampleNODATA ), "Drainage NODATA count" );
+  bool notLowered = true;
+  for( unsigned int r = 0; r < sampleSize; r++ )
+  {
+    for( unsigned int c = 0; c < sampleSize; c++ )
+    {
+      float before, after;
+      grid.getValue( c, r, before );
+      sampleFilled.getValue( c, r, after );
+      notLowered = notLowered && ( after >= before );
+    }
+  }
+  check( notLowered, "Drainage never lowers cells" );
+}
+
+// --------------------------------------------------------------------
+
+void checkOverlay( void )
+{
+  // A 40 x 40 pixel mosaic over the sample grid, red rises to the east and
+  // green to the south ( down the image )
+  string fileName = "checklidar.tmp.png";
+  vector<unsigned char> rgb;
+  for( unsigned int y = 0; y < 40; y++ )
+  {
+    for( unsigned int x = 0; x < 40; x++ )
+    {
+      rgb.push_back( x * 6 );
+      rgb.push_back( y * 6 );
+      rgb.push_back( 100 );
+    }
+  }
+  lodepng::encode( fileName, rgb, 40, 40, LCT_RGB, 8 );
+
+  for( int streamed = 0; streamed < 2; streamed++ )
+  {
+    string name = streamed ? "streamed " : "";
+    lidarImage mosaic;
+    struct returnResult res = streamed ? mosaic.openStream( fileName ) : mosaic.readFromFile( fileName );
+    check( res.result && ( mosaic.getXSize() == 40 ) && ( mosaic.getYSize() == 40 ),
+           "Overlay " + name + "mosaic: " + res.reason );
+    mosaic.setExtent( 0.0, 0.0, sampleSize, sampleSize );
+
+    // The centre of cell ( x, y ) is half way between pixels 2x and 2x + 1,
+    // and between pixel rows 38 - 2y and 39 - 2y
+    lidarImage overlay( sampleSize, sampleSize, 255 );
+    res = overlay.sampleFrom( mosaic, 0.0, 0.0, 1.0 );
+    check( res.result, "Overlay " + name + "sample: " + res.reason );
+    bool match = true;
+    for( unsigned int y = 0; y < sampleSize; y++ )
+    {
+      for( unsigned int x = 0; x < sampleSize; x++ )
+      {
+        unsigned char red, green, blue;
+        overlay.getPixel( x, y, red, green, blue );
+        match = match && near( red, 12 * x + 3, 1 ) && near( green, 231 - 12 * y, 1 ) && ( blue == 100 );
+      }
+    }
+    check( match, "Overlay " + name + "values" );
+
+    // Only part of the grid is covered, the rest is black
+    lidarImage edge( 4, 4, 255 );
+    res = edge.sampleFrom( mosaic, 18.0, 18.0, 1.0 );
+    unsigned char red, green, blue;
+    edge.getPixel( 1, 1, red, green, blue );
+    bool inside = ( red == 12 * 19 + 3 ) && ( blue == 100 );
+    edge.getPixel( 2, 1, red, green, blue );
+    bool outside = ( red == 0 ) && ( green == 0 ) && ( blue == 0 );
+    check( res.result && inside && outside, "Overlay " + name + "at the edge: " + res.reason );
+    check( mosaic.covers( 0.0, 0.0, 20.0, 20.0 ) && !mosaic.covers( 18.0, 18.0, 22.0, 22.0 ),
+           "Overlay " + name + "extent" );
+  }
+
+  remove( fileName.c_str() );
+}
+
+//=========================================================================
+
+int main( int argc, char *argv[] )
+{
+  if( argc != 3 )
+  {
+    cout << "Usage: checklidar <test20x20.asc> <test20x20.asc.gz>" << endl;
+    return 1;
+  }
+  sampleFile = argv[1];
+  gzipFile = argv[2];
+
+  checkAscii();
+  checkNumbers();
+  checkCache();
+  checkWindow();
+  checkDecimation( 2, POOL_MEAN, "by 2, mean" );
+  checkDecimation( 3, POOL_MEAN, "by 3, mean" );
+  checkDecimation( 3, POOL_MAX, "by 3, max" );
+  checkGeoTiff();
+  checkLas();
+  checkFillGaps();
+  checkResample();
+  checkTerrain();
+  checkContours();
+  checkViewshed();
+  checkVolumes();
+  checkProfiles();
+  checkDrainage();
+  checkOverlay();
+
+  if( failures == 0 )
+  {
+    cout << "LiDAR checks passed" << endl;
+  }
+  else
+  {
+    cout << failures << " LiDAR checks FAILED" << endl;
+  }
+  return ( failures == 0 ) ? 0 : 1;
+}
@@ -0,0 +1,184 @@
+// checkpng.cpp - compare the streaming PNG decoder with lodepng
+// Copyright (C) 2018 John Davies
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Usage: checkpng <png file> ...
+// Each file given is decoded with pngStream and with lodepng and the rows
+// compared. Images in every colour type and bit depth are then encoded
+// with stored, fixed and dynamic deflate blocks and checked in the same way.
+
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include "pngstream.hpp"
+#include "lodepng.h"
+
+using namespace std;
+
+// Scratch file for the encoded images
+const string tempFile = "checkpng.tmp.png";
+
+// Size of the encoded images, odd so that rows don't end on a byte boundary
+const unsigned int testWidth = 37;
+const unsigned int testHeight = 23;
+
+//=========================================================================
+
+bool checkFile( string fileName, string description )
+{
+  vector<unsigned char> expected;
+  unsigned int width, height;
+  unsigned int error = lodepng::decode( expected, width, height, fileName, LCT_RGB, 8 );
+  if( error )
+  {
+    cout << "FAIL " << description << ": lodepng " << lodepng_error_text( error ) << endl;
+    return false;
+  }
+
+  pngStream stream;
+  struct returnResult result = stream.open( fileName );
+  if( result.result == false )
+  {
+    cout << "FAIL " << description << ": " << result.reason << endl;
+    return false;
+  }
+  if( ( stream.getWidth() != width ) || ( stream.getHeight() != height ) )
+  {
+    cout << "FAIL " << description << ": size " << stream.getWidth() << "x" << stream.getHeight() << endl;
+    return false;
+  }
+
+  // Read the image twice to check rewind
+  vector<unsigned char> row( width * 3 );
+  for( int pass = 0; pass < 2; pass++ )
+  {
+    stream.rewind();
+    for( unsigned int y = 0; y < height; y++ )
+    {
+      result = stream.readRow( &row[0] );
+      if( result.result == false )
+      {
+        cout << "FAIL " << description << ": row " << y << ": " << result.reason << endl;
+        return false;
+      }
+      if( memcmp( &row[0], &expected[ (size_t)y * width * 3 ], width * 3 ) != 0 )
+      {
+        cout << "FAIL " << description << ": row " << y << " differs" << endl;
+        return false;
+      }
+    }
+  }
+
+  cout << "ok   " << description << endl;
+  return true;
+}
+
+//=========================================================================
+
+bool checkEncoding( LodePNGColorType colourType, unsigned int bitDepth, unsigned int blockType )
+{
+  lodepng::State state;
+  state.encoder.auto_convert = 0;
+  state.encoder.zlibsettings.btype = blockType;
+  state.info_raw.colortype = colourType;
+  state.info_raw.bitdepth = bitDepth;
+  state.info_png.color.colortype = colourType;
+  state.info_png.color.bitdepth = bitDepth;
+
+  // The palette is the same for the raw data and the file
+  unsigned int paletteSize = 0;
+  if( colourType == LCT_PALETTE )
+  {
+    paletteSize = ( bitDepth < 8 ) ? ( 1 << bitDepth ) : 200;
+    for( unsigned int i = 0; i < paletteSize; i++ )
+    {
+      unsigned char r = i * 53, g = i * 101 + 7, b = 255 - i * 29;
+      lodepng_palette_add( &state.info_raw, r, g, b, 255 );
+      lodepng_palette_add( &state.info_png.color, r, g, b, 255 );
+    }
+  }
+
+  // Mix of repeating and varying bytes so that all the filters get used
+  size_t rowBytes = ( (size_t)testWidth * lodepng_get_bpp( &state.info_raw ) + 7 ) / 8;
+  vector<unsigned char> raw( rowBytes * testHeight );
+  unsigned int seed = 1;
+  for( unsigned int y = 0; y < testHeight; y++ )
+  {
+    for( size_t i = 0; i < rowBytes; i++ )
+    {
+      seed = seed * 1103515245 + 12345;
+      unsigned char value = ( ( y + i ) % 3 == 0 ) ? ( seed >> 16 ) : ( ( i + y ) * 13 );
+      if( ( colourType == LCT_PALETTE ) && ( bitDepth == 8 ) )
+      {
+        value %= paletteSize;
+      }
+      raw[ y * rowBytes + i ] = value;
+    }
+  }
+
+  char description[80];
+  const char* blockNames[] = { "stored", "fixed", "dynamic" };
+  snprintf( description, sizeof( description ), "colour type %d, %u bit, %s blocks",
+            (int)colourType, bitDepth, blockNames[ blockType ] );
+
+  vector<unsigned char> png;
+  unsigned int error = lodepng::encode( png, raw, testWidth, testHeight, state );
+  if( error == 0 )
+  {
+    error = lodepng::save_file( png, tempFile );
+  }
+  if( error )
+  {
+    cout << "FAIL " << description << ": lodepng " << lodepng_error_text( error ) << endl;
+    return false;
+  }
+
+  bool pass = checkFile( tempFile, description );
+  remove( tempFile.c_str() );
+  return pass;
+}
+
+//=========================================================================
+
+int main( int argc, char *argv[] )
+{
+  bool pass = true;
+
+  for( int i = 1; i < argc; i++ )
+  {
+    pass = checkFile( argv[i], argv[i] ) && pass;
+  }
+
+  struct {
+    LodePNGColorType colourType;
+    unsigned int bitDepth;
+  } formats[] = {
+    { LCT_GREY, 1 }, { LCT_GREY, 2 }, { LCT_GREY, 4 }, { LCT_GREY, 8 }, { LCT_GREY, 16 },
+    { LCT_RGB, 8 }, { LCT_RGB, 16 },
+    { LCT_PALETTE, 1 }, { LCT_PALETTE, 2 }, { LCT_PALETTE, 4 }, { LCT_PALETTE, 8 },
+    { LCT_GREY_ALPHA, 8 }, { LCT_GREY_ALPHA, 16 },
+    { LCT_RGBA, 8 }, { LCT_RGBA, 16 }
+  };
+  for( unsigned int f = 0; f < sizeof( formats ) / sizeof( formats[0] ); f++ )
+  {
+    for( unsigned int blockType = 0; blockType < 3; blockType++ )
+    {
+      pass = checkEncoding( formats[f].colourType, formats[f].bitDepth, blockType ) && pass;
+    }
+  }
+
+  cout << ( pass ? "PNG checks passed" : "PNG checks FAILED" ) << endl;
+  return pass ? 0 : 1;
+}
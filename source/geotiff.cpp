@@ -0,0 +1,524 @@
+// geotiff.cpp - Decoder for single band floating point GeoTIFF files
+// Copyright (C) 2018 John Davies
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// TIFF 6.0 specification: https://www.adobe.io/open/standards/TIFF.html
+// GeoTIFF specification: http://docs.opengeospatial.org/is/19-008r4/19-008r4.html
+
+#include "geotiff.hpp"
+#include "lodepng.h"
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <stdexcept>
+#include <algorithm>
+
+using namespace std;
+
+// TIFF tags
+static const unsigned int TAG_IMAGE_WIDTH = 256;
+static const unsigned int TAG_IMAGE_LENGTH = 257;
+static const unsigned int TAG_BITS_PER_SAMPLE = 258;
+static const unsigned int TAG_COMPRESSION = 259;
+static const unsigned int TAG_STRIP_OFFSETS = 273;
+static const unsigned int TAG_SAMPLES_PER_PIXEL = 277;
+static const unsigned int TAG_ROWS_PER_STRIP = 278;
+static const unsigned int TAG_STRIP_BYTE_COUNTS = 279;
+static const unsigned int TAG_PLANAR_CONFIGURATION = 284;
+static const unsigned int TAG_PREDICTOR = 317;
+static const unsigned int TAG_TILE_WIDTH = 322;
+static const unsigned int TAG_TILE_LENGTH = 323;
+static const unsigned int TAG_TILE_OFFSETS = 324;
+static const unsigned int TAG_TILE_BYTE_COUNTS = 325;
+static const unsigned int TAG_SAMPLE_FORMAT = 339;
+// GeoTIFF tags
+static const unsigned int TAG_MODEL_PIXEL_SCALE = 33550;
+static const unsigned int TAG_MODEL_TIEPOINT = 33922;
+static const unsigned int TAG_MODEL_TRANSFORMATION = 34264;
+static const unsigned int TAG_GEO_KEY_DIRECTORY = 34735;
+// GDAL extension
+static const unsigned int TAG_GDAL_NODATA = 42113;
+
+// GeoKeys
+static const unsigned int KEY_RASTER_TYPE = 1025;
+static const unsigned int RASTER_PIXEL_IS_POINT = 2;
+
+// Compression schemes
+static const unsigned int COMPRESSION_NONE = 1;
+static const unsigned int COMPRESSION_DEFLATE = 8;
+static const unsigned int COMPRESSION_DEFLATE_OLD = 32946;
+
+// Predictors
+static const unsigned int PREDICTOR_NONE = 1;
+static const unsigned int PREDICTOR_FLOATING_POINT = 3;
+
+// Field types and their sizes in bytes
+static const unsigned int TYPE_ASCII = 2;
+static const unsigned int TYPE_SHORT = 3;
+static const unsigned int TYPE_LONG = 4;
+static const unsigned int TYPE_DOUBLE = 12;
+
+static unsigned int typeSize( unsigned int type )
+{
+  switch( type )
+  {
+    case 1: case 2: case 6: case 7: return 1;   // BYTE, ASCII, SBYTE, UNDEFINED
+    case 3: case 8: return 2;                   // SHORT, SSHORT
+    case 4: case 9: case 11: return 4;          // LONG, SLONG, FLOAT
+    case 5: case 10: case 12: return 8;         // RATIONAL, SRATIONAL, DOUBLE
+    default: return 0;
+  }
+}
+
+// ====================================================================
+// Constructor
+
+geoTiff::geoTiff( void )
+{
+  fileData = NULL;
+  fileSize = 0;
+  bigEndian = false;
+  width = 0;
+  height = 0;
+  compression = COMPRESSION_NONE;
+  predictor = PREDICTOR_NONE;
+  tiled = false;
+  blockWidth = 0;
+  blockHeight = 0;
+  left = 0.0;
+  top = 0.0;
+  pixelWidth = 1.0;
+  pixelHeight = 1.0;
+  noDataFound = false;
+  noData = 0.0;
+}
+
+// ====================================================================
+// Low level access
+
+bool geoTiff::isTiff( const char* data, size_t size )
+{
+  return ( size >= 4 )
+      && ( ( memcmp( data, "II\x2a\x00", 4 ) == 0 ) || ( memcmp( data, "MM\x00\x2a", 4 ) == 0 ) );
+}
+
+// --------------------------------------------------------------------
+
+UINT64 geoTiff::read16( size_t pos ) const
+{
+  if( pos + 2 > fileSize )
+  {
+    throw invalid_argument( "Unexpected end of TIFF file" );
+  }
+  const unsigned char* p = fileData + pos;
+  return bigEndian ? ( ( p[0] << 8 ) | p[1] ) : ( ( p[1] << 8 ) | p[0] );
+}
+
+// --------------------------------------------------------------------
+
+UINT64 geoTiff::read32( size_t pos ) const
+{
+  if( pos + 4 > fileSize )
+  {
+    throw invalid_argument( "Unexpected end of TIFF file" );
+  }
+  const unsigned char* p = fileData + pos;
+  if( bigEndian )
+  {
+    return ( static_cast<UINT64>( p[0] ) << 24 ) | ( p[1] << 16 ) | ( p[2] << 8 ) | p[3];
+  }
+  return ( static_cast<UINT64>( p[3] ) << 24 ) | ( p[2] << 16 ) | ( p[1] << 8 ) | p[0];
+}
+
+// --------------------------------------------------------------------
+
+const struct geoTiff::tiffTag* geoTiff::findTag( unsigned int tag ) const
+{
+  for( auto& t : tags )
+  {
+    if( t.tag == tag )
+    {
+      return &t;
+    }
+  }
+  return NULL;
+}
+
+// --------------------------------------------------------------------
+
+vector<UINT64> geoTiff::getIntegers( unsigned int tag ) const
+{
+  vector<UINT64> result;
+  const struct tiffTag* t = findTag( tag );
+  if( t != NULL )
+  {
+    for( UINT64 i=0; i<t->count; i++ )
+    {
+      if( t->type == TYPE_SHORT )
+      {
+        result.push_back( read16( t->valuePos + ( i * 2 ) ) );
+      }
+      else if( t->type == TYPE_LONG )
+      {
+        result.push_back( read32( t->valuePos + ( i * 4 ) ) );
+      }
+      else
+      {
+        throw invalid_argument( "Unexpected TIFF field type for tag " + to_string( tag ) );
+      }
+    }
+  }
+  return result;
+}
+
+// --------------------------------------------------------------------
+
+vector<double> geoTiff::getDoubles( unsigned int tag ) const
+{
+  vector<double> result;
+  const struct tiffTag* t = findTag( tag );
+  if( t != NULL )
+  {
+    if( t->type != TYPE_DOUBLE )
+    {
+      throw invalid_argument( "Unexpected TIFF field type for tag " + to_string( tag ) );
+    }
+    for( UINT64 i=0; i<t->count; i++ )
+    {
+      UINT64 bits = ( read32( t->valuePos + ( i * 8 ) + ( bigEndian ? 0 : 4 ) ) << 32 )
+                  | read32( t->valuePos + ( i * 8 ) + ( bigEndian ? 4 : 0 ) );
+      double d;
+      memcpy( &d, &bits, sizeof( d ) );
+      result.push_back( d );
+    }
+  }
+  return result;
+}
+
+// --------------------------------------------------------------------
+
+string geoTiff::getString( unsigned int tag ) const
+{
+  string result;
+  const struct tiffTag* t = findTag( tag );
+  if( ( t != NULL ) && ( t->type == TYPE_ASCII ) && ( t->valuePos + t->count <= fileSize ) )
+  {
+    result.assign( reinterpret_cast<const char*>( fileData + t->valuePos ), t->count );
+    result = result.substr( 0, result.find( '\0' ) );
+  }
+  return result;
+}
+
+// ====================================================================
+// Header
+
+struct returnResult geoTiff::open( const char* data, size_t size )
+{
+  struct returnResult res = { true, "" };
+
+  fileData = reinterpret_cast<const unsigned char*>( data );
+  fileSize = size;
+  tags.clear();
+
+  try
+  {
+    if( isTiff( data, size ) == false )
+    {
+      if( ( size >= 4 ) && ( ( data[2] == 0x2b ) || ( data[3] == 0x2b ) ) )
+      {
+        throw invalid_argument( "BigTIFF files are not supported" );
+      }
+      throw invalid_argument( "Not a TIFF file" );
+    }
+    bigEndian = ( data[0] == 'M' );
+
+    // Image file directory, only the first image is used
+    size_t ifd = read32( 4 );
+    unsigned int entries = read16( ifd );
+    for( unsigned int i=0; i<entries; i++ )
+    {
+      size_t entry = ifd + 2 + ( i * 12 );
+      struct tiffTag t;
+      t.tag = read16( entry );
+      t.type = read16( entry + 2 );
+      t.count = read32( entry + 4 );
+      UINT64 bytes = t.count * typeSize( t.type );
+      // Values that fit in 4 bytes are stored in the entry itself
+      t.valuePos = ( bytes <= 4 ) ? entry + 8 : read32( entry + 8 );
+      if( t.valuePos + bytes > fileSize )
+      {
+        throw invalid_argument( "TIFF tag " + to_string( t.tag ) + " points past the end of the file" );
+      }
+      tags.push_back( t );
+    }
+
+    // Image layout
+    vector<UINT64> v;
+    v = getIntegers( TAG_IMAGE_WIDTH );
+    width = v.empty() ? 0 : v[0];
+    v = getIntegers( TAG_IMAGE_LENGTH );
+    height = v.empty() ? 0 : v[0];
+    if( ( width == 0 ) || ( height == 0 ) )
+    {
+      throw invalid_argument( "Missing TIFF image size" );
+    }
+
+    v = getIntegers( TAG_SAMPLES_PER_PIXEL );
+    if( !v.empty() && ( v[0] != 1 ) )
+    {
+      throw invalid_argument( "Only single band TIFF files are supported" );
+    }
+    v = getIntegers( TAG_BITS_PER_SAMPLE );
+    UINT64 bits = v.empty() ? 1 : v[0];
+    v = getIntegers( TAG_SAMPLE_FORMAT );
+    UINT64 format = v.empty() ? 1 : v[0];
+    if( ( bits != 32 ) || ( format != 3 ) )
+    {
+      throw invalid_argument( "Only 32 bit floating point TIFF files are supported" );
+    }
+    v = getIntegers( TAG_PLANAR_CONFIGURATION );
+    if( !v.empty() && ( v[0] != 1 ) && ( v[0] != 2 ) )
+    {
+      throw invalid_argument( "Unsupported TIFF planar configuration" );
+    }
+
+    v = getIntegers( TAG_COMPRESSION );
+    compression = v.empty() ? COMPRESSION_NONE : v[0];
+    if( ( compression != COMPRESSION_NONE ) && ( compression != COMPRESSION_DEFLATE )
+     && ( compression != COMPRESSION_DEFLATE_OLD ) )
+    {
+      throw invalid_argument( "Unsupported TIFF compression: " + to_string( compression ) );
+    }
+    v = getIntegers( TAG_PREDICTOR );
+    predictor = v.empty() ? PREDICTOR_NONE : v[0];
+    if( ( predictor != PREDICTOR_NONE ) && ( predictor != PREDICTOR_FLOATING_POINT ) )
+    {
+      throw invalid_argument( "Unsupported TIFF predictor: " + to_string( predictor ) );
+    }
+
+    tiled = ( findTag( TAG_TILE_WIDTH ) != NULL );
+    if( tiled == true )
+    {
+      v = getIntegers( TAG_TILE_WIDTH );
+      blockWidth = v.empty() ? 0 : v[0];
+      v = getIntegers( TAG_TILE_LENGTH );
+      blockHeight = v.empty() ? 0 : v[0];
+      blockOffsets = getIntegers( TAG_TILE_OFFSETS );
+      blockByteCounts = getIntegers( TAG_TILE_BYTE_COUNTS );
+    }
+    else
+    {
+      blockWidth = width;
+      v = getIntegers( TAG_ROWS_PER_STRIP );
+      blockHeight = v.empty() ? height : min<UINT64>( v[0], height );
+      blockOffsets = getIntegers( TAG_STRIP_OFFSETS );
+      blockByteCounts = getIntegers( TAG_STRIP_BYTE_COUNTS );
+    }
+    if( ( blockWidth == 0 ) || ( blockHeight == 0 ) )
+    {
+      throw invalid_argument( "Invalid TIFF strip / tile size" );
+    }
+    UINT64 across = ( width + blockWidth - 1 ) / blockWidth;
+    UINT64 down = ( height + blockHeight - 1 ) / blockHeight;
+    if( ( blockOffsets.size() < across * down ) || ( blockByteCounts.size() < across * down ) )
+    {
+      throw invalid_argument( "Missing TIFF strip / tile offsets" );
+    }
+
+    // Georeferencing, from a tie point and pixel scale or a transformation matrix
+    vector<double> scale = getDoubles( TAG_MODEL_PIXEL_SCALE );
+    vector<double> tiepoint = getDoubles( TAG_MODEL_TIEPOINT );
+    vector<double> matrix = getDoubles( TAG_MODEL_TRANSFORMATION );
+    if( ( scale.size() >= 2 ) && ( tiepoint.size() >= 6 ) )
+    {
+      pixelWidth = scale[0];
+      pixelHeight = scale[1];
+      left = tiepoint[3] - ( tiepoint[0] * pixelWidth );
+      top = tiepoint[4] + ( tiepoint[1] * pixelHeight );
+    }
+    else if( matrix.size() >= 16 )
+    {
+      if( ( matrix[1] != 0.0 ) || ( matrix[4] != 0.0 ) )
+      {
+        throw invalid_argument( "Rotated GeoTIFF files are not supported" );
+      }
+      pixelWidth = matrix[0];
+      pixelHeight = -matrix[5];
+      left = matrix[3];
+      top = matrix[7];
+    }
+    else
+    {
+      throw invalid_argument( "Missing GeoTIFF georeferencing" );
+    }
+    if( ( pixelWidth <= 0.0 ) || ( pixelHeight <= 0.0 ) )
+    {
+      throw invalid_argument( "Invalid GeoTIFF pixel size" );
+    }
+
+    // GeoKey directory is a list of shorts: header of 4 then 4 per key
+    vector<UINT64> keys = getIntegers( TAG_GEO_KEY_DIRECTORY );
+    for( size_t k=4; k+3<keys.size(); k+=4 )
+    {
+      // Tie points for "PixelIsPoint" rasters refer to the centre of the pixel
+      if( ( keys[k] == KEY_RASTER_TYPE ) && ( keys[k+1] == 0 )
+       && ( keys[k+3] == RASTER_PIXEL_IS_POINT ) )
+      {
+        left -= pixelWidth / 2.0;
+        top += pixelHeight / 2.0;
+      }
+    }
+
+    string nodata = getString( TAG_GDAL_NODATA );
+    noDataFound = !nodata.empty();
+    if( noDataFound == true )
+    {
+      noData = strtod( nodata.c_str(), NULL );
+    }
+  }
+  catch( const std::invalid_argument& e )
+  {
+    res.result = false;
+    res.reason = e.what();
+  }
+
+  return res;
+}
+
+// ====================================================================
+// Decoding
+
+void geoTiff::decodeTile( unsigned int index, unsigned int rows, vector<float>& out,
+                          vector<unsigned char>& buffer ) const
+{
+  size_t rowBytes = static_cast<size_t>( blockWidth ) * 4;
+  size_t expected = rowBytes * rows;
+  UINT64 offset = blockOffsets[ index ];
+  UINT64 length = blockByteCounts[ index ];
+  if( offset + length > fileSize )
+  {
+    throw invalid_argument( "TIFF strip / tile points past the end of the file" );
+  }
+
+  const unsigned char* raw;
+  if( compression == COMPRESSION_NONE )
+  {
+    if( length < expected )
+    {
+      throw invalid_argument( "TIFF strip / tile is too short" );
+    }
+    raw = fileData + offset;
+  }
+  else
+  {
+    unsigned char* inflated = NULL;
+    size_t inflatedSize = 0;
+    unsigned error = lodepng_zlib_decompress( &inflated, &inflatedSize, fileData + offset, length,
+                                              &lodepng_default_decompress_settings );
+    if( ( error != 0 ) || ( inflatedSize < expected ) )
+    {
+      free( inflated );
+      throw invalid_argument( string( "Error decompressing TIFF data: " )
+                              + ( error ? lodepng_error_text( error ) : "too short" ) );
+    }
+    buffer.assign( inflated, inflated + expected );
+    free( inflated );
+    raw = buffer.data();
+  }
+
+  out.resize( static_cast<size_t>( blockWidth ) * rows );
+  vector<unsigned char> row( rowBytes );
+  for( unsigned int r=0; r<rows; r++ )
+  {
+    const unsigned char* src = raw + ( r * rowBytes );
+    float* dst = &out[ static_cast<size_t>( r ) * blockWidth ];
+    if( predictor == PREDICTOR_FLOATING_POINT )
+    {
+      // Undo the byte differencing, then the bytes are grouped by
+      // significance, most significant first
+      unsigned char sum = 0;
+      for( size_t i=0; i<rowBytes; i++ )
+      {
+        sum += src[i];
+        row[i] = sum;
+      }
+      for( unsigned int c=0; c<blockWidth; c++ )
+      {
+        UINT32 bits = ( static_cast<UINT32>( row[c] ) << 24 )
+                    | ( row[ blockWidth + c ] << 16 )
+                    | ( row[ ( 2 * blockWidth ) + c ] << 8 )
+                    | row[ ( 3 * blockWidth ) + c ];
+        memcpy( &dst[c], &bits, 4 );
+      }
+    }
+    else
+    {
+      for( unsigned int c=0; c<blockWidth; c++ )
+      {
+        const unsigned char* b = src + ( c * 4 );
+        UINT32 bits = bigEndian ? ( ( static_cast<UINT32>( b[0] ) << 24 ) | ( b[1] << 16 ) | ( b[2] << 8 ) | b[3] )
+                                : ( ( static_cast<UINT32>( b[3] ) << 24 ) | ( b[2] << 16 ) | ( b[1] << 8 ) | b[0] );
+        memcpy( &dst[c], &bits, 4 );
+      }
+    }
+  }
+}
+
+// --------------------------------------------------------------------
+
+void geoTiff::decodeBlock( unsigned int block, struct geoTiffCache& cache ) const
+{
+  cache.block = -1;
+  cache.firstRow = block * blockHeight;
+  cache.rows = min( blockHeight, height - cache.firstRow );
+  cache.values.resize( static_cast<size_t>( width ) * cache.rows );
+
+  unsigned int across = ( width + blockWidth - 1 ) / blockWidth;
+  // Tiles are always full size, strips may be short at the bottom
+  unsigned int tileRows = ( tiled == true ) ? blockHeight : cache.rows;
+  vector<float> tile;
+  vector<unsigned char> buffer;
+  for( unsigned int t=0; t<across; t++ )
+  {
+    decodeTile( ( block * across ) + t, tileRows, tile, buffer );
+    unsigned int firstCol = t * blockWidth;
+    unsigned int cols = min( blockWidth, width - firstCol );
+    for( unsigned int r=0; r<cache.rows; r++ )
+    {
+      memcpy( &cache.values[ ( static_cast<size_t>( r ) * width ) + firstCol ],
+              &tile[ static_cast<size_t>( r ) * blockWidth ], cols * sizeof( float ) );
+    }
+  }
+  cache.block = block;
+}
+
+// --------------------------------------------------------------------
+
+void geoTiff::readRow( unsigned int row, unsigned int col, unsigned int count, float* out,
+                       struct geoTiffCache& cache ) const
+{
+  if( ( row >= height ) || ( col + count > width ) )
+  {
+    throw invalid_argument( "TIFF row out of range" );
+  }
+  unsigned int block = row / blockHeight;
+  if( cache.block != static_cast<long>( block ) )
+  {
+    decodeBlock( block, cache );
+  }
+  memcpy( out, &cache.values[ ( static_cast<size_t>( row - cache.firstRow ) * width ) + col ],
+          count * sizeof( float ) );
+}
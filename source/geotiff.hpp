@@ -0,0 +1,161 @@
+// geotiff.hpp - header file for geotiff
+// Copyright (C) 2018 John Davies
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef GEOTIFF_H
+#define GEOTIFF_H
+
+#include "util.hpp"
+#include <string>
+#include <vector>
+#include <cstddef>
+
+using namespace std;
+
+/// Holds the most recently decoded strip, or row of tiles, so that
+/// consecutive rows don't decode the same data again. Use one per thread.
+///
+struct geoTiffCache {
+  long block = -1;
+  unsigned int firstRow = 0;
+  unsigned int rows = 0;
+  vector<float> values;
+};
+
+/// Decoder for single band, 32 bit floating point GeoTIFF elevation files,
+/// e.g. the DSM / DTM files published by Ordnance Survey and Natural
+/// Resources Wales. Strip and tiled layouts are supported, either
+/// uncompressed or deflate compressed ( with or without the floating
+/// point predictor ). The file contents must stay in memory while the
+/// decoder is in use.
+///
+
+class geoTiff
+{
+  // File contents
+  const unsigned char* fileData;
+  size_t fileSize;
+  bool bigEndian;
+
+  // Image layout
+  unsigned int width;
+  unsigned int height;
+  unsigned int compression;
+  unsigned int predictor;
+  bool tiled;
+  unsigned int blockWidth;
+  unsigned int blockHeight;
+  vector<UINT64> blockOffsets;
+  vector<UINT64> blockByteCounts;
+
+  // Georeferencing
+  double left;
+  double top;
+  double pixelWidth;
+  double pixelHeight;
+  bool noDataFound;
+  double noData;
+
+  // Directory entry
+  struct tiffTag {
+    unsigned int tag;
+    unsigned int type;
+    UINT64 count;
+    size_t valuePos;
+  };
+  vector<struct tiffTag> tags;
+
+  UINT64 read16( size_t pos ) const;
+  UINT64 read32( size_t pos ) const;
+  const struct tiffTag* findTag( unsigned int tag ) const;
+  vector<UINT64> getIntegers( unsigned int tag ) const;
+  vector<double> getDoubles( unsigned int tag ) const;
+  string getString( unsigned int tag ) const;
+
+  /// Decode strip / tile row "block" into "cache". Throws invalid_argument.
+  ///
+  void decodeBlock( unsigned int block, struct geoTiffCache& cache ) const;
+
+  /// Decode one strip or tile into "out" ( blockWidth values per row ).
+  /// Throws invalid_argument.
+  ///
+  void decodeTile( unsigned int index, unsigned int rows, vector<float>& out,
+                   vector<unsigned char>& buffer ) const;
+
+public:
+
+  /// Constructor
+  ///
+  geoTiff( void );
+
+  /// Parse the header and first image directory of a GeoTIFF file
+  /// @param[in] data : file contents
+  /// @param[in] size : number of bytes in "data"
+  /// @return Success/fail & error message
+  ///
+  struct returnResult open( const char* data, size_t size );
+
+  /// Check whether a buffer starts with a TIFF signature
+  /// @param[in] data : file contents
+  /// @param[in] size : number of bytes in "data"
+  /// @return true if it looks like a TIFF file
+  ///
+  static bool isTiff( const char* data, size_t size );
+
+  /// @return Image width in pixels
+  ///
+  unsigned int getWidth( void ) const { return width; }
+
+  /// @return Image height in pixels
+  ///
+  unsigned int getHeight( void ) const { return height; }
+
+  /// @return X coordinate of the western edge of the image
+  ///
+  double getLeft( void ) const { return left; }
+
+  /// @return Y coordinate of the northern edge of the image
+  ///
+  double getTop( void ) const { return top; }
+
+  /// @return Width of a pixel in world units
+  ///
+  double getPixelWidth( void ) const { return pixelWidth; }
+
+  /// @return Height of a pixel in world units
+  ///
+  double getPixelHeight( void ) const { return pixelHeight; }
+
+  /// @return true if the file specifies a NODATA value
+  ///
+  bool hasNoData( void ) const { return noDataFound; }
+
+  /// @return NODATA value ( only valid if "hasNoData" )
+  ///
+  double getNoData( void ) const { return noData; }
+
+  /// Read part of an image row. Throws invalid_argument on any error.
+  /// @param[in] row : image row, 0 is the northern edge
+  /// @param[in] col : first column
+  /// @param[in] count : number of values
+  /// @param[out] out : values
+  /// @param[in,out] cache : decoded data kept between calls
+  ///
+  void readRow( unsigned int row, unsigned int col, unsigned int count, float* out,
+                struct geoTiffCache& cache ) const;
+
+};
+
+#endif
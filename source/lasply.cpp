@@ -0,0 +1,275 @@
+// lasply.cpp - Convert LAS point clouds to PLY point clouds
+// Copyright (C) 2018 John Davies
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "lasply.hpp"
+#include "lidarlas.hpp"
+#include "mappedfile.hpp"
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+// Number of points converted between writes, this bounds the memory used
+static const UINT64 LAS_PLY_CHUNK = 1 << 20;
+
+// Little endian output, independent of the local machine
+static inline unsigned char* putFloat( unsigned char* p, float f )
+{
+  UINT32 bits;
+  memcpy( &bits, &f, 4 );
+  p[0] = bits & 0xff;
+  p[1] = ( bits >> 8 ) & 0xff;
+  p[2] = ( bits >> 16 ) & 0xff;
+  p[3] = bits >> 24;
+  return p + 4;
+}
+
+// ====================================================================
+// Constructor
+
+lasPly::lasPly( void )
+{
+  intensityEnabled = false;
+  classificationEnabled = false;
+  xOffset = 0.0;
+  yOffset = 0.0;
+  zOffset = 0.0;
+}
+
+// ====================================================================
+// Options
+
+void lasPly::setIntensity( bool enable )
+{
+  intensityEnabled = enable;
+}
+
+// --------------------------------------------------------------------
+
+void lasPly::setClassification( bool enable )
+{
+  classificationEnabled = enable;
+}
+
+// --------------------------------------------------------------------
+
+void lasPly::setClassFilter( const vector<unsigned int>& codes )
+{
+  classes.clear();
+  if( !codes.empty() )
+  {
+    classes.assign( 256, false );
+    for( auto c : codes )
+    {
+      if( c < classes.size() )
+      {
+        classes[c] = true;
+      }
+    }
+  }
+}
+
+// --------------------------------------------------------------------
+
+void lasPly::setOffset( float x, float y, float z )
+{
+  xOffset = x;
+  yOffset = y;
+  zOffset = z;
+}
+
+// ====================================================================
+// Conversion
+
+struct returnResult lasPly::convert( const string lasFileName, const string plyFileName )
+{
+  struct returnResult res = { true, "" };
+
+  mappedFile inputFile;
+  res = inputFile.open( lasFileName );
+  if( res.result == false )
+  {
+    return res;
+  }
+  lidarLas las;
+  res = las.open( inputFile.data(), inputFile.size() );
+  if( res.result == false )
+  {
+    res.reason = "Error reading LAS file: " + lasFileName + "\n" + res.reason;
+    return res;
+  }
+
+  UINT64 points = las.getPointCount();
+  unsigned int threads = defaultThreadCount();
+  auto wanted = [&]( const struct lasPoint& p )
+  {
+    return ( p.withheld == false ) && ( classes.empty() || classes[ p.classification ] );
+  };
+
+  // The vertex count goes in the header so the points are counted first.
+  // The colour and intensity ranges are found at the same time.
+  vector<UINT64> counts( threads, 0 );
+  vector<unsigned int> maxIntensity( threads, 0 );
+  vector<unsigned int> maxColour( threads, 0 );
+  parallelFor( threads, threads, [&]( unsigned int first, unsigned int last )
+  {
+    for( unsigned int t=first; t<last; t++ )
+    {
+      struct lasPoint p;
+      for( UINT64 i=( points * t ) / threads; i<( points * ( t + 1 ) ) / threads; i++ )
+      {
+        las.getPoint( i, p );
+        if( wanted( p ) )
+        {
+          counts[t]++;
+          maxIntensity[t] = max( maxIntensity[t], p.intensity );
+          maxColour[t] = max( maxColour[t], max( p.red, max( p.green, p.blue ) ) );
+        }
+      }
+    }
+  } );
+  UINT64 vertexCount = 0;
+  unsigned int intensityRange = 0;
+  unsigned int colourRange = 0;
+  for( unsigned int t=0; t<threads; t++ )
+  {
+    vertexCount += counts[t];
+    intensityRange = max( intensityRange, maxIntensity[t] );
+    colourRange = max( colourRange, maxColour[t] );
+  }
+  // Some files store 8 bit colours in the 16 bit fields
+  unsigned int colourShift = ( colourRange > 255 ) ? 8 : 0;
+  bool colour = las.hasColour();
+
+  // Same properties as a "lidarply" vertex plus the optional extras
+  stringstream header;
+  header << PLY << endl;
+  header << FORMAT << " binary_little_endian 1.0" << endl;
+  header << COMMENT << " created using \"basicply\" library" << endl;
+  header << ELEMENT << " vertex " << vertexCount << endl;
+  header << PROPERTY << " float x" << endl;
+  header << PROPERTY << " float y" << endl;
+  header << PROPERTY << " float z" << endl;
+  header << PROPERTY << " uchar red" << endl;
+  header << PROPERTY << " uchar green" << endl;
+  header << PROPERTY << " uchar blue" << endl;
+  header << PROPERTY << " float nx" << endl;
+  header << PROPERTY << " float ny" << endl;
+  header << PROPERTY << " float nz" << endl;
+  size_t vertexSize = 27;
+  if( intensityEnabled == true )
+  {
+    header << PROPERTY << " ushort intensity" << endl;
+    vertexSize += 2;
+  }
+  if( classificationEnabled == true )
+  {
+    header << PROPERTY << " uchar classification" << endl;
+    vertexSize += 1;
+  }
+  header << END_HEADER << endl;
+
+  // Coordinates are relative to the corner so that floats keep the precision
+  double xOrigin = floor( las.getMinX() ) - xOffset;
+  double yOrigin = floor( las.getMinY() ) - yOffset;
+
+  ofstream outputFile;
+  outputFile.exceptions( ofstream::failbit | ofstream::badbit );
+  try
+  {
+    outputFile.open( plyFileName.c_str(), ios::out | ios::binary );
+    outputFile << header.str();
+
+    // Each thread converts its share of a chunk into its own buffer, the
+    // buffers are then written in order
+    vector< vector<unsigned char> > buffers( threads );
+    for( UINT64 start=0; start<points; start+=LAS_PLY_CHUNK )
+    {
+      UINT64 chunk = min( LAS_PLY_CHUNK, points - start );
+      parallelFor( threads, threads, [&]( unsigned int first, unsigned int last )
+      {
+        for( unsigned int t=first; t<last; t++ )
+        {
+          UINT64 begin = start + ( ( chunk * t ) / threads );
+          UINT64 end = start + ( ( chunk * ( t + 1 ) ) / threads );
+          vector<unsigned char>& buffer = buffers[t];
+          buffer.resize( ( end - begin ) * vertexSize );
+          unsigned char* out = buffer.data();
+          struct lasPoint p;
+          for( UINT64 i=begin; i<end; i++ )
+          {
+            las.getPoint( i, p );
+            if( !wanted( p ) )
+            {
+              continue;
+            }
+            out = putFloat( out, static_cast<float>( p.x - xOrigin ) );
+            out = putFloat( out, static_cast<float>( p.y - yOrigin ) );
+            out = putFloat( out, static_cast<float>( p.z + zOffset ) );
+            if( colour == true )
+            {
+              *out++ = ( p.red >> colourShift ) & 0xff;
+              *out++ = ( p.green >> colourShift ) & 0xff;
+              *out++ = ( p.blue >> colourShift ) & 0xff;
+            }
+            else
+            {
+              // Grey scale based on intensity
+              unsigned char grey = ( intensityRange > 0 ) ? ( p.intensity * 255 ) / intensityRange : 128;
+              *out++ = grey;
+              *out++ = grey;
+              *out++ = grey;
+            }
+            // Vertex normals, note that these are set to point upwards
+            out = putFloat( out, 0.0f );
+            out = putFloat( out, 0.0f );
+            out = putFloat( out, 1.0f );
+            if( intensityEnabled == true )
+            {
+              *out++ = p.intensity & 0xff;
+              *out++ = ( p.intensity >> 8 ) & 0xff;
+            }
+            if( classificationEnabled == true )
+            {
+              *out++ = p.classification;
+            }
+          }
+          buffer.resize( out - buffer.data() );
+        }
+      } );
+      for( auto& b : buffers )
+      {
+        outputFile.write( reinterpret_cast<const char*>( b.data() ), b.size() );
+      }
+    }
+
+    outputFile.close();
+  }
+  catch( const ofstream::failure& e )
+  {
+    res.result = false;
+    res.reason = "Error processing file: " + plyFileName + "\n" + e.what();
+  }
+
+  return res;
+}
@@ -0,0 +1,82 @@
+// lasply.hpp - header file for lasply
+// Copyright (C) 2018 John Davies
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LASPLY_H
+#define LASPLY_H
+
+#include "util.hpp"
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/// Converts the points of a LAS file straight to a binary PLY point cloud
+/// without building a grid or a PLY model in memory. The vertices have the
+/// same properties as "lidarply" vertices, optionally followed by
+///   - intensity as ushort
+///   - classification as uchar
+/// Points are coloured from the LAS file if it has colours, otherwise by
+/// intensity. Coordinates are relative to the lower left hand corner of
+/// the points, rounded down to a whole metre, plus the offsets.
+///
+
+class lasPly
+{
+  bool intensityEnabled;
+  bool classificationEnabled;
+  vector<bool> classes;
+  float xOffset;
+  float yOffset;
+  float zOffset;
+
+public:
+
+  /// Constructor, all points are written without the extra properties
+  ///
+  lasPly( void );
+
+  /// Add an intensity property to each vertex
+  /// @param[in] enable : true to add the property
+  ///
+  void setIntensity( bool enable );
+
+  /// Add a classification property to each vertex
+  /// @param[in] enable : true to add the property
+  ///
+  void setClassification( bool enable );
+
+  /// Only write points with these classification codes, e.g. 2 for ground
+  /// @param[in] codes : classification codes, empty to write all points
+  ///
+  void setClassFilter( const vector<unsigned int>& codes );
+
+  /// Offset added to every point
+  /// @param[in] x : X axis offset
+  /// @param[in] y : Y axis offset
+  /// @param[in] z : Z axis offset
+  ///
+  void setOffset( float x, float y, float z );
+
+  /// Convert a LAS file. Withheld points are skipped.
+  /// @param[in] lasFileName : path to LAS file
+  /// @param[in] plyFileName : path to PLY file to create
+  /// @return Success/fail & error message
+  ///
+  struct returnResult convert( const string lasFileName, const string plyFileName );
+
+};
+
+#endif
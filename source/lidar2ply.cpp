@@ -7,15 +7,34 @@
 // lidar2ply.lua -f <input file> [ options]
 //          <input file> : LiDAR file
 // Options: -i <image file> : specify image overlay
+//          -t <LiDAR file> : subtract this file, e.g. a DTM from a DSM
+//          -v <x>,<y>[,<height>] : darken the parts that can't be seen from x,y
 //          -x <value> : add X axis offset to PLY model
 //          -y <value> : add Y axis offset to PLY model
 //          -z <value> : add Z axis offset to PLY model
 //
-// lidar2ply -l <list file>
+// lidar2ply -l <list file> [ options]
 //          <list file> : text file containing a list of LiDAR/image files
+// Options: -g <image file>[,<minX>,<minY>,<maxX>,<maxY>] : one image overlay for all the files
 //
 // General options:  -a : auto fill NODATA values
 //                   -m : create an output mesh
+//                   -c : cache LiDAR files in binary form
+//                   -d <factor> : reduce resolution by <factor>
+//                   -r <size> : cell size for LAS point cloud files
+//                   -b <rule> : gridding rule for LAS files ( min, max, mean or last )
+//                   -s <size> : resample to cell size <size>
+//                   -o <type> : colour by hillshade, slope, aspect or flow when there is no image
+//                   -n <interval> : write contour lines every <interval> m
+//                   -u <level or file> : report cut and fill volumes instead of creating a model
+//                   -j <profile file> : write elevation profiles instead of creating a model
+//                   -w <step> : distance between profile points
+//
+// lidar2ply -p <LAS file> [ options]
+//          <LAS file> : point cloud to write as PLY points without gridding
+// Options: -k <codes> : only write points with these classifications, e.g. 2,9
+//          -e : add intensity and classification properties
+//          -x / -y / -z <value> : as above
 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -33,11 +52,22 @@
 #include <unistd.h>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <climits>
+#include <cmath>
+#include <iomanip>
+#include <stdexcept>
+#include <new>
 #include "lidarlib.hpp"
 #include "util.hpp"
 #include "lidarply.hpp"
 #include "lidarimage.hpp"
+#include "lasply.hpp"
+#include "lidarterrain.hpp"
+#include "lidarcontour.hpp"
+#include "lidarviewshed.hpp"
+#include "lidarvolume.hpp"
+#include "lidardrainage.hpp"
 
 using namespace std;
 
@@ -47,6 +77,9 @@ bool inputFileOpt = false;
 char *inputFileName = NULL;
 bool imageFileOpt = false;
 char *imageFileName = NULL;
+bool mosaicOpt = false;
+string mosaicFileName;
+vector<double> mosaicExtent;
 bool xOffsetOpt = false;
 float xOffset = 0.0;
 bool yOffsetOpt = false;
@@ -57,6 +90,29 @@ bool listFileOpt = false;
 char *listFileName = NULL;
 bool autofillOpt = false;
 bool meshOpt = false;
+bool cacheOpt = false;
+unsigned int decimateFactor = 1;
+float binCellsize = 1.0;
+enum lidarBinning binRule = BIN_MAX;
+bool resampleOpt = false;
+float resampleCellsize = 0.0;
+bool pointCloudOpt = false;
+char *pointCloudFileName = NULL;
+vector<unsigned int> classCodes;
+bool extraOpt = false;
+bool contourOpt = false;
+float contourInterval = 0.0;
+bool viewshedOpt = false;
+vector<double> viewshedPoint;
+bool volumeOpt = false;
+char *volumeBase = NULL;
+bool profileOpt = false;
+char *profileFileName = NULL;
+double profileStep = 1.0;
+bool baseFileOpt = false;
+char *baseFileName = NULL;
+enum terrainType { TERRAIN_NONE, TERRAIN_HILLSHADE, TERRAIN_SLOPE, TERRAIN_ASPECT, TERRAIN_FLOW };
+enum terrainType terrainOverlay = TERRAIN_NONE;
 bool parseCheck = true;
 
 // ------------------------------------------------------------------------
@@ -69,15 +125,161 @@ void printHelp( void )
   cout << "lidar2ply -f <input file> [ options]" << endl;
   cout << "             <input file> : LiDAR file" << endl;
   cout << "Options: -i <image file> : specify image overlay" << endl;
-  cout << "         ( image must be in Imagemagick text format )" << endl;
+  cout << "         ( PNG image, stretched to fit the LiDAR file )" << endl;
+  cout << "         -t <LiDAR file> : subtract this file from the input file, e.g. a terrain model ( DTM )" << endl;
+  cout << "                           from a surface model ( DSM ) to give building and tree heights" << endl;
+  cout << "         -v <x>,<y>[,<height>] : darken the parts of the model that can't be seen from x,y" << endl;
+  cout << "                                 ( grid coordinates ) at <height> m above the ground, default 1.7" << endl;
   cout << "         -x <value> : add X axis offset to PLY model" << endl;
   cout << "         -y <value> : add Y axis offset to PLY model" << endl;
   cout << "         -z <value> : add Z axis offset to PLY model" << endl;
   cout << endl;
-  cout << "lidar2ply -l <list file>" << endl;
+  cout << "lidar2ply -p <LAS file> [ options]" << endl;
+  cout << "             <LAS file> : point cloud to write as PLY points without gridding" << endl;
+  cout << "Options: -k <codes> : only write points with these classifications, e.g. 2,9" << endl;
+  cout << "         -e : add intensity and classification properties to each point" << endl;
+  cout << "         -x / -y / -z <value> : as above" << endl;
+  cout << endl;
+  cout << "lidar2ply -l <list file> [ options]" << endl;
   cout << "             <list file> : text file containing a list of LiDAR/image files" << endl;
+  cout << "Options: -g <image file>[,<minX>,<minY>,<maxX>,<maxY>] : one image overlay for all the files" << endl;
+  cout << "         without their own image. The image covers the given area ( grid" << endl;
+  cout << "         coordinates ), the area in a world file ( <image>.pgw ) or else all of the files." << endl;
+  cout << "         Only the rows of the image that cover the current file are decoded and kept, so list" << endl;
+  cout << "         the files from north to south for the image to be read just once" << endl;
   cout << endl;
-  cout << "General options: -m : create an output mesh" << endl;
+  cout << "General options: -a : fill NODATA points from the surrounding data" << endl;
+  cout << "                 -m : create an output mesh" << endl;
+  cout << "                 -c : cache LiDAR files in binary form ( <file>.lgc ) to speed up later runs" << endl;
+  cout << "                 -d <factor> : reduce resolution by <factor>, each block of <factor> x <factor>" << endl;
+  cout << "                               points is replaced by their mean. With -l <factor> must" << endl;
+  cout << "                               divide the number of rows and columns of every file" << endl;
+  cout << "                 -r <size> : cell size ( in m ) used to grid LAS point cloud files, default 1" << endl;
+  cout << "                 -b <rule> : how the points in each cell of a LAS file are combined -" << endl;
+  cout << "                             min, max ( default ), mean or last ( lowest last return )" << endl;
+  cout << "                 -s <size> : resample to a cell size of <size> m. List files with mixed cell sizes" << endl;
+  cout << "                             are resampled to the largest cell size unless this is given" << endl;
+  cout << "                 -o <type> : colour the model by hillshade, slope, aspect or flow ( accumulation )" << endl;
+  cout << "                             where there is no image overlay ( single files also write" << endl;
+  cout << "                             <file>.<type>.png )" << endl;
+  cout << "                 -n <interval> : write contour lines every <interval> m as PLY edges" << endl;
+  cout << "                                 to <file>.contours.ply" << endl;
+  cout << "                 -u <level or file> : report the cut and fill volumes between the LiDAR data" << endl;
+  cout << "                                      and a level, or a second file covering the same area." << endl;
+  cout << "                                      With -l the second file is a list file of matching tiles" << endl;
+  cout << "                 -j <profile file> : write elevation profiles along lines to <profile file>.csv" << endl;
+  cout << "                                     instead of creating a model. Each line of the file is a" << endl;
+  cout << "                                     line to profile, \"x,y x,y ...\" in grid coordinates" << endl;
+  cout << "                 -w <step> : distance ( in m ) between profile points, default 1" << endl;
+}
+
+// ------------------------------------------------------------------------
+
+vector< vector<string> > readListFile( const string fileName )
+{
+  ifstream listFile;
+  string inputLine;
+
+  // Build list of files & images ( if necessary )
+  vector< vector<string> > fileList;
+  listFile.open( fileName, ios::in );
+  if( !listFile )
+  {
+    cout << "Could not open file: " << fileName << endl;
+  }
+  while( getline ( listFile, inputLine ) )
+  {
+    // Ignore comment or blank lines
+    if( !inputLine.empty() && inputLine.at(0) != '#' )
+    {
+      // Get file names
+      vector<string> params = split( inputLine, ' ' );
+      // And add to list
+      fileList.push_back( params );
+    }
+  }
+
+  return fileList;
+}
+
+// ------------------------------------------------------------------------
+
+lidarImage* terrainImage( lidar& lidarFile, string pngFileName )
+{
+  lidarTerrain terrain;
+  lidar grid;
+  float minimum = 0.0;
+  float maximum = 255.0;
+
+  // Large grids can run out of memory, and drainage is limited to
+  // 2^32 cells
+  try
+  {
+    switch( terrainOverlay )
+    {
+      case TERRAIN_SLOPE:
+        // Steep slopes dark
+        grid = terrain.slope( lidarFile );
+        minimum = 45.0;
+        maximum = 0.0;
+        break;
+
+      case TERRAIN_ASPECT:
+        grid = terrain.aspect( lidarFile );
+        maximum = 360.0;
+        break;
+
+      case TERRAIN_FLOW:
+      {
+        // Streams bright, on a log scale
+        lidarDrainage drainage;
+        lidar filled = drainage.fillDepressions( lidarFile );
+        lidar direction = drainage.flowDirection( filled );
+        grid = drainage.flowAccumulation( direction );
+        for( unsigned int r=0; r<grid.getNoRows(); r++ )
+        {
+          float* row = grid.getRow( r );
+          for( unsigned int c=0; c<grid.getNoColumns(); c++ )
+          {
+            if( row[c] != grid.getNODATA_value() )
+            {
+              row[c] = log10( row[c] );
+            }
+          }
+        }
+        grid.updateStatistics();
+        maximum = grid.getMaxValue();
+        break;
+      }
+
+      default:
+        grid = terrain.hillshade( lidarFile );
+        break;
+    }
+  }
+  catch( const std::bad_alloc& )
+  {
+    cout << "Could not create terrain overlay: not enough memory" << endl;
+    return NULL;
+  }
+  catch( const std::invalid_argument& e )
+  {
+    cout << "Could not create terrain overlay: " << e.what() << endl;
+    return NULL;
+  }
+
+  lidarImage* image = new lidarImage( grid.getNoColumns(), grid.getNoRows(), 255 );
+  struct returnResult ret = lidarTerrain::toImage( grid, minimum, maximum, *image );
+  if( ( ret.result == true ) && ( pngFileName.empty() == false ) )
+  {
+    ret = lidarTerrain::writePng( grid, minimum, maximum, pngFileName );
+  }
+  if( ret.result == false )
+  {
+    cout << "Could not create terrain overlay: " << ret.reason << endl;
+  }
+
+  return image;
 }
 
 // ------------------------------------------------------------------------
@@ -86,23 +288,39 @@ void processFiles( vector< vector<string> > files, string modelName )
 {
   lidarply model;
   model.setFormat( "binary_little_endian" );
+  lidarply contourModel;
+  contourModel.setFormat( "binary_little_endian" );
 
   struct returnResult ret;
   unsigned int xllMin = UINT_MAX;
   unsigned int yllMin = UINT_MAX;
+  double xurMax = 0.0;
+  double yurMax = 0.0;
+  float cellsizeMax = 0.0;
 
   // First pass to calculate positions
   for ( auto f : files )
   {
+    // Only the header is needed to find the corner positions
     lidar lidarFile;
-    ret = lidarFile.readFromFile( f.at(0) );
+    lidarFile.setPointCloudOptions( binCellsize, binRule );
+    ret = lidarFile.readHeader( f.at(0) );
     if( ret.result == false )
     {
-      cout << "Could not open file: " << inputFileName << " " << endl << ret.reason << endl;
+      cout << "Could not open file: " << f.at(0) << " " << endl << ret.reason << endl;
       break;
     }
 
-    // Loop through the points and copy to PLY file
+    // A partial block at the edge of a decimated tile would overlap the
+    // next tile
+    if( ( files.size() > 1 ) && ( ( lidarFile.getNoColumns() % decimateFactor != 0 )
+                               || ( lidarFile.getNoRows() % decimateFactor != 0 ) ) )
+    {
+      cout << "Reduction factor " << decimateFactor << " doesn't divide the size of "
+           << f.at(0) << " ( " << lidarFile.getNoColumns() << " x " << lidarFile.getNoRows() << " )" << endl;
+      return;
+    }
+
     unsigned int xll = lidarFile.getXllcorner();
     unsigned int yll = lidarFile.getYllcorner();
 
@@ -114,15 +332,56 @@ void processFiles( vector< vector<string> > files, string modelName )
     {
       yllMin = yll;
     }
+    if( lidarFile.getCellsize() * decimateFactor > cellsizeMax )
+    {
+      cellsizeMax = lidarFile.getCellsize() * decimateFactor;
+    }
+    xurMax = max( xurMax, xll + ( (double)lidarFile.getNoColumns() * lidarFile.getCellsize() ) );
+    yurMax = max( yurMax, yll + ( (double)lidarFile.getNoRows() * lidarFile.getCellsize() ) );
   }
   cout << "xllcorner min = " << xllMin << " yllcorner min = " << yllMin << endl;
 
+  // A mosaic overlay is decoded once and sampled for each file
+  lidarImage mosaic;
+  if( mosaicOpt == true )
+  {
+    cout << "Opening mosaic image file: " << mosaicFileName << endl;
+    ret = mosaic.openStream( mosaicFileName );
+    if( ret.result == false )
+    {
+      cout << "Could not open image file: " << mosaicFileName << endl << ret.reason << endl;
+      return;
+    }
+    string worldFileName = mosaicFileName.substr( 0, mosaicFileName.find_last_of( '.' ) ) + ".pgw";
+    if( mosaicExtent.size() == 4 )
+    {
+      mosaic.setExtent( mosaicExtent[0], mosaicExtent[1], mosaicExtent[2], mosaicExtent[3] );
+    }
+    else if( ifstream( worldFileName ).good() == true )
+    {
+      ret = mosaic.readWorldFile( worldFileName );
+      if( ret.result == false )
+      {
+        cout << ret.reason << endl;
+        return;
+      }
+    }
+    else
+    {
+      // Stretched over all the files, as if cut into one piece per file
+      mosaic.setExtent( xllMin, yllMin, xurMax, yurMax );
+    }
+  }
+
+  // Tiles must all have the same cell size to fit together
+  float cellsizeModel = ( resampleOpt == true ) ? resampleCellsize : cellsizeMax;
+
   // Second pass to process the files
   for ( auto f : files )
   {
 
     lidar lidarFile;
-    lidarImage* image;
+    unique_ptr<lidarImage> image;
     bool imageOverlay = false;
 
     cout << "Processing: " << f.at(0) << " ( ";
@@ -131,6 +390,15 @@ void processFiles( vector< vector<string> > files, string modelName )
       cout << f.at(1) << " )" << endl;
       imageOverlay = true;
     }
+    else if( mosaicOpt == true )
+    {
+      cout << " Mosaic overlay )" << endl;
+      imageOverlay = true;
+    }
+    else if( terrainOverlay != TERRAIN_NONE )
+    {
+      cout << " Terrain overlay )" << endl;
+    }
     else
     {
       cout << " No overlay )" << endl;
@@ -138,28 +406,60 @@ void processFiles( vector< vector<string> > files, string modelName )
 
     // Read the LiDAR file
     cout << "  Reading LiDAR file" << endl;
+    lidarFile.setCacheEnabled( cacheOpt );
+    lidarFile.setDecimation( decimateFactor, POOL_MEAN );
+    lidarFile.setPointCloudOptions( binCellsize, binRule );
     ret = lidarFile.readFromFile( f.at(0) );
     if( ret.result == false )
     {
       cout << "Could not open file: " << inputFileName << " " << endl << ret.reason << endl;
       break;
     }
+    if( autofillOpt == true )
+    {
+      cout << "  Filled " << lidarFile.fillGaps( 0 ) << " NODATA points" << endl;
+    }
+    if( fabs( lidarFile.getCellsize() - cellsizeModel ) > 1e-6 )
+    {
+      cout << "  Resampling from " << lidarFile.getCellsize() << "m to " << cellsizeModel << "m" << endl;
+      try
+      {
+        lidarFile = lidarFile.resample( cellsizeModel, INTERPOLATE_BILINEAR );
+      }
+      catch( const std::bad_alloc& )
+      {
+        cout << "Could not resample file: " << f.at(0) << endl << "Not enough memory for the new grid" << endl;
+        return;
+      }
+      catch( const std::invalid_argument& e )
+      {
+        cout << "Could not resample file: " << f.at(0) << endl << e.what() << endl;
+        return;
+      }
+    }
 
     // Loop through the points and copy to PLY file
     unsigned int r = lidarFile.getNoRows();
     unsigned int c = lidarFile.getNoColumns();
-    float noData = lidarFile.getNODATA_value();
     float cellsize = lidarFile.getCellsize();
 
     // Work out offset for tiling
     unsigned int xOff = lidarFile.getXllcorner() - xllMin;
     unsigned int yOff = lidarFile.getYllcorner() - yllMin;
 
+    if( contourOpt == true )
+    {
+      cout << "  Creating contour lines" << endl;
+      lidarContour contours;
+      contours.setLevels( contourInterval, 0.0 );
+      lidarContour::addToModel( contours.extract( lidarFile ), contourModel, xOff, yOff, zOffset );
+    }
+
     // Check if an image overlay is needed
-    if( imageOverlay == true )
+    if( ( imageOverlay == true ) && ( f.size() == 2 ) )
     {
       cout << "  Opening image file" << endl;
-      image = new lidarImage( c, r, 255 );
+      image.reset( new lidarImage( c, r, 255 ) );
       ret = image->readFromFile( f.at(1) );
       if( ret.result == false )
       {
@@ -167,6 +467,30 @@ void processFiles( vector< vector<string> > files, string modelName )
         break;
       }
     }
+    else if( imageOverlay == true )
+    {
+      cout << "  Sampling mosaic image" << endl;
+      image.reset( new lidarImage( c, r, 255 ) );
+      ret = image->sampleFrom( mosaic, lidarFile.getXllcorner(), lidarFile.getYllcorner(), cellsize );
+      if( ret.result == false )
+      {
+        cout << "Could not read image file: " << mosaicFileName << endl << ret.reason << endl;
+        break;
+      }
+      if( mosaic.covers( lidarFile.getXllcorner(), lidarFile.getYllcorner(),
+                         lidarFile.getXllcorner() + ( c * cellsize ),
+                         lidarFile.getYllcorner() + ( r * cellsize ) ) == false )
+      {
+        cout << "  Warning: the mosaic image doesn't cover all of " << f.at(0)
+             << ", the rest is black" << endl;
+      }
+    }
+    else if( terrainOverlay != TERRAIN_NONE )
+    {
+      cout << "  Creating terrain overlay" << endl;
+      image.reset( terrainImage( lidarFile, "" ) );
+      imageOverlay = ( image != nullptr );
+    }
 
     // Write the data
     cout << "  Creating PLY file" << endl;
@@ -174,7 +498,6 @@ void processFiles( vector< vector<string> > files, string modelName )
     unsigned char red = 128;
     unsigned char green = 128;
     unsigned char blue = 128;
-    bool res;
     // Create an array for storing the vertex ids in case a mesh needs
     // to be created
     int** ids;
@@ -196,19 +519,16 @@ void processFiles( vector< vector<string> > files, string modelName )
     // Copy data to model
     for( unsigned int y=0; y<r; y++ )
     {
+      const float* row = lidarFile.getRow( y );
       for( unsigned int x=0; x<c; x++ )
       {
-        res = lidarFile.getValue( x, y, v );
-        if( ( res == true ) && ( v != noData ) )
+        // NODATA points were found while the file was read
+        if( lidarFile.isNODATA( x, y ) == false )
         {
+          v = row[x];
           if( imageOverlay == true )
           {
-            ret = image->getPixel( x, y, red, green, blue );
-            if( ret.result == false )
-            {
-              cout << "Error getting pixel: " << ret.reason << endl;
-              break;
-            }
+            image->getPixel( x, y, red, green, blue );
           }
           ids[y][x] = model.addVertex( ( (float)x * cellsize ) + xOff,
                            ( (float)y * cellsize ) + yOff,
@@ -258,40 +578,314 @@ void processFiles( vector< vector<string> > files, string modelName )
 
   // Write model
   model.writeToFile( modelName );
+  if( contourOpt == true )
+  {
+    string contourName = modelName.substr( 0, modelName.size() - 4 ) + ".contours.ply";
+    cout << "Writing contour file: " << contourName << endl;
+    contourModel.writeToFile( contourName );
+  }
 
 }
 
 // ------------------------------------------------------------------------
 
+void volumeFiles( void )
+{
+  // The base is either a level or file(s)
+  bool baseLevel = true;
+  double level = 0.0;
+  try
+  {
+    size_t used;
+    level = stod( volumeBase, &used );
+    baseLevel = ( used == string( volumeBase ).size() );
+  }
+  catch( const std::exception& )
+  {
+    baseLevel = false;
+  }
+
+  // Pairs of surface and base files
+  vector< pair<string, string> > files;
+  if( listFileOpt == true )
+  {
+    vector< vector<string> > surfaceList = readListFile( listFileName );
+    vector< vector<string> > baseList;
+    if( baseLevel == false )
+    {
+      baseList = readListFile( volumeBase );
+      if( baseList.size() != surfaceList.size() )
+      {
+        cout << "List files have different numbers of tiles: " << listFileName << " " << volumeBase << endl;
+        return;
+      }
+    }
+    for( size_t i=0; i<surfaceList.size(); i++ )
+    {
+      files.push_back( make_pair( surfaceList[i].at(0), ( baseLevel == true ) ? "" : baseList[i].at(0) ) );
+    }
+  }
+  else
+  {
+    files.push_back( make_pair( string( inputFileName ), ( baseLevel == true ) ? "" : string( volumeBase ) ) );
+  }
+
+  // Tiles are read one at a time and added to the totals
+  lidarVolume volume;
+  for( auto f : files )
+  {
+    cout << "Processing: " << f.first;
+    lidar surface;
+    surface.setCacheEnabled( cacheOpt );
+    surface.setDecimation( decimateFactor, POOL_MEAN );
+    surface.setPointCloudOptions( binCellsize, binRule );
+    struct returnResult r = surface.readFromFile( f.first );
+    if( r.result == false )
+    {
+      cout << endl << "Could not open file: " << f.first << " " << endl << r.reason << endl;
+      return;
+    }
+    if( baseLevel == true )
+    {
+      cout << endl;
+      r = volume.add( surface, level );
+    }
+    else
+    {
+      cout << " - " << f.second << endl;
+      lidar base;
+      base.setCacheEnabled( cacheOpt );
+      base.setDecimation( decimateFactor, POOL_MEAN );
+      base.setPointCloudOptions( binCellsize, binRule );
+      r = base.readFromFile( f.second );
+      if( r.result == true )
+      {
+        r = volume.add( surface, base );
+      }
+    }
+    if( r.result == false )
+    {
+      cout << "Could not work out volumes: " << r.reason << endl;
+      return;
+    }
+  }
+
+  cout << fixed << setprecision( 1 );
+  cout << "Cut volume:  " << volume.getCut() << " m3 over " << volume.getCutArea() << " m2" << endl;
+  cout << "Fill volume: " << volume.getFill() << " m3 over " << volume.getFillArea() << " m2" << endl;
+  cout << "Net volume:  " << volume.getCut() - volume.getFill() << " m3 ( total area "
+       << volume.getArea() << " m2 )" << endl;
+}
+
+// ------------------------------------------------------------------------
+
+void profileFiles( void )
+{
+  // Read the lines and lay out the profile points
+  ifstream lineFile;
+  string inputLine;
+  vector< vector<struct lidarProfilePoint> > profiles;
+  double minX = HUGE_VAL;
+  double minY = HUGE_VAL;
+  double maxX = -HUGE_VAL;
+  double maxY = -HUGE_VAL;
+  lineFile.open( profileFileName, ios::in );
+  if( !lineFile )
+  {
+    cout << "Could not open file: " << profileFileName << endl;
+    return;
+  }
+  while( getline( lineFile, inputLine ) )
+  {
+    // Ignore comment or blank lines
+    if( inputLine.empty() || ( inputLine.at(0) == '#' ) )
+    {
+      continue;
+    }
+    vector< pair<double, double> > polyline;
+    for( auto vertex : split( inputLine, ' ' ) )
+    {
+      vector<string> xy = split( vertex, ',' );
+      if( xy.size() != 2 )
+      {
+        cout << "Invalid line vertex: " << vertex << endl;
+        return;
+      }
+      polyline.push_back( make_pair( stod( xy.at(0) ), stod( xy.at(1) ) ) );
+      minX = min( minX, polyline.back().first );
+      minY = min( minY, polyline.back().second );
+      maxX = max( maxX, polyline.back().first );
+      maxY = max( maxY, polyline.back().second );
+    }
+    profiles.push_back( lidar::profilePoints( polyline, profileStep ) );
+  }
+  cout << "Read " << profiles.size() << " lines from: " << profileFileName << endl;
+
+  vector<string> files;
+  if( listFileOpt == true )
+  {
+    for( auto f : readListFile( listFileName ) )
+    {
+      files.push_back( f.at(0) );
+    }
+  }
+  else
+  {
+    files.push_back( inputFileName );
+  }
+
+  // Only the part of each tile that the lines cross is read
+  for( auto f : files )
+  {
+    lidar tile;
+    struct returnResult r = tile.readHeader( f );
+    if( r.result == false )
+    {
+      cout << "Could not open file: " << f << " " << endl << r.reason << endl;
+      return;
+    }
+    double right = tile.getXllcorner() + ( tile.getNoColumns() * static_cast<double>( tile.getCellsize() ) );
+    double top = tile.getYllcorner() + ( tile.getNoRows() * static_cast<double>( tile.getCellsize() ) );
+    if( ( maxX < tile.getXllcorner() ) || ( minX > right ) || ( maxY < tile.getYllcorner() ) || ( minY > top ) )
+    {
+      continue;
+    }
+    cout << "Processing: " << f << endl;
+    float margin = tile.getCellsize() * decimateFactor;
+    tile.setCacheEnabled( cacheOpt );
+    tile.setDecimation( decimateFactor, POOL_MEAN );
+    tile.setPointCloudOptions( binCellsize, binRule );
+    r = tile.readFromFile( f, minX - margin, minY - margin, maxX + margin, maxY + margin );
+    if( r.result == false )
+    {
+      cout << "Could not open file: " << f << " " << endl << r.reason << endl;
+      return;
+    }
+    tile.sampleProfiles( profiles );
+  }
+  lidar::finishProfiles( profiles );
+
+  // Points without data have no elevation
+  string outputFileName = string( profileFileName ) + ".csv";
+  ofstream outputFile( outputFileName, ios::out );
+  if( !outputFile )
+  {
+    cout << "Could not open file: " << outputFileName << endl;
+    return;
+  }
+  cout << "Writing profiles: " << outputFileName << endl;
+  outputFile << fixed << setprecision( 2 );
+  outputFile << "line,distance,x,y,z" << endl;
+  for( size_t i=0; i<profiles.size(); i++ )
+  {
+    for( auto& p : profiles[i] )
+    {
+      outputFile << i + 1 << "," << p.distance << "," << p.x << "," << p.y << ",";
+      if( p.valid == true )
+      {
+        outputFile << p.z;
+      }
+      outputFile << "\n";
+    }
+  }
+}
+
+// ------------------------------------------------------------------------
+
+void pointCloudFile( void )
+{
+  cout << "Processing LAS point cloud: " << pointCloudFileName << endl;
+  lasPly converter;
+  converter.setIntensity( extraOpt );
+  converter.setClassification( extraOpt );
+  converter.setClassFilter( classCodes );
+  converter.setOffset( xOffset, yOffset, zOffset );
+
+  cout << "Writing PLY file: " << pointCloudFileName << ".ply" << endl;
+  struct returnResult r = converter.convert( pointCloudFileName, string( pointCloudFileName ) + ".ply" );
+  if( r.result == false )
+  {
+    cout << "Could not convert file: " << pointCloudFileName << " " << endl << r.reason << endl;
+  }
+}
+
+// ------------------------------------------------------------------------
+
 void singleFile( void )
 {
   lidar lidarFile;
 
   cout << "Processing single LiDAR file: " << inputFileName << endl;
-  struct returnResult r = lidarFile.readFromFile( inputFileName );
+  lidarFile.setCacheEnabled( cacheOpt );
+  lidarFile.setDecimation( decimateFactor, POOL_MEAN );
+  lidarFile.setPointCloudOptions( binCellsize, binRule );
+  struct returnResult r;
+  if( baseFileOpt == true )
+  {
+    cout << "Subtracting LiDAR file: " << baseFileName << endl;
+    r = lidarFile.readDifference( inputFileName, baseFileName );
+  }
+  else
+  {
+    r = lidarFile.readFromFile( inputFileName );
+  }
   if( r.result == false )
   {
     cout << "Could not open file: " << inputFileName << " " << endl << r.reason << endl;
   }
   else
   {
+    if( autofillOpt == true )
+    {
+      cout << "Filled " << lidarFile.fillGaps( 0 ) << " NODATA points" << endl;
+    }
+    if( resampleOpt == true )
+    {
+      cout << "Resampling from " << lidarFile.getCellsize() << "m to " << resampleCellsize << "m" << endl;
+      try
+      {
+        lidarFile = lidarFile.resample( resampleCellsize, INTERPOLATE_BILINEAR );
+      }
+      catch( const std::bad_alloc& )
+      {
+        cout << "Could not resample file: " << inputFileName << endl << "Not enough memory for the new grid" << endl;
+        return;
+      }
+      catch( const std::invalid_argument& e )
+      {
+        cout << "Could not resample file: " << inputFileName << endl << e.what() << endl;
+        return;
+      }
+    }
+
+    if( contourOpt == true )
+    {
+      lidarply contourModel;
+      contourModel.setFormat( "binary_little_endian" );
+      lidarContour contours;
+      contours.setLevels( contourInterval, 0.0 );
+      lidarContour::addToModel( contours.extract( lidarFile ), contourModel, xOffset, yOffset, zOffset );
+      cout << "Writing contour file: " << inputFileName << ".contours.ply" << endl;
+      contourModel.writeToFile( string( inputFileName ) + ".contours.ply" );
+    }
+
     lidarply model;
     model.setFormat( "binary_little_endian" );
 
-    lidarImage* image;
+    unique_ptr<lidarImage> image;
+    bool imageOverlay = imageFileOpt;
     struct returnResult ret;
 
     // Loop through the points and copy to PLY file
     unsigned int r = lidarFile.getNoRows();
     unsigned int c = lidarFile.getNoColumns();
-    float noData = lidarFile.getNODATA_value();
     float cellsize = lidarFile.getCellsize();
 
     // Check if an image overlay is needed
     if( imageFileOpt == true )
     {
       cout << "Processing image file: " << imageFileName << endl;
-      image = new lidarImage( c, r, 255 );
+      image.reset( new lidarImage( c, r, 255 ) );
       ret = image->readFromFile( string( imageFileName ) );
       if( ret.result == false )
       {
@@ -299,6 +893,57 @@ void singleFile( void )
         return;
       }
     }
+    else if( terrainOverlay != TERRAIN_NONE )
+    {
+      const char* names[] = { "", "hillshade", "slope", "aspect", "flow" };
+      string pngFileName = string( inputFileName ) + "." + names[ terrainOverlay ] + ".png";
+      cout << "Creating terrain overlay: " << pngFileName << endl;
+      image.reset( terrainImage( lidarFile, pngFileName ) );
+      imageOverlay = ( image != nullptr );
+    }
+
+    // Darken what can't be seen
+    if( viewshedOpt == true )
+    {
+      cout << "Creating viewshed from " << viewshedPoint.at(0) << "," << viewshedPoint.at(1) << endl;
+      lidarViewshed viewshed;
+      if( viewshedPoint.size() > 2 )
+      {
+        viewshed.setHeights( viewshedPoint.at(2), 0.0 );
+      }
+      lidar visibility;
+      ret = viewshed.compute( lidarFile, viewshedPoint.at(0), viewshedPoint.at(1), visibility );
+      if( ret.result == false )
+      {
+        cout << "Could not create viewshed: " << ret.reason << endl;
+        return;
+      }
+      if( imageOverlay == false )
+      {
+        image.reset( new lidarImage( c, r, 255 ) );
+        imageOverlay = true;
+        for( unsigned int y=0; y<r; y++ )
+        {
+          for( unsigned int x=0; x<c; x++ )
+          {
+            image->setPixel( x, y, 128, 128, 128 );
+          }
+        }
+      }
+      for( unsigned int y=0; y<r; y++ )
+      {
+        const float* row = visibility.getRow( y );
+        for( unsigned int x=0; x<c; x++ )
+        {
+          if( row[x] == 0.0 )
+          {
+            unsigned char red, green, blue;
+            image->getPixel( x, y, red, green, blue );
+            image->setPixel( x, y, ( red / 3 ) + 64, green / 3, blue / 3 );
+          }
+        }
+      }
+    }
 
     // Write the data
     cout << "Creating PLY file" << endl;
@@ -306,7 +951,6 @@ void singleFile( void )
     unsigned char red = 128;
     unsigned char green = 128;
     unsigned char blue = 128;
-    bool res;
     // Create an array for storing the vertex ids in case a mesh needs
     // to be created
     int** ids;
@@ -328,19 +972,16 @@ void singleFile( void )
     // Copy data to model
     for( unsigned int y=0; y<r; y++ )
     {
+      const float* row = lidarFile.getRow( y );
       for( unsigned int x=0; x<c; x++ )
       {
-        res = lidarFile.getValue( x, y, v );
-        if( ( res == true ) && ( v != noData ) )
+        // NODATA points were found while the file was read
+        if( lidarFile.isNODATA( x, y ) == false )
         {
-          if( imageFileOpt == true )
+          v = row[x];
+          if( imageOverlay == true )
           {
-            ret = image->getPixel( x, y, red, green, blue );
-            if( ret.result == false )
-            {
-              cout << "Error getting pixel: " << ret.reason << endl;
-              return;
-            }
+            image->getPixel( x, y, red, green, blue );
           }
           ids[y][x] = model.addVertex( ( (float)x * cellsize ) + xOffset,
                            ( (float)y * cellsize ) + yOffset,
@@ -404,7 +1045,7 @@ int main( int argc, char *argv[] )
   opterr = 0;
 
   // Process the command line
-  while( (c = getopt( argc, argv, "hf:i:x:y:z:l:am" ) ) != -1 )
+  while( (c = getopt( argc, argv, "hf:i:x:y:z:l:amcd:r:b:p:k:es:o:t:n:v:u:j:w:g:" ) ) != -1 )
   {
     switch( c )
       {
@@ -422,6 +1063,70 @@ int main( int argc, char *argv[] )
           imageFileName = optarg;
           break;
 
+        case 'g':
+          {
+            mosaicOpt = true;
+            vector<string> values = split( optarg, ',' );
+            mosaicFileName = values.at(0);
+            for( size_t i=1; i<values.size(); i++ )
+            {
+              mosaicExtent.push_back( stod( values[i] ) );
+            }
+            if( ( mosaicExtent.size() != 0 ) && ( mosaicExtent.size() != 4 ) )
+            {
+              cout << "Mosaic area needs minX,minY,maxX,maxY: " << optarg << endl;
+              parseCheck = false;
+            }
+          }
+          break;
+
+        case 'v':
+          viewshedOpt = true;
+          for( auto value : split( optarg, ',' ) )
+          {
+            viewshedPoint.push_back( stod( value ) );
+          }
+          if( viewshedPoint.size() < 2 )
+          {
+            cout << "Viewshed needs an X and Y coordinate: " << optarg << endl;
+            parseCheck = false;
+          }
+          break;
+
+        case 'u':
+          volumeOpt = true;
+          volumeBase = optarg;
+          break;
+
+        case 'j':
+          profileOpt = true;
+          profileFileName = optarg;
+          break;
+
+        case 'w':
+          profileStep = stod( optarg );
+          if( !( profileStep > 0.0 ) )
+          {
+            cout << "Profile step must be greater than 0: " << optarg << endl;
+            parseCheck = false;
+          }
+          break;
+
+        case 'n':
+          contourOpt = true;
+          contourInterval = stof( optarg );
+          if( !( contourInterval > 0.0 ) )
+          {
+            cout << "Contour interval must be greater than 0: " << optarg << endl;
+            parseCheck = false;
+          }
+          break;
+
+        case 't':
+          baseFileOpt = true;
+          baseFileName = optarg;
+          break;
+
         case 'x':
           xOffsetOpt = true;
           xOffset = stof( optarg );
@@ -450,9 +1155,111 @@ int main( int argc, char *argv[] )
           meshOpt = true;
           break;
 
+        case 'c':
+          cacheOpt = true;
+          break;
+
+        case 'd':
+          {
+            int factor = stoi( optarg );
+            if( factor < 1 )
+            {
+              cout << "Reduction factor must be 1 or more: " << optarg << endl;
+              parseCheck = false;
+            }
+            else
+            {
+              decimateFactor = factor;
+            }
+          }
+          break;
+
+        case 'r':
+          binCellsize = stof( optarg );
+          break;
+
+        case 's':
+          resampleOpt = true;
+          resampleCellsize = stof( optarg );
+          if( !( resampleCellsize > 0.0 ) )
+          {
+            cout << "Cell size must be greater than 0: " << optarg << endl;
+            parseCheck = false;
+          }
+          break;
+
+        case 'p':
+          pointCloudOpt = true;
+          pointCloudFileName = optarg;
+          break;
+
+        case 'k':
+          for( auto code : split( optarg, ',' ) )
+          {
+            classCodes.push_back( stoi( code ) );
+          }
+          break;
+
+        case 'e':
+          extraOpt = true;
+          break;
+
+        case 'o':
+          if( string( optarg ) == "hillshade" )
+          {
+            terrainOverlay = TERRAIN_HILLSHADE;
+          }
+          else if( string( optarg ) == "slope" )
+          {
+            terrainOverlay = TERRAIN_SLOPE;
+          }
+          else if( string( optarg ) == "aspect" )
+          {
+            terrainOverlay = TERRAIN_ASPECT;
+          }
+          else if( string( optarg ) == "flow" )
+          {
+            terrainOverlay = TERRAIN_FLOW;
+          }
+          else
+          {
+            cout << "Unknown terrain overlay: " << optarg << endl;
+            parseCheck = false;
+          }
+          break;
+
+        case 'b':
+          if( string( optarg ) == "min" )
+          {
+            binRule = BIN_MIN;
+          }
+          else if( string( optarg ) == "max" )
+          {
+            binRule = BIN_MAX;
+          }
+          else if( string( optarg ) == "mean" )
+          {
+            binRule = BIN_MEAN;
+          }
+          else if( string( optarg ) == "last" )
+          {
+            binRule = BIN_LAST_RETURN;
+          }
+          else
+          {
+            cout << "Unknown gridding rule: " << optarg << endl;
+            parseCheck = false;
+          }
+          break;
+
         case '?':
           if( optopt == 'f' || optopt == 'i' || optopt == 'x'
-           || optopt == 'y'  || optopt == 'z'  || optopt == 'l' )
+           || optopt == 'y'  || optopt == 'z'  || optopt == 'l'
+           || optopt == 'd' || optopt == 'r' || optopt == 'b'
+           || optopt == 'p' || optopt == 'k' || optopt == 's'
+           || optopt == 'o' || optopt == 't' || optopt == 'n'
+           || optopt == 'v' || optopt == 'u' || optopt == 'j' || optopt == 'w'
+           || optopt == 'g' )
           {
             cout << "Option -" << static_cast<char>(optopt) << " requires an argument." << endl;
           }
@@ -468,6 +1275,18 @@ int main( int argc, char *argv[] )
       }
     }
 
+  // Options that only work on a single file
+  if( ( listFileOpt == true ) && ( baseFileOpt == true ) )
+  {
+    cout << "The -t option can't be used with a list file" << endl;
+    parseCheck = false;
+  }
+  if( ( listFileOpt == true ) && ( viewshedOpt == true ) )
+  {
+    cout << "The -v option can't be used with a list file" << endl;
+    parseCheck = false;
+  }
+
   if( parseCheck == false )
   {
     return EXIT_FAILURE;
@@ -478,35 +1297,30 @@ int main( int argc, char *argv[] )
     // Help file
     printHelp();
   }
+  else if( ( volumeOpt == true ) && ( ( listFileOpt == true ) || ( inputFileOpt == true ) ) )
+  {
+    // Volumes only
+    volumeFiles();
+  }
+  else if( ( profileOpt == true ) && ( ( listFileOpt == true ) || ( inputFileOpt == true ) ) )
+  {
+    // Profiles only
+    profileFiles();
+  }
   else if( listFileOpt == true )
   {
     // List file processing
     cout << "Processing multi LiDAR file: " << string( listFileName ) << endl;
-    ifstream listFile;
-    string inputLine;
-
-    // Build list of files & images ( if necessary )
-    vector< vector<string> > fileList;
-    listFile.open( listFileName, ios::in );
-    if( !listFile )
-    {
-      cout << "Could not open file: " << listFileName << endl;
-    }
-    while( getline ( listFile, inputLine ) )
-    {
-      // Ignore comment or blank lines
-      if( !inputLine.empty() && inputLine.at(0) != '#' )
-      {
-        // Get file names
-        vector<string> params = split( inputLine, ' ' );
-        // And add to list
-        fileList.push_back( params );
-      }
-    }
+    vector< vector<string> > fileList = readListFile( listFileName );
 
     // And process
     processFiles( fileList, string( listFileName ) + ".ply" );
   }
+  else if( pointCloudOpt == true )
+  {
+    // Point cloud conversion
+    pointCloudFile();
+  }
   else if( inputFileOpt == true )
   {
     // Single file processing
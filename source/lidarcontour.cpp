@@ -0,0 +1,302 @@
+// lidarcontour.cpp - Contour lines of LiDAR grids
+// Copyright (C) 2018 John Davies
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "lidarcontour.hpp"
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+// A piece of contour line within one cell. Each end lies on a grid edge
+// and the key identifies the edge and level so that the pieces can be
+// joined up.
+struct contourSegment {
+  UINT64 key[2];
+  struct contourPoint p[2];
+};
+
+static const size_t NO_LINK = ~static_cast<size_t>( 0 );
+
+// ====================================================================
+// Constructor
+
+lidarContour::lidarContour( void )
+{
+  interval = 10.0;
+  base = 0.0;
+}
+
+// ====================================================================
+// Options
+
+void lidarContour::setLevels( float step, float offset )
+{
+  interval = step;
+  base = offset;
+}
+
+// ====================================================================
+// Extraction
+
+vector<struct contourLine> lidarContour::extract( lidar& grid ) const
+{
+  vector<struct contourLine> lines;
+
+  unsigned int cols = grid.getNoColumns();
+  unsigned int rows = grid.getNoRows();
+  float noData = grid.getNODATA_value();
+  float cellsize = grid.getCellsize();
+  if( ( cols < 2 ) || ( rows < 2 ) || ( interval <= 0.0f )
+   || ( grid.getNODATACount() == static_cast<UINT64>( cols ) * rows ) )
+  {
+    return lines;
+  }
+
+  // Grid edges are numbered from the cell at their lower left end, two
+  // per cell ( east and north ), and each level has its own set of keys
+  UINT64 edgeCount = static_cast<UINT64>( cols ) * rows * 2;
+  long long firstLevel = static_cast<long long>( floor( ( grid.getMinValue() - base ) / interval ) ) - 2;
+
+  // Marching squares on bands of rows in parallel
+  unsigned int cellRows = rows - 1;
+  unsigned int threads = defaultThreadCount();
+  unsigned int bands = min( cellRows, threads * 4 );
+  vector< vector<struct contourSegment> > bandSegments( bands );
+  parallelFor( bands, threads, [&]( unsigned int firstBand, unsigned int lastBand )
+  {
+    for( unsigned int b=firstBand; b<lastBand; b++ )
+    {
+      vector<struct contourSegment>& segments = bandSegments[b];
+      unsigned int firstRow = static_cast<unsigned int>( ( static_cast<UINT64>( cellRows ) * b ) / bands );
+      unsigned int lastRow = static_cast<unsigned int>( ( static_cast<UINT64>( cellRows ) * ( b + 1 ) ) / bands );
+      for( unsigned int r=firstRow; r<lastRow; r++ )
+      {
+        const float* south = grid.getRow( r );
+        const float* north = grid.getRow( r + 1 );
+        for( unsigned int c=0; c<cols-1; c++ )
+        {
+          // Corners anticlockwise from the lower left
+          float z[4] = { south[c], south[c+1], north[c+1], north[c] };
+          if( ( z[0] == noData ) || ( z[1] == noData ) || ( z[2] == noData ) || ( z[3] == noData ) )
+          {
+            continue;
+          }
+          float lo = min( min( z[0], z[1] ), min( z[2], z[3] ) );
+          float hi = max( max( z[0], z[1] ), max( z[2], z[3] ) );
+          long long kLo = static_cast<long long>( floor( ( lo - base ) / interval ) );
+          long long kHi = static_cast<long long>( floor( ( hi - base ) / interval ) );
+          // Most cells are between two levels. The levels either side are
+          // also tried in case of rounding in the division.
+          if( ( lo >= base + ( kLo * interval ) ) && ( hi < base + ( ( kLo + 1 ) * interval ) ) )
+          {
+            continue;
+          }
+
+          // Edges bottom, right, top, left: key and the end cells
+          UINT64 cell = ( static_cast<UINT64>( r ) * cols ) + c;
+          UINT64 edgeKey[4] = { cell * 2, ( ( cell + 1 ) * 2 ) + 1, ( cell + cols ) * 2, ( cell * 2 ) + 1 };
+          const int from[4] = { 0, 1, 3, 0 };
+          const int to[4] = { 1, 2, 2, 3 };
+
+          for( long long k=kLo-1; k<=kHi+1; k++ )
+          {
+            float level = base + ( k * interval );
+            bool above[4];
+            for( int i=0; i<4; i++ )
+            {
+              above[i] = ( z[i] >= level );
+            }
+            // Where the contour crosses each edge
+            struct contourPoint p[4];
+            bool crossed[4];
+            int crossings = 0;
+            for( int e=0; e<4; e++ )
+            {
+              crossed[e] = ( above[ from[e] ] != above[ to[e] ] );
+              if( crossed[e] == true )
+              {
+                // Always interpolated from the same end so neighbouring
+                // cells agree
+                float t = ( level - z[ from[e] ] ) / ( z[ to[e] ] - z[ from[e] ] );
+                float x = ( e == 1 ) ? 1.0f : ( ( e == 3 ) ? 0.0f : t );
+                float y = ( e == 2 ) ? 1.0f : ( ( e == 0 ) ? 0.0f : t );
+                p[e].x = ( c + x ) * cellsize;
+                p[e].y = ( r + y ) * cellsize;
+                crossings++;
+              }
+            }
+            if( crossings == 0 )
+            {
+              continue;
+            }
+
+            UINT64 levelKey = static_cast<UINT64>( k - firstLevel ) * edgeCount;
+            auto add = [&]( int e0, int e1 )
+            {
+              struct contourSegment s;
+              s.key[0] = levelKey + edgeKey[e0];
+              s.key[1] = levelKey + edgeKey[e1];
+              s.p[0] = p[e0];
+              s.p[1] = p[e1];
+              segments.push_back( s );
+            };
+            if( crossings == 2 )
+            {
+              int e0 = -1;
+              int e1 = -1;
+              for( int e=0; e<4; e++ )
+              {
+                if( crossed[e] == true )
+                {
+                  ( ( e0 == -1 ) ? e0 : e1 ) = e;
+                }
+              }
+              add( e0, e1 );
+            }
+            else
+            {
+              // Saddle, the centre decides which corners are joined
+              bool centre = ( ( z[0] + z[1] + z[2] + z[3] ) * 0.25f ) >= level;
+              if( centre == above[0] )
+              {
+                // Lower right and upper left corners are cut off
+                add( 0, 1 );
+                add( 2, 3 );
+              }
+              else
+              {
+                add( 3, 0 );
+                add( 1, 2 );
+              }
+            }
+          }
+        }
+      }
+    }
+  } );
+
+  // Join the segments at band boundaries and within bands
+  vector<struct contourSegment> segments;
+  for( auto& band : bandSegments )
+  {
+    segments.insert( segments.end(), band.begin(), band.end() );
+    vector<struct contourSegment>().swap( band );
+  }
+  size_t ends = segments.size() * 2;
+  vector< pair<UINT64, size_t> > keys( ends );
+  for( size_t i=0; i<ends; i++ )
+  {
+    keys[i] = make_pair( segments[ i / 2 ].key[ i % 2 ], i );
+  }
+  sort( keys.begin(), keys.end() );
+  // No more than two segment ends share a key
+  vector<size_t> link( ends, NO_LINK );
+  for( size_t i=1; i<ends; i++ )
+  {
+    if( keys[i].first == keys[ i - 1 ].first )
+    {
+      link[ keys[i].second ] = keys[ i - 1 ].second;
+      link[ keys[ i - 1 ].second ] = keys[i].second;
+    }
+  }
+
+  // Follow the links to build the lines
+  vector<bool> used( segments.size(), false );
+  for( size_t s=0; s<segments.size(); s++ )
+  {
+    if( used[s] == true )
+    {
+      continue;
+    }
+    struct contourLine line;
+    line.closed = false;
+    line.level = base + ( static_cast<long long>( segments[s].key[0] / edgeCount ) + firstLevel ) * interval;
+
+    // Go backwards to the start of the line, ends are numbered segment * 2 + end
+    size_t start = s * 2;
+    while( link[ start ] != NO_LINK )
+    {
+      size_t previous = link[ start ];
+      if( previous / 2 == s )
+      {
+        line.closed = true;
+        break;
+      }
+      start = previous ^ 1;
+    }
+    if( line.closed == true )
+    {
+      start = s * 2;
+    }
+
+    // Then forwards, each segment is entered at one end and left by the other
+    size_t entry = start;
+    line.points.push_back( segments[ entry / 2 ].p[ entry % 2 ] );
+    while( true )
+    {
+      used[ entry / 2 ] = true;
+      size_t leave = entry ^ 1;
+      size_t next = link[ leave ];
+      if( ( next == NO_LINK ) || ( used[ next / 2 ] == true ) )
+      {
+        // A closed line ends back at its first point
+        if( line.closed == false )
+        {
+          line.points.push_back( segments[ leave / 2 ].p[ leave % 2 ] );
+        }
+        break;
+      }
+      line.points.push_back( segments[ leave / 2 ].p[ leave % 2 ] );
+      entry = next;
+    }
+
+    lines.push_back( line );
+  }
+
+  return lines;
+}
+
+// ====================================================================
+// Output
+
+void lidarContour::addToModel( const vector<struct contourLine>& lines, lidarply& model,
+                               float xOff, float yOff, float zOff )
+{
+  for( auto& line : lines )
+  {
+    unsigned int first = 0;
+    unsigned int previous = 0;
+    for( size_t i=0; i<line.points.size(); i++ )
+    {
+      unsigned int v = model.addVertex( line.points[i].x + xOff, line.points[i].y + yOff,
+                                        line.level + zOff, 0, 0, 0 );
+      if( i == 0 )
+      {
+        first = v;
+      }
+      else
+      {
+        model.addEdge( previous, v );
+      }
+      previous = v;
+    }
+    if( ( line.closed == true ) && ( line.points.size() > 2 ) )
+    {
+      model.addEdge( previous, first );
+    }
+  }
+}
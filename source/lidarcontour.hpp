@@ -0,0 +1,84 @@
+// lidarcontour.hpp - header file for lidarcontour
+// Copyright (C) 2018 John Davies
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LIDARCONTOUR_H
+#define LIDARCONTOUR_H
+
+#include "util.hpp"
+#include "lidarlib.hpp"
+#include "lidarply.hpp"
+#include <vector>
+
+using namespace std;
+
+/// Point on a contour line, in metres from the lower left hand corner of
+/// the grid
+///
+struct contourPoint {
+  float x;
+  float y;
+};
+
+/// A contour line
+///
+struct contourLine {
+  float level;
+  bool closed;                    // the last point joins the first
+  vector<struct contourPoint> points;
+};
+
+/// Contour lines of LiDAR grids using marching squares. The grid is split
+/// into bands of rows which are processed in parallel, then the line
+/// segments are joined where they cross the same grid edge. Lines stop at
+/// NODATA cells and at the edge of the grid.
+///
+
+class lidarContour
+{
+  float interval;
+  float base;
+
+public:
+
+  /// Constructor, contours every 10m
+  ///
+  lidarContour( void );
+
+  /// Set the contour levels
+  /// @param[in] step : height between contours
+  /// @param[in] offset : height of one of the contours, usually 0
+  ///
+  void setLevels( float step, float offset );
+
+  /// Find the contour lines of a grid
+  /// @param[in] grid : elevation grid
+  /// @return The contour lines
+  ///
+  vector<struct contourLine> extract( lidar& grid ) const;
+
+  /// Add contour lines to a model as vertices joined by edges
+  /// @param[in] lines : contour lines
+  /// @param[in] model : model to add to
+  /// @param[in] xOff : X offset of the lines
+  /// @param[in] yOff : Y offset of the lines
+  /// @param[in] zOff : Z offset of the lines
+  ///
+  static void addToModel( const vector<struct contourLine>& lines, lidarply& model,
+                          float xOff, float yOff, float zOff );
+
+};
+
+#endif
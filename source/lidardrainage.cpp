@@ -0,0 +1,353 @@
+// lidardrainage.cpp - Drainage analysis of LiDAR grids
+// Copyright (C) 2018 John Davies
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Barnes, R., Lehman, C. and Mulla, D. "Priority-flood: An optimal
+// depression-filling and watershed-labeling algorithm for digital
+// elevation models", Computers & Geosciences, 62, 2014
+
+#include "lidardrainage.hpp"
+#include <vector>
+#include <deque>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+// Neighbour offsets in direction order, anticlockwise from east
+static const int DX[8] = { 1, 1, 0, -1, -1, -1, 0, 1 };
+static const int DY[8] = { 0, 1, 1, 1, 0, -1, -1, -1 };
+
+// Cells are numbered with 32 bit indexes, one of which is kept as a marker
+static void checkCellCount( unsigned int cols, unsigned int rows )
+{
+  if( ( static_cast<UINT64>( cols ) * rows ) >= 0xffffffffu )
+  {
+    throw invalid_argument( "Grid is too large for drainage analysis" );
+  }
+}
+
+// ====================================================================
+// Radix heap
+//
+// A priority queue for when the smallest key never goes down, as in
+// priority-flood. Entries are kept in 33 buckets by the highest bit that
+// differs from the last key taken out, each entry moves down at most 32
+// times and the buckets are plain arrays.
+
+class radixHeap
+{
+  struct entry {
+    UINT32 key;
+    UINT32 cell;
+  };
+  vector<struct entry> buckets[33];
+  UINT32 last = 0;
+  size_t count = 0;
+
+  static unsigned int bucketIndex( UINT32 key, UINT32 from )
+  {
+    return ( key == from ) ? 0 : 32 - __builtin_clz( key ^ from );
+  }
+
+public:
+
+  bool empty( void ) const { return count == 0; }
+
+  void push( UINT32 key, UINT32 cell )
+  {
+    struct entry e = { key, cell };
+    buckets[ bucketIndex( key, last ) ].push_back( e );
+    count++;
+  }
+
+  UINT32 pop( void )
+  {
+    if( buckets[0].empty() == true )
+    {
+      // Redistribute the first non empty bucket around its smallest key
+      unsigned int i = 1;
+      while( buckets[i].empty() == true )
+      {
+        i++;
+      }
+      last = buckets[i][0].key;
+      for( auto& e : buckets[i] )
+      {
+        last = min( last, e.key );
+      }
+      for( auto& e : buckets[i] )
+      {
+        buckets[ bucketIndex( e.key, last ) ].push_back( e );
+      }
+      buckets[i].clear();
+    }
+    UINT32 cell = buckets[0].back().cell;
+    buckets[0].pop_back();
+    count--;
+    return cell;
+  }
+};
+
+// Order preserving conversion of a float to an unsigned key
+static UINT32 floatKey( float value )
+{
+  UINT32 bits;
+  memcpy( &bits, &value, sizeof( bits ) );
+  return ( bits & 0x80000000u ) ? ~bits : ( bits | 0x80000000u );
+}
+
+// ====================================================================
+// Depression filling
+
+lidar lidarDrainage::fillDepressions( lidar& dem ) const
+{
+  unsigned int cols = dem.getNoColumns();
+  unsigned int rows = dem.getNoRows();
+  checkCellCount( cols, rows );
+  float noData = dem.getNODATA_value();
+  lidar filled( cols, rows, dem.getXllcorner(), dem.getYllcorner(), dem.getCellsize(), noData );
+  for( unsigned int r=0; r<rows; r++ )
+  {
+    std::copy( dem.getRow( r ), dem.getRow( r ) + cols, filled.getRow( r ) );
+  }
+
+  // Cells are numbered row by row
+  vector<bool> closed( static_cast<size_t>( cols ) * rows, false );
+  radixHeap open;
+  deque<UINT32> pit;
+
+  // The edges of the grid and the cells next to NODATA are outlets
+  for( unsigned int r=0; r<rows; r++ )
+  {
+    const float* row = filled.getRow( r );
+    for( unsigned int c=0; c<cols; c++ )
+    {
+      UINT32 cell = ( r * cols ) + c;
+      if( row[c] == noData )
+      {
+        closed[ cell ] = true;
+        continue;
+      }
+      bool outlet = ( r == 0 ) || ( c == 0 ) || ( r == rows - 1 ) || ( c == cols - 1 );
+      for( int d=0; ( d<8 ) && ( outlet == false ); d++ )
+      {
+        outlet = ( filled.getRow( r + DY[d] )[ c + DX[d] ] == noData );
+      }
+      if( outlet == true )
+      {
+        closed[ cell ] = true;
+        open.push( floatKey( row[c] ), cell );
+      }
+    }
+  }
+
+  while( ( open.empty() == false ) || ( pit.empty() == false ) )
+  {
+    UINT32 cell;
+    if( pit.empty() == false )
+    {
+      cell = pit.front();
+      pit.pop_front();
+    }
+    else
+    {
+      cell = open.pop();
+    }
+    unsigned int r = cell / cols;
+    unsigned int c = cell % cols;
+    float z = filled.getRow( r )[c];
+    // Anything that drains here must be at least this high
+    float raised = nextafter( z, HUGE_VALF );
+    for( int d=0; d<8; d++ )
+    {
+      int nr = static_cast<int>( r ) + DY[d];
+      int nc = static_cast<int>( c ) + DX[d];
+      if( ( nr < 0 ) || ( nc < 0 ) || ( nr >= static_cast<int>( rows ) ) || ( nc >= static_cast<int>( cols ) ) )
+      {
+        continue;
+      }
+      UINT32 next = ( nr * cols ) + nc;
+      if( closed[ next ] == true )
+      {
+        continue;
+      }
+      closed[ next ] = true;
+      float& nz = filled.getRow( nr )[ nc ];
+      if( nz <= raised )
+      {
+        nz = raised;
+        pit.push_back( next );
+      }
+      else
+      {
+        open.push( floatKey( nz ), next );
+      }
+    }
+  }
+
+  filled.updateStatistics();
+  return filled;
+}
+
+// ====================================================================
+// Flow directions
+
+lidar lidarDrainage::flowDirection( lidar& dem ) const
+{
+  unsigned int cols = dem.getNoColumns();
+  unsigned int rows = dem.getNoRows();
+  float noData = dem.getNODATA_value();
+  float cellsize = dem.getCellsize();
+  lidar direction( cols, rows, dem.getXllcorner(), dem.getYllcorner(), cellsize, noData );
+
+  const float distance[8] = { 1.0f, sqrtf( 2.0f ), 1.0f, sqrtf( 2.0f ), 1.0f, sqrtf( 2.0f ), 1.0f, sqrtf( 2.0f ) };
+
+  parallelFor( rows, defaultThreadCount(), [&]( unsigned int first, unsigned int last )
+  {
+    for( unsigned int r=first; r<last; r++ )
+    {
+      const float* row = dem.getRow( r );
+      float* out = direction.getRow( r );
+      for( unsigned int c=0; c<cols; c++ )
+      {
+        if( row[c] == noData )
+        {
+          continue;
+        }
+        // Water leaves the grid at the edges and NODATA unless there is
+        // a lower neighbour
+        bool outlet = false;
+        float steepest = 0.0f;
+        int best = -1;
+        for( int d=0; d<8; d++ )
+        {
+          int nr = static_cast<int>( r ) + DY[d];
+          int nc = static_cast<int>( c ) + DX[d];
+          if( ( nr < 0 ) || ( nc < 0 ) || ( nr >= static_cast<int>( rows ) ) || ( nc >= static_cast<int>( cols ) ) )
+          {
+            outlet = true;
+            continue;
+          }
+          float z = dem.getRow( nr )[ nc ];
+          if( z == noData )
+          {
+            outlet = true;
+            continue;
+          }
+          float drop = ( row[c] - z ) / distance[d];
+          if( drop > steepest )
+          {
+            steepest = drop;
+            best = d;
+          }
+        }
+        // Pits that aren't outlets have nowhere to go
+        out[c] = ( ( best == -1 ) && ( outlet == false ) ) ? noData : static_cast<float>( best );
+      }
+    }
+  } );
+
+  direction.updateStatistics();
+  return direction;
+}
+
+// ====================================================================
+// Flow accumulation
+
+lidar lidarDrainage::flowAccumulation( lidar& direction ) const
+{
+  unsigned int cols = direction.getNoColumns();
+  unsigned int rows = direction.getNoRows();
+  checkCellCount( cols, rows );
+  float noData = direction.getNODATA_value();
+  lidar accumulation( cols, rows, direction.getXllcorner(), direction.getYllcorner(),
+                      direction.getCellsize(), noData );
+
+  // Cell each cell drains to, or none
+  const UINT32 NONE = 0xffffffffu;
+  size_t cells = static_cast<size_t>( cols ) * rows;
+  vector<UINT32> downstream( cells, NONE );
+  vector<unsigned char> inflow( cells, 0 );
+  vector<UINT32> total( cells, 0 );
+  for( unsigned int r=0; r<rows; r++ )
+  {
+    const float* row = direction.getRow( r );
+    for( unsigned int c=0; c<cols; c++ )
+    {
+      if( row[c] == noData )
+      {
+        continue;
+      }
+      total[ ( r * cols ) + c ] = 1;
+      int d = static_cast<int>( row[c] );
+      if( d < 0 )
+      {
+        continue;
+      }
+      int nr = static_cast<int>( r ) + DY[d];
+      int nc = static_cast<int>( c ) + DX[d];
+      if( ( nr >= 0 ) && ( nc >= 0 ) && ( nr < static_cast<int>( rows ) ) && ( nc < static_cast<int>( cols ) )
+       && ( direction.getRow( nr )[ nc ] != noData ) )
+      {
+        downstream[ ( r * cols ) + c ] = ( nr * cols ) + nc;
+        inflow[ ( nr * cols ) + nc ]++;
+      }
+    }
+  }
+
+  // Pass each cell's total downstream once everything upstream of it is
+  // done, starting from the cells nothing drains into
+  vector<UINT32> ready;
+  for( size_t i=0; i<cells; i++ )
+  {
+    if( ( inflow[i] == 0 ) && ( total[i] > 0 ) )
+    {
+      ready.push_back( i );
+    }
+  }
+  while( ready.empty() == false )
+  {
+    UINT32 cell = ready.back();
+    ready.pop_back();
+    UINT32 next = downstream[ cell ];
+    if( next == NONE )
+    {
+      continue;
+    }
+    total[ next ] += total[ cell ];
+    if( --inflow[ next ] == 0 )
+    {
+      ready.push_back( next );
+    }
+  }
+
+  for( unsigned int r=0; r<rows; r++ )
+  {
+    float* out = accumulation.getRow( r );
+    for( unsigned int c=0; c<cols; c++ )
+    {
+      if( total[ ( r * cols ) + c ] > 0 )
+      {
+        out[c] = static_cast<float>( total[ ( r * cols ) + c ] );
+      }
+    }
+  }
+
+  accumulation.updateStatistics();
+  return accumulation;
+}
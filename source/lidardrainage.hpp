@@ -0,0 +1,71 @@
+// lidardrainage.hpp - header file for lidardrainage
+// Copyright (C) 2018 John Davies
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LIDARDRAINAGE_H
+#define LIDARDRAINAGE_H
+
+#include "util.hpp"
+#include "lidarlib.hpp"
+
+using namespace std;
+
+/// Drainage analysis of LiDAR grids - depression filling, D8 flow
+/// directions and flow accumulation. Water leaves the grid at its edges
+/// and at NODATA cells.
+///
+/// Flow directions are numbered anticlockwise from east:
+///   3 2 1
+///   4   0
+///   5 6 7
+/// Cells that drain off the grid, or into NODATA, have direction -1.
+///
+
+class lidarDrainage
+{
+
+public:
+
+  /// Fill depressions so that every cell drains to the edge of the grid,
+  /// using the Priority-Flood+epsilon method. Filled cells, including flat
+  /// areas, are raised by the smallest possible amount above the cell they
+  /// drain to, so they always slope towards an outlet. Cells are taken in
+  /// height order from a radix heap and cells inside depressions go
+  /// through a plain queue, so this runs in close to O(N) time.
+  /// Throws invalid_argument if the grid has 2^32 cells or more and
+  /// bad_alloc if the memory can't be allocated.
+  /// @param[in] dem : elevation grid
+  /// @return Filled grid
+  ///
+  lidar fillDepressions( lidar& dem ) const;
+
+  /// Direction of steepest descent from each cell to one of its eight
+  /// neighbours, see above for the numbering
+  /// @param[in] dem : elevation grid, normally filled
+  /// @return Direction of each cell, NODATA where the elevation has none
+  ///
+  lidar flowDirection( lidar& dem ) const;
+
+  /// Number of cells, including itself, that drain through each cell.
+  /// Throws invalid_argument if the grid has 2^32 cells or more and
+  /// bad_alloc if the memory can't be allocated.
+  /// @param[in] direction : flow directions
+  /// @return Upstream cell count of each cell, NODATA where there is no direction
+  ///
+  lidar flowAccumulation( lidar& direction ) const;
+
+};
+
+#endif
@@ -1,4 +1,4 @@
-// lidarimage.cpp - Reads an Imagemagick ".txt" file
+// lidarimage.cpp - Reads a PNG image overlay
 // Copyright (C) 2018 John Davies
 //
 // This program is free software: you can redistribute it and/or modify
@@ -20,6 +20,7 @@
 #include <sstream>
 #include <vector>
 #include <algorithm>
+#include <cmath>
 #include <stdexcept>
 #include "lidarimage.hpp"
 #include "util.hpp"
@@ -28,28 +29,35 @@ using namespace std;
 using namespace lodepng;
 
 // ====================================================================
-// Constructor
+// Constructors
+
+lidarImage::lidarImage( void )
+{
+  xSize = 0;
+  ySize = 0;
+  maxColourDepth = 255;
+  rowStride = 0;
+  streamed = false;
+  firstRow = 0;
+  georeferenced = false;
+  minX = minY = maxX = maxY = 0.0;
+}
+
+// --------------------------------------------------------------------
 
 lidarImage::lidarImage( unsigned int x, unsigned int y, unsigned int colourDepth )
 {
   xSize = x;
   ySize = y;
   maxColourDepth = colourDepth;
+  rowStride = static_cast<size_t>( xSize ) * 3;
+  streamed = false;
+  firstRow = 0;
+  georeferenced = false;
+  minX = minY = maxX = maxY = 0.0;
 
   // Create the array to store the data
-  values = new struct rgb*[ xSize ];
-  if( values == NULL )
-  {
-    throw logic_error( "Failed to create \"values\" array" );
-  }
-  for( unsigned int i=0; i<xSize; i++ )
-  {
-    values[i] = new struct rgb[ ySize ];
-    if( values[i] == NULL )
-    {
-      throw logic_error( "Failed to create row array: " + i );
-    }
-  }
+  pixels.assign( rowStride * ySize, 0 );
 }
 
 // ====================================================================
@@ -59,12 +67,17 @@ struct returnResult lidarImage::readFromFile( string fileName )
 {
   struct returnResult res = { true, "" };
 
+  // The decoded pixels replace the current ones
+  vector<unsigned char>().swap( pixels );
+  streamed = false;
+  firstRow = 0;
+
   // Uses https://github.com/lvandeve/lodepng
   std::vector<unsigned char> image; //the raw pixels
   unsigned width, height;
 
-  //decode
-  unsigned error = lodepng::decode( image, width, height, fileName.c_str() );
+  //decode, straight to 3 bytes per pixel, ordered RGBRGB
+  unsigned error = lodepng::decode( image, width, height, fileName.c_str(), LCT_RGB, 8 );
 
    //if there's an error then exit
    if( error )
@@ -72,50 +85,267 @@ struct returnResult lidarImage::readFromFile( string fileName )
      res.result = false;
      res.reason = lodepng_error_text( error );
    }
-   else if( ( width != xSize ) || ( height != ySize ) )
+   else if( ( width == 0 ) || ( height == 0 ) )
    {
-     // Image size mismatch
      res.result = false;
-     res.reason = "File size mismatch";
+     res.reason = "Image is empty";
+   }
+   else if( ( xSize == 0 ) && ( ySize == 0 ) )
+   {
+     // Empty image so take the size of the file
+     xSize = width;
+     ySize = height;
+     rowStride = static_cast<size_t>( xSize ) * 3;
+     pixels.swap( image );
+   }
+   else if( ( width != xSize ) || ( height != ySize ) )
+   {
+     // Different size, so stretch the image over the grid
+     double xStep = static_cast<double>( width ) / xSize;
+     double yStep = static_cast<double>( height ) / ySize;
+     resample( image.data(), width, height,
+               ( 0.5 * xStep ) - 0.5, xStep, ( 0.5 * yStep ) - 0.5, yStep );
    }
    else
    {
-     // File OK so read into memory
-     //the pixels are now in the vector "image", 4 bytes per pixel, ordered RGBARGBA
-     for( unsigned int y = 0; y < ySize; y++ )
-     {
-       for( unsigned int x = 0; x < xSize; x++ )
-       {
-         unsigned int pixel = ( ( ( ySize - y - 1 ) * xSize ) + x ) * 4;
-         values[x][y].red = image[ pixel ];
-         values[x][y].green = image[ pixel + 1 ];
-         values[x][y].blue = image[ pixel + 2 ];
-       }
-     }
+     // File OK so keep the decoded rows as they are
+     pixels.swap( image );
    }
 
+  // Keep the image usable, e.g. for setPixel, after a failure
+  if( res.result == false )
+  {
+    pixels.assign( rowStride * ySize, 0 );
+  }
+
+  return res;
+}
+
+// --------------------------------------------------------------------
+
+struct returnResult lidarImage::openStream( string fileName )
+{
+  struct returnResult res = stream.open( fileName );
+  if( ( res.result == false ) && ( stream.isInterlaced() == true ) )
+  {
+    // Has to be decoded in one go
+    xSize = 0;
+    ySize = 0;
+    return readFromFile( fileName );
+  }
+  if( res.result == true )
+  {
+    xSize = stream.getWidth();
+    ySize = stream.getHeight();
+    rowStride = static_cast<size_t>( xSize ) * 3;
+    vector<unsigned char>().swap( pixels );
+    streamed = true;
+    firstRow = 0;
+  }
+
+  return res;
+}
+
+// --------------------------------------------------------------------
+
+struct returnResult lidarImage::loadRows( unsigned int first, unsigned int last )
+{
+  struct returnResult res = { true, "" };
+
+  // Earlier rows need the image to be decoded again from the top
+  if( first < firstRow )
+  {
+    stream.rewind();
+    pixels.clear();
+    firstRow = 0;
+  }
+
+  // Drop the rows above the first one needed
+  size_t rows = pixels.size() / rowStride;
+  size_t drop = min( static_cast<size_t>( first - firstRow ), rows );
+  pixels.erase( pixels.begin(), pixels.begin() + ( drop * rowStride ) );
+  firstRow += drop;
+
+  // Skip rows that aren't needed, then decode the rest
+  vector<unsigned char> skipped( rowStride );
+  while( ( res.result == true ) && ( stream.getNextRow() < first ) )
+  {
+    res = stream.readRow( skipped.data() );
+    firstRow++;
+  }
+  while( ( res.result == true ) && ( stream.getNextRow() <= last ) )
+  {
+    pixels.resize( pixels.size() + rowStride );
+    res = stream.readRow( &pixels[ pixels.size() - rowStride ] );
+  }
+
   return res;
 }
 
 // ====================================================================
-// Get data
+// Georeferencing
+
+void lidarImage::setExtent( double xMin, double yMin, double xMax, double yMax )
+{
+  minX = xMin;
+  minY = yMin;
+  maxX = xMax;
+  maxY = yMax;
+  georeferenced = true;
+}
+
+// --------------------------------------------------------------------
 
-struct returnResult  lidarImage::getPixel( unsigned int x, unsigned int y,
-               unsigned char& red, unsigned char& green, unsigned char& blue )
+struct returnResult lidarImage::readWorldFile( string fileName )
 {
- struct returnResult res = { true, "" };
-
- if( ( x >= xSize ) || ( y >= ySize ) )
- {
-   res.result = false;
-   res.reason = "Image coordinates out of range";
- }
- else
- {
-   red = values[x][y].red;
-   green = values[x][y].green;
-   blue = values[x][y].blue;
- }
-
- return res;
+  struct returnResult res = { true, "" };
+
+  // Six lines: pixel width, two rotation terms, pixel height ( negative ),
+  // then the centre of the top left pixel
+  ifstream worldFile( fileName, ios::in );
+  double values[6];
+  unsigned int count = 0;
+  while( ( count < 6 ) && ( worldFile >> values[ count ] ) )
+  {
+    count++;
+  }
+
+  if( !worldFile.is_open() )
+  {
+    res.result = false;
+    res.reason = "Could not open world file: " + fileName;
+  }
+  else if( count < 6 )
+  {
+    res.result = false;
+    res.reason = "World file needs 6 values: " + fileName;
+  }
+  else if( ( values[1] != 0.0 ) || ( values[2] != 0.0 ) || ( values[0] <= 0.0 ) || ( values[3] >= 0.0 ) )
+  {
+    res.result = false;
+    res.reason = "Rotated or flipped images are not supported: " + fileName;
+  }
+  else
+  {
+    double left = values[4] - ( values[0] / 2.0 );
+    double top = values[5] - ( values[3] / 2.0 );
+    setExtent( left, top + ( values[3] * ySize ), left + ( values[0] * xSize ), top );
+  }
+
+  return res;
+}
+
+// --------------------------------------------------------------------
+
+struct returnResult lidarImage::sampleFrom( lidarImage& mosaic, double xll, double yll, double cellsize )
+{
+  struct returnResult res = { true, "" };
+
+  pixels.assign( rowStride * ySize, 0 );
+  if( ( mosaic.xSize == 0 ) || ( mosaic.ySize == 0 ) || ( ySize == 0 ) )
+  {
+    return res;
+  }
+
+  // Size of a mosaic pixel in grid units
+  double pixelWidth = ( mosaic.maxX - mosaic.minX ) / mosaic.xSize;
+  double pixelHeight = ( mosaic.maxY - mosaic.minY ) / mosaic.ySize;
+
+  // Cell centres in mosaic pixels, the top row of this image is the
+  // northern row of the grid
+  double xStep = cellsize / pixelWidth;
+  double yStep = cellsize / pixelHeight;
+  double xStart = ( ( xll + ( 0.5 * cellsize ) - mosaic.minX ) / pixelWidth ) - 0.5;
+  double yStart = ( ( mosaic.maxY - ( yll + ( ( ySize - 0.5 ) * cellsize ) ) ) / pixelHeight ) - 0.5;
+
+  // Mosaic rows that are used, positions outside them take the nearest
+  // row so the result is the same as using the whole mosaic
+  double yEnd = yStart + ( ( ySize - 1 ) * yStep );
+  unsigned int first = static_cast<unsigned int>( min( max( floor( yStart ), 0.0 ), mosaic.ySize - 1.0 ) );
+  unsigned int last = static_cast<unsigned int>( min( max( floor( yEnd ) + 1.0, 0.0 ), mosaic.ySize - 1.0 ) );
+  if( mosaic.streamed == true )
+  {
+    res = mosaic.loadRows( first, last );
+    if( res.result == false )
+    {
+      return res;
+    }
+  }
+
+  resample( &mosaic.pixels[ ( first - mosaic.firstRow ) * mosaic.rowStride ], mosaic.xSize, last - first + 1,
+            xStart, xStep, yStart - first, yStep );
+
+  // Cells whose centre is outside the mosaic are black rather than
+  // repeating its edge, so a wrong extent shows up in the model
+  for( unsigned int y=0; y<ySize; y++ )
+  {
+    double row = yStart + ( y * yStep );
+    bool rowOutside = ( row < -0.5 ) || ( row > mosaic.ySize - 0.5 );
+    unsigned char* out = &pixels[ y * rowStride ];
+    for( unsigned int x=0; x<xSize; x++ )
+    {
+      double column = xStart + ( x * xStep );
+      if( ( rowOutside == true ) || ( column < -0.5 ) || ( column > mosaic.xSize - 0.5 ) )
+      {
+        std::fill( out + ( x * 3 ), out + ( x * 3 ) + 3, 0 );
+      }
+    }
+  }
+
+  return res;
+}
+
+// --------------------------------------------------------------------
+
+void lidarImage::resample( const unsigned char* image, unsigned int width, unsigned int height,
+                           double xStart, double xStep, double yStart, double yStep )
+{
+  pixels.assign( rowStride * ySize, 0 );
+
+  // Position of each pixel centre in the source image, edges repeated
+  auto taps = []( unsigned int i, double start, double step, unsigned int sourceSize,
+                  unsigned int& first, unsigned int& second, float& t )
+  {
+    double position = start + ( i * step );
+    position = min( max( position, 0.0 ), sourceSize - 1.0 );
+    first = static_cast<unsigned int>( position );
+    second = min( first + 1, sourceSize - 1 );
+    t = static_cast<float>( position - first );
+  };
+
+  vector<unsigned int> left( xSize ), right( xSize );
+  vector<float> across( xSize );
+  for( unsigned int x=0; x<xSize; x++ )
+  {
+    taps( x, xStart, xStep, width, left[x], right[x], across[x] );
+  }
+
+  size_t sourceStride = static_cast<size_t>( width ) * 3;
+  parallelFor( ySize, defaultThreadCount(), [&]( unsigned int first, unsigned int last )
+  {
+    for( unsigned int y=first; y<last; y++ )
+    {
+      // Rows in file order
+      unsigned int top, bottom;
+      float down;
+      taps( y, yStart, yStep, height, top, bottom, down );
+      const unsigned char* above = &image[ top * sourceStride ];
+      const unsigned char* below = &image[ bottom * sourceStride ];
+      unsigned char* out = &pixels[ y * rowStride ];
+      for( unsigned int x=0; x<xSize; x++ )
+      {
+        const unsigned char* a = above + ( left[x] * 3 );
+        const unsigned char* b = above + ( right[x] * 3 );
+        const unsigned char* c = below + ( left[x] * 3 );
+        const unsigned char* d = below + ( right[x] * 3 );
+        float t = across[x];
+        for( unsigned int k=0; k<3; k++ )
+        {
+          float upper = a[k] + ( t * ( b[k] - a[k] ) );
+          float lower = c[k] + ( t * ( d[k] - c[k] ) );
+          out[ ( x * 3 ) + k ] = static_cast<unsigned char>( upper + ( down * ( lower - upper ) ) + 0.5f );
+        }
+      }
+    }
+  } );
 }
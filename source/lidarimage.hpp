@@ -18,29 +18,72 @@
 #define LIDARIMAGE_H
 
 #include "util.hpp"
+#include "pngstream.hpp"
 #include <string>
 #include <vector>
 
 using namespace std;
 
-/// Class to read and store png images.
+/// Class to read and store png images. The pixels are kept as one block
+/// of 8 bit RGB values, in file order, i.e. the first row is the top
+/// ( northern ) edge of the image. Pixel coordinates have y = 0 at the
+/// bottom to match the LiDAR grids. An image can also be given the area
+/// it covers, in grid coordinates, so that the overlay for each LiDAR file
+/// can be cut from one large ( mosaic ) image. Very large mosaics can be
+/// streamed, so that only the rows needed for the current LiDAR file are
+/// decoded and kept.
 
 class lidarImage
 {
 
-  struct rgb {
-    unsigned int red;
-    unsigned int green;
-    unsigned int blue;
-  };
-
   unsigned int xSize;
   unsigned int ySize;
   unsigned int maxColourDepth;
-  struct rgb** values;
+  size_t rowStride;
+  vector<unsigned char> pixels;
+
+  // Streamed images only hold rows firstRow onwards ( counted from the top )
+  pngStream stream;
+  bool streamed;
+  unsigned int firstRow;
+
+  // Area covered by the image, in grid coordinates
+  bool georeferenced;
+  double minX;
+  double minY;
+  double maxX;
+  double maxY;
+
+  /// Fill the image by bilinear interpolation of another image. Pixel
+  /// ( x, row ) is taken from position ( xStart + x * xStep, yStart + row * yStep )
+  /// of the other image, rows counted from the top. Positions outside the
+  /// other image take the nearest edge pixel.
+  /// @param[in] image : RGB values of the other image, rows in file order
+  /// @param[in] width : width of the other image
+  /// @param[in] height : height of the other image
+  /// @param[in] xStart : position of the first column in the other image
+  /// @param[in] xStep : distance between columns in the other image
+  /// @param[in] yStart : position of the top row in the other image
+  /// @param[in] yStep : distance between rows in the other image
+  ///
+  void resample( const unsigned char* image, unsigned int width, unsigned int height,
+                 double xStart, double xStep, double yStart, double yStep );
+
+  /// Make sure that rows first to last ( counted from the top ) of a
+  /// streamed image are decoded. Rows above "first" are discarded, going
+  /// back up the image decodes it again from the top.
+  /// @param[in] first : first row needed
+  /// @param[in] last : last row needed
+  /// @return Success/fail & error message
+  ///
+  struct returnResult loadRows( unsigned int first, unsigned int last );
 
 public:
 
+  /// Constructor for an empty image, readFromFile keeps the size of the file
+  ///
+  lidarImage( void );
+
   /// Constructor, any errors in memory allocation will cause an exception
   /// @param[in] x : X size of image
   /// @param[in] y : Y size of image
@@ -48,22 +91,114 @@ public:
   ///
   lidarImage( unsigned int x, unsigned int y, unsigned int colourDepth );
 
-  /// Populate the image from a disk file.
+  /// Populate the image from a disk file. Images of a different size are
+  /// stretched to fit using bilinear interpolation.
   /// @param[in] fileName : path to file
   /// @return Success/fail & error message
   ///
   struct returnResult readFromFile( string fileName );
 
-  /// Add a vertex
+  /// Open a PNG file to be decoded a few rows at a time by sampleFrom,
+  /// rather than all at once. The image takes the size of the file and
+  /// can only be used with sampleFrom. Interlaced files can't be streamed
+  /// so are read with readFromFile instead.
+  /// @param[in] fileName : path to file
+  /// @return Success/fail & error message
+  ///
+  struct returnResult openStream( string fileName );
+
+  /// Set the area covered by the image
+  /// @param[in] xMin : grid X coordinate of the left edge
+  /// @param[in] yMin : grid Y coordinate of the bottom edge
+  /// @param[in] xMax : grid X coordinate of the right edge
+  /// @param[in] yMax : grid Y coordinate of the top edge
+  ///
+  void setExtent( double xMin, double yMin, double xMax, double yMax );
+
+  /// Set the area covered by the image from a world file ( e.g. ".pgw" ),
+  /// the image must already be read. Rotated images aren't supported.
+  /// @param[in] fileName : path to world file
+  /// @return Success/fail & error message
+  ///
+  struct returnResult readWorldFile( string fileName );
+
+  /// @return true if the area covered by the image is known
+  ///
+  bool isGeoreferenced( void ) const { return georeferenced; }
+
+  /// Check whether the image covers an area
+  /// @param[in] xMin : grid X coordinate of the left edge
+  /// @param[in] yMin : grid Y coordinate of the bottom edge
+  /// @param[in] xMax : grid X coordinate of the right edge
+  /// @param[in] yMax : grid Y coordinate of the top edge
+  /// @return true if the image is georeferenced and the area is inside it
+  ///
+  bool covers( double xMin, double yMin, double xMax, double yMax ) const
+  {
+    return ( georeferenced == true ) && ( xMin >= minX ) && ( yMin >= minY )
+        && ( xMax <= maxX ) && ( yMax <= maxY );
+  }
+
+  /// Fill the image from the part of a larger, georeferenced image that
+  /// covers a LiDAR grid, using bilinear interpolation. Pixel ( x, y ) is
+  /// the colour at the centre of cell ( x, y ) of the grid. Cells outside
+  /// the area covered by the larger image are black.
+  /// @param[in] mosaic : georeferenced image to sample
+  /// @param[in] xll : grid X coordinate of the lower left corner of the grid
+  /// @param[in] yll : grid Y coordinate of the lower left corner of the grid
+  /// @param[in] cellsize : cell size of the grid
+  /// @return Success/fail & error message
+  ///
+  struct returnResult sampleFrom( lidarImage& mosaic, double xll, double yll, double cellsize );
+
+  /// Get a pixel. No range checking is done.
   /// @param[in] x : X coordinate of pixel
   /// @param[in] y : y coordinate of pixel
   /// @param[out] red : red value of pixel
   /// @param[out] green : green value of pixel
   /// @param[out] blue : blue value of pixel
-  /// @return Success/fail & error message
   ///
-  struct returnResult  getPixel( unsigned int x, unsigned int y,
-                 unsigned char& red, unsigned char& green, unsigned char& blue );
+  void getPixel( unsigned int x, unsigned int y,
+                 unsigned char& red, unsigned char& green, unsigned char& blue ) const
+  {
+    const unsigned char* p = getRow( y ) + ( x * 3 );
+    red = p[0];
+    green = p[1];
+    blue = p[2];
+  }
+
+  /// Set a pixel. No range checking is done.
+  /// @param[in] x : X coordinate of pixel
+  /// @param[in] y : y coordinate of pixel
+  /// @param[in] red : red value of pixel
+  /// @param[in] green : green value of pixel
+  /// @param[in] blue : blue value of pixel
+  ///
+  void setPixel( unsigned int x, unsigned int y,
+                 unsigned char red, unsigned char green, unsigned char blue )
+  {
+    unsigned char* p = &pixels[ ( ( ySize - 1 - y ) * rowStride ) + ( x * 3 ) ];
+    p[0] = red;
+    p[1] = green;
+    p[2] = blue;
+  }
+
+  /// Get a pointer to a row of RGB values. No range checking is done.
+  /// @param[in] y : row, 0 is the bottom of the image
+  /// @return Pointer to the first pixel of the row
+  ///
+  const unsigned char* getRow( unsigned int y ) const
+  {
+    return &pixels[ ( ySize - 1 - y ) * rowStride ];
+  }
+
+  /// @return X size of image
+  ///
+  unsigned int getXSize( void ) { return xSize; }
+
+  /// @return Y size of image
+  ///
+  unsigned int getYSize( void ) { return ySize; }
 
 };
 
@@ -0,0 +1,399 @@
+// lidarlas.cpp - Read LAS point cloud files
+// Copyright (C) 2018 John Davies
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// LAS specification: https://www.asprs.org/divisions-committees/lidar-division/laser-las-file-format-exchange-activities
+
+#include "lidarlas.hpp"
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <algorithm>
+
+using namespace std;
+
+// Public header block offsets
+static const size_t LAS_VERSION_MAJOR = 24;
+static const size_t LAS_VERSION_MINOR = 25;
+static const size_t LAS_HEADER_SIZE = 94;
+static const size_t LAS_POINT_OFFSET = 96;
+static const size_t LAS_POINT_FORMAT = 104;
+static const size_t LAS_RECORD_LENGTH = 105;
+static const size_t LAS_LEGACY_POINT_COUNT = 107;
+static const size_t LAS_SCALE = 131;
+static const size_t LAS_OFFSET = 155;
+static const size_t LAS_MAX_X = 179;
+static const size_t LAS_POINT_COUNT = 247;      // LAS 1.4
+static const size_t LAS_HEADER_MIN = 227;
+static const size_t LAS_HEADER_14 = 375;
+
+// Grids with more cells than this per thread are binned with fewer threads
+static const UINT64 LAS_PARTIAL_GRID_BYTES = 1ULL << 30;
+// Minimum number of points for each thread
+static const UINT64 LAS_POINTS_PER_THREAD = 1 << 20;
+
+// Little endian field access
+static inline unsigned int get16( const unsigned char* p )
+{
+  return p[0] | ( p[1] << 8 );
+}
+
+static inline UINT32 get32( const unsigned char* p )
+{
+  return static_cast<UINT32>( p[0] ) | ( static_cast<UINT32>( p[1] ) << 8 )
+       | ( static_cast<UINT32>( p[2] ) << 16 ) | ( static_cast<UINT32>( p[3] ) << 24 );
+}
+
+static inline UINT64 get64( const unsigned char* p )
+{
+  return static_cast<UINT64>( get32( p ) ) | ( static_cast<UINT64>( get32( p + 4 ) ) << 32 );
+}
+
+static inline double getDouble( const unsigned char* p )
+{
+  UINT64 bits = get64( p );
+  double d;
+  memcpy( &d, &bits, sizeof( d ) );
+  return d;
+}
+
+// Smallest record length of each point format, 0 if the format isn't supported
+static unsigned int minimumRecordLength( unsigned int format )
+{
+  switch( format )
+  {
+    case 0: return 20;
+    case 1: return 28;
+    case 2: return 26;
+    case 3: return 34;
+    case 6: return 30;
+    case 7: return 36;
+    case 8: return 38;
+    default: return 0;
+  }
+}
+
+// ====================================================================
+// Constructor
+
+lidarLas::lidarLas( void )
+{
+  fileData = NULL;
+  fileSize = 0;
+  versionMajor = 0;
+  versionMinor = 0;
+  pointFormat = 0;
+  recordLength = 0;
+  pointOffset = 0;
+  pointCount = 0;
+  for( int i=0; i<3; i++ )
+  {
+    scale[i] = 1.0;
+    offset[i] = 0.0;
+    minimum[i] = 0.0;
+    maximum[i] = 0.0;
+  }
+}
+
+// ====================================================================
+// Header
+
+bool lidarLas::isLas( const char* data, size_t size )
+{
+  return ( size >= 4 ) && ( memcmp( data, "LASF", 4 ) == 0 );
+}
+
+// --------------------------------------------------------------------
+
+struct returnResult lidarLas::open( const char* data, size_t size )
+{
+  struct returnResult res = { true, "" };
+
+  fileData = reinterpret_cast<const unsigned char*>( data );
+  fileSize = size;
+
+  try
+  {
+    if( ( isLas( data, size ) == false ) || ( size < LAS_HEADER_MIN ) )
+    {
+      throw invalid_argument( "Not a LAS file" );
+    }
+
+    versionMajor = fileData[ LAS_VERSION_MAJOR ];
+    versionMinor = fileData[ LAS_VERSION_MINOR ];
+    unsigned int headerSize = get16( fileData + LAS_HEADER_SIZE );
+    if( ( versionMajor != 1 ) || ( headerSize < LAS_HEADER_MIN ) || ( headerSize > size ) )
+    {
+      throw invalid_argument( "Unsupported LAS version " + to_string( versionMajor ) + "."
+                              + to_string( versionMinor ) );
+    }
+
+    // The top bits of the format are set by LAZ compression
+    unsigned int format = fileData[ LAS_POINT_FORMAT ];
+    if( ( format & 0xc0 ) != 0 )
+    {
+      throw invalid_argument( "Compressed ( LAZ ) files are not supported" );
+    }
+    pointFormat = format;
+    recordLength = get16( fileData + LAS_RECORD_LENGTH );
+    if( minimumRecordLength( pointFormat ) == 0 )
+    {
+      throw invalid_argument( "Unsupported LAS point format: " + to_string( pointFormat ) );
+    }
+    if( recordLength < minimumRecordLength( pointFormat ) )
+    {
+      throw invalid_argument( "LAS point records are too short" );
+    }
+
+    pointOffset = get32( fileData + LAS_POINT_OFFSET );
+    pointCount = get32( fileData + LAS_LEGACY_POINT_COUNT );
+    if( ( versionMinor >= 4 ) && ( headerSize >= LAS_HEADER_14 ) )
+    {
+      pointCount = get64( fileData + LAS_POINT_COUNT );
+    }
+    if( ( pointOffset > size ) || ( pointCount > ( size - pointOffset ) / recordLength ) )
+    {
+      throw invalid_argument( "LAS file is truncated" );
+    }
+
+    for( int i=0; i<3; i++ )
+    {
+      scale[i] = getDouble( fileData + LAS_SCALE + ( i * 8 ) );
+      offset[i] = getDouble( fileData + LAS_OFFSET + ( i * 8 ) );
+      // Stored as max X, min X, max Y, min Y, max Z, min Z
+      maximum[i] = getDouble( fileData + LAS_MAX_X + ( i * 16 ) );
+      minimum[i] = getDouble( fileData + LAS_MAX_X + ( i * 16 ) + 8 );
+      if( scale[i] == 0.0 )
+      {
+        throw invalid_argument( "Invalid LAS scale factor" );
+      }
+    }
+  }
+  catch( const std::invalid_argument& e )
+  {
+    res.result = false;
+    res.reason = e.what();
+  }
+
+  return res;
+}
+
+// ====================================================================
+// Points
+
+bool lidarLas::hasColour( void ) const
+{
+  return ( pointFormat == 2 ) || ( pointFormat == 3 ) || ( pointFormat == 7 ) || ( pointFormat == 8 );
+}
+
+// --------------------------------------------------------------------
+
+void lidarLas::getPoint( UINT64 index, struct lasPoint& point ) const
+{
+  const unsigned char* p = fileData + pointOffset + ( index * recordLength );
+
+  point.x = ( static_cast<int32_t>( get32( p ) ) * scale[0] ) + offset[0];
+  point.y = ( static_cast<int32_t>( get32( p + 4 ) ) * scale[1] ) + offset[1];
+  point.z = ( static_cast<int32_t>( get32( p + 8 ) ) * scale[2] ) + offset[2];
+  point.intensity = get16( p + 12 );
+
+  const unsigned char* colour = NULL;
+  if( pointFormat < 6 )
+  {
+    point.returnNumber = p[14] & 0x07;
+    point.numberOfReturns = ( p[14] >> 3 ) & 0x07;
+    point.classification = p[15] & 0x1f;
+    point.withheld = ( p[15] & 0x80 ) != 0;
+    if( pointFormat == 2 )
+    {
+      colour = p + 20;
+    }
+    else if( pointFormat == 3 )
+    {
+      colour = p + 28;
+    }
+  }
+  else
+  {
+    point.returnNumber = p[14] & 0x0f;
+    point.numberOfReturns = p[14] >> 4;
+    point.classification = p[16];
+    point.withheld = ( p[15] & 0x04 ) != 0;
+    if( pointFormat >= 7 )
+    {
+      colour = p + 30;
+    }
+  }
+
+  if( colour != NULL )
+  {
+    point.red = get16( colour );
+    point.green = get16( colour + 2 );
+    point.blue = get16( colour + 4 );
+  }
+  else
+  {
+    point.red = 0;
+    point.green = 0;
+    point.blue = 0;
+  }
+}
+
+// ====================================================================
+// Gridding
+
+void lidarLas::binPoints( lidar& grid, enum lidarBinning binning ) const
+{
+  unsigned int cols = grid.getNoColumns();
+  unsigned int rows = grid.getNoRows();
+  double xll = grid.getXllcorner();
+  double yll = grid.getYllcorner();
+  double size = grid.getCellsize();
+  float noData = grid.getNODATA_value();
+  size_t cells = static_cast<size_t>( cols ) * rows;
+  if( cells == 0 )
+  {
+    return;
+  }
+
+  // Each thread bins a contiguous run of points into its own grid. The
+  // number of threads is limited so that the partial grids fit in memory.
+  bool mean = ( binning == BIN_MEAN );
+  UINT64 cellBytes = mean ? sizeof( double ) + sizeof( UINT32 ) : sizeof( float );
+  UINT64 threads = defaultThreadCount();
+  threads = min( threads, max<UINT64>( 1, pointCount / LAS_POINTS_PER_THREAD ) );
+  while( ( threads > 1 ) && ( threads * cells * cellBytes > LAS_PARTIAL_GRID_BYTES ) )
+  {
+    threads--;
+  }
+
+  const float none = numeric_limits<float>::quiet_NaN();
+  vector< vector<float> > level( mean ? 0 : threads );
+  vector< vector<double> > sum( mean ? threads : 0 );
+  vector< vector<UINT32> > count( mean ? threads : 0 );
+
+  parallelFor( threads, threads, [&]( unsigned int first, unsigned int last )
+  {
+    for( unsigned int t=first; t<last; t++ )
+    {
+      if( mean == true )
+      {
+        sum[t].assign( cells, 0.0 );
+        count[t].assign( cells, 0 );
+      }
+      else
+      {
+        level[t].assign( cells, none );
+      }
+
+      UINT64 begin = ( pointCount * t ) / threads;
+      UINT64 end = ( pointCount * ( t + 1 ) ) / threads;
+      struct lasPoint point;
+      for( UINT64 i=begin; i<end; i++ )
+      {
+        getPoint( i, point );
+        if( point.withheld == true )
+        {
+          continue;
+        }
+        // Only the last ( lowest ) return of each pulse
+        if( ( binning == BIN_LAST_RETURN ) && ( point.returnNumber < point.numberOfReturns ) )
+        {
+          continue;
+        }
+        double cx = floor( ( point.x - xll ) / size );
+        double cy = floor( ( point.y - yll ) / size );
+        if( ( cx < 0.0 ) || ( cy < 0.0 ) || ( cx >= cols ) || ( cy >= rows ) )
+        {
+          continue;
+        }
+        size_t cell = ( static_cast<size_t>( cy ) * cols ) + static_cast<size_t>( cx );
+        float z = static_cast<float>( point.z );
+        switch( binning )
+        {
+          case BIN_MIN:
+          case BIN_LAST_RETURN:
+            if( !( level[t][cell] <= z ) )
+            {
+              level[t][cell] = z;
+            }
+            break;
+          case BIN_MAX:
+            if( !( level[t][cell] >= z ) )
+            {
+              level[t][cell] = z;
+            }
+            break;
+          case BIN_MEAN:
+            sum[t][cell] += point.z;
+            count[t][cell]++;
+            break;
+        }
+      }
+    }
+  } );
+
+  // Merge the partial grids a band of rows at a time
+  parallelFor( rows, defaultThreadCount(), [&]( unsigned int first, unsigned int last )
+  {
+    for( unsigned int r=first; r<last; r++ )
+    {
+      float* row = grid.getRow( r );
+      for( unsigned int c=0; c<cols; c++ )
+      {
+        size_t cell = ( static_cast<size_t>( r ) * cols ) + c;
+        float value = noData;
+        if( mean == true )
+        {
+          double total = 0.0;
+          UINT64 n = 0;
+          for( UINT64 t=0; t<threads; t++ )
+          {
+            total += sum[t][cell];
+            n += count[t][cell];
+          }
+          if( n > 0 )
+          {
+            value = static_cast<float>( total / n );
+          }
+        }
+        else
+        {
+          float best = none;
+          for( UINT64 t=0; t<threads; t++ )
+          {
+            float v = level[t][cell];
+            if( std::isnan( v ) )
+            {
+              continue;
+            }
+            if( std::isnan( best ) || ( ( binning == BIN_MAX ) ? ( v > best ) : ( v < best ) ) )
+            {
+              best = v;
+            }
+          }
+          if( !std::isnan( best ) )
+          {
+            value = best;
+          }
+        }
+        row[c] = value;
+      }
+    }
+  } );
+}
@@ -0,0 +1,125 @@
+// lidarlas.hpp - header file for lidarlas
+// Copyright (C) 2018 John Davies
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LIDARLAS_H
+#define LIDARLAS_H
+
+#include "util.hpp"
+#include "lidarlib.hpp"
+#include <string>
+#include <cstddef>
+
+using namespace std;
+
+/// One point record, converted to world coordinates
+///
+struct lasPoint {
+  double x;
+  double y;
+  double z;
+  unsigned int intensity;
+  unsigned int returnNumber;
+  unsigned int numberOfReturns;
+  unsigned int classification;
+  bool withheld;
+  unsigned int red;     ///< colour, 16 bit, only set for formats with RGB
+  unsigned int green;
+  unsigned int blue;
+};
+
+/// Reader for LAS 1.0 - 1.4 point cloud files with point data record
+/// formats 0 - 3 and 6 - 8. Compressed ( LAZ ) files are not supported.
+/// The file contents must stay in memory while the reader is in use.
+///
+
+class lidarLas
+{
+  // File contents
+  const unsigned char* fileData;
+  size_t fileSize;
+
+  // Header
+  unsigned int versionMajor;
+  unsigned int versionMinor;
+  unsigned int pointFormat;
+  unsigned int recordLength;
+  size_t pointOffset;
+  UINT64 pointCount;
+  double scale[3];
+  double offset[3];
+  double minimum[3];
+  double maximum[3];
+
+public:
+
+  /// Constructor
+  ///
+  lidarLas( void );
+
+  /// Parse the public header block of a LAS file
+  /// @param[in] data : file contents
+  /// @param[in] size : number of bytes in "data"
+  /// @return Success/fail & error message
+  ///
+  struct returnResult open( const char* data, size_t size );
+
+  /// Check whether a buffer starts with the LAS signature
+  /// @param[in] data : file contents
+  /// @param[in] size : number of bytes in "data"
+  /// @return true if it looks like a LAS file
+  ///
+  static bool isLas( const char* data, size_t size );
+
+  /// @return Number of point records
+  ///
+  UINT64 getPointCount( void ) const { return pointCount; }
+
+  /// @return Point data record format
+  ///
+  unsigned int getPointFormat( void ) const { return pointFormat; }
+
+  /// @return true if the point records include a colour
+  ///
+  bool hasColour( void ) const;
+
+  /// @return Bounds of the points, from the header
+  ///
+  double getMinX( void ) const { return minimum[0]; }
+  double getMinY( void ) const { return minimum[1]; }
+  double getMinZ( void ) const { return minimum[2]; }
+  double getMaxX( void ) const { return maximum[0]; }
+  double getMaxY( void ) const { return maximum[1]; }
+  double getMaxZ( void ) const { return maximum[2]; }
+
+  /// Decode a point record
+  /// @param[in] index : point number, 0 to getPointCount() - 1
+  /// @param[out] point : decoded point
+  ///
+  void getPoint( UINT64 index, struct lasPoint& point ) const;
+
+  /// Bin the points into a grid. The grid must already be allocated, its
+  /// header gives the area and cell size. Withheld points and points
+  /// outside the grid are ignored and cells without points are NODATA.
+  /// Points are binned in parallel into per thread grids that are then
+  /// merged. Statistics are not updated.
+  /// @param[in,out] grid : grid to fill
+  /// @param[in] binning : how the points in a cell are combined
+  ///
+  void binPoints( lidar& grid, enum lidarBinning binning ) const;
+
+};
+
+#endif
@@ -16,6 +16,10 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "lidarlib.hpp"
+#include "mappedfile.hpp"
+#include "geotiff.hpp"
+#include "lidarlas.hpp"
+#include "lodepng.h"
 #include <iostream>
 #include <fstream>
 #include <string>
@@ -24,185 +28,1827 @@
 #include <algorithm>
 #include <stdexcept>
 #include <cctype>
+#include <cstring>
+#include <cmath>
+#include <cstdlib>
+#include <new>
+#include <climits>
+#include <mutex>
+#include <memory>
+#include <cstdio>
+#include <sys/stat.h>
 
 using namespace std;
 
+// ====================================================================
+// Constructors / destructor
+
+lidar::lidar( void )
+{
+  ncols = 0;
+  nrows = 0;
+  xllcorner = 0;
+  yllcorner = 0;
+  cellsize = 0.0;
+  NODATA_value = 0.0;
+  values = NULL;
+  rowStride = 0;
+  cacheEnabled = false;
+  decimation = 1;
+  decimationPooling = POOL_NEAREST;
+  binCellsize = 1.0;
+  binning = BIN_MAX;
+  maskStride = 0;
+  statisticsValid = false;
+  minValue = 0.0;
+  maxValue = 0.0;
+  meanValue = 0.0;
+  nodataCount = 0;
+}
+
+// --------------------------------------------------------------------
+
+lidar::lidar( unsigned int columns, unsigned int rows, unsigned int xll, unsigned int yll,
+              float size, float noData )
+{
+  values = NULL;
+  rowStride = 0;
+  cacheEnabled = false;
+  decimation = 1;
+  decimationPooling = POOL_NEAREST;
+  binCellsize = 1.0;
+  binning = BIN_MAX;
+  maskStride = 0;
+  statisticsValid = false;
+  minValue = 0.0;
+  maxValue = 0.0;
+  meanValue = 0.0;
+  nodataCount = 0;
+  xllcorner = xll;
+  yllcorner = yll;
+  cellsize = size;
+  NODATA_value = noData;
+  allocate( columns, rows );
+  for( unsigned int r=0; r<nrows; r++ )
+  {
+    std::fill( getRow( r ), getRow( r ) + ncols, NODATA_value );
+  }
+  updateStatistics();
+}
+
+// --------------------------------------------------------------------
+
+lidar::lidar( lidar&& other )
+{
+  ncols = other.ncols;
+  nrows = other.nrows;
+  xllcorner = other.xllcorner;
+  yllcorner = other.yllcorner;
+  cellsize = other.cellsize;
+  NODATA_value = other.NODATA_value;
+  values = other.values;
+  rowStride = other.rowStride;
+  cacheEnabled = other.cacheEnabled;
+  decimation = other.decimation;
+  decimationPooling = other.decimationPooling;
+  binCellsize = other.binCellsize;
+  binning = other.binning;
+  nodataMask = std::move( other.nodataMask );
+  maskStride = other.maskStride;
+  rowStatistics = std::move( other.rowStatistics );
+  statisticsValid = other.statisticsValid;
+  minValue = other.minValue;
+  maxValue = other.maxValue;
+  meanValue = other.meanValue;
+  nodataCount = other.nodataCount;
+
+  other.values = NULL;
+  other.rowStride = 0;
+  other.ncols = 0;
+  other.nrows = 0;
+  other.maskStride = 0;
+  other.statisticsValid = false;
+}
+
+// --------------------------------------------------------------------
+
+lidar& lidar::operator=( lidar&& other )
+{
+  if( this != &other )
+  {
+    release();
+    ncols = other.ncols;
+    nrows = other.nrows;
+    xllcorner = other.xllcorner;
+    yllcorner = other.yllcorner;
+    cellsize = other.cellsize;
+    NODATA_value = other.NODATA_value;
+    values = other.values;
+    rowStride = other.rowStride;
+    cacheEnabled = other.cacheEnabled;
+    decimation = other.decimation;
+    decimationPooling = other.decimationPooling;
+    binCellsize = other.binCellsize;
+    binning = other.binning;
+    nodataMask = std::move( other.nodataMask );
+    maskStride = other.maskStride;
+    rowStatistics = std::move( other.rowStatistics );
+    statisticsValid = other.statisticsValid;
+    minValue = other.minValue;
+    maxValue = other.maxValue;
+    meanValue = other.meanValue;
+    nodataCount = other.nodataCount;
+
+    other.values = NULL;
+    other.rowStride = 0;
+    other.ncols = 0;
+    other.nrows = 0;
+    other.maskStride = 0;
+    other.statisticsValid = false;
+  }
+  return *this;
+}
+
+// --------------------------------------------------------------------
+
+lidar::~lidar( void )
+{
+  release();
+}
+
+// ====================================================================
+// Memory management
+
+void lidar::allocate( unsigned int columns, unsigned int rows )
+{
+  release();
+
+  // Round each row up to a whole number of aligned blocks so that every
+  // row starts on an aligned boundary
+  const size_t perBlock = LIDAR_ALIGNMENT / sizeof( float );
+  size_t stride = ( ( columns + perBlock - 1 ) / perBlock ) * perBlock;
+  size_t bytes = stride * rows * sizeof( float );
+
+  void* p = NULL;
+  if( bytes > 0 )
+  {
+    if( posix_memalign( &p, LIDAR_ALIGNMENT, bytes ) != 0 )
+    {
+      throw bad_alloc();
+    }
+  }
+
+  values = static_cast<float*>( p );
+  rowStride = stride;
+  ncols = columns;
+  nrows = rows;
+
+  // One bit per cell, each row starts on a new word
+  maskStride = ( columns + 63 ) / 64;
+  nodataMask.assign( maskStride * rows, 0 );
+  rowStatistics.assign( rows, rowStatistics_t() );
+  statisticsValid = false;
+}
+
+// --------------------------------------------------------------------
+
+void lidar::release( void )
+{
+  free( values );
+  values = NULL;
+  rowStride = 0;
+  nodataMask.clear();
+  maskStride = 0;
+  rowStatistics.clear();
+  statisticsValid = false;
+}
+
+// ====================================================================
+// Text parsing helpers
+
+static inline bool isSpace( char c )
+{
+  return ( c == ' ' ) || ( c == '\t' ) || ( c == '\n' ) || ( c == '\r' )
+      || ( c == '\v' ) || ( c == '\f' );
+}
+
+// --------------------------------------------------------------------
+
+static inline const char* skipSpace( const char* p, const char* end )
+{
+  while( ( p < end ) && isSpace( *p ) )
+  {
+    p++;
+  }
+  return p;
+}
+
+// --------------------------------------------------------------------
+
+static inline const char* skipToken( const char* p, const char* end )
+{
+  while( ( p < end ) && !isSpace( *p ) )
+  {
+    p++;
+  }
+  return p;
+}
+
+// --------------------------------------------------------------------
+
+// Slow but complete conversion for anything the fast path doesn't handle,
+// e.g. very long mantissas, large exponents, "nan" etc.
+// Returns NULL if the token is not a valid number
+static const char* parseNumberSlow( const char* p, const char* end, float& value )
+{
+  const char* tokenEnd = skipToken( p, end );
+  char buffer[64];
+  size_t length = tokenEnd - p;
+  if( length == 0 || length >= sizeof( buffer ) )
+  {
+    return NULL;
+  }
+  memcpy( buffer, p, length );
+  buffer[ length ] = '\0';
+  char* converted;
+  value = strtof( buffer, &converted );
+  if( converted != buffer + length )
+  {
+    return NULL;
+  }
+  return tokenEnd;
+}
+
+// --------------------------------------------------------------------
+
+// Convert the decimal number starting at "p". The usual LiDAR values,
+// e.g. "123.456" or "-9999", are converted without any library calls.
+// Mantissas of up to 15 digits and powers of 10 up to 22 are exact in a
+// double, so the double is correctly rounded. Anything else goes to strtof.
+// Returns a pointer to the character after the number or NULL if the
+// token is not a valid number
+static inline const char* parseNumber( const char* p, const char* end, float& value )
+{
+  // Exact powers of 10 that can be represented by a double
+  static const double powersOf10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+  static const int MAX_DIGITS = 15;
+
+  const char* start = p;
+  bool negative = false;
+  if( ( p < end ) && ( ( *p == '-' ) || ( *p == '+' ) ) )
+  {
+    negative = ( *p == '-' );
+    p++;
+  }
+
+  UINT64 mantissa = 0;
+  int digits = 0;
+  int exponent = 0;
+  bool found = false;
+
+  // Integer part
+  while( ( p < end ) && ( *p >= '0' ) && ( *p <= '9' ) )
+  {
+    if( digits == MAX_DIGITS )
+    {
+      return parseNumberSlow( start, end, value );
+    }
+    mantissa = ( mantissa * 10 ) + ( *p - '0' );
+    if( mantissa != 0 )
+    {
+      digits++;
+    }
+    found = true;
+    p++;
+  }
+
+  // Fractional part
+  if( ( p < end ) && ( *p == '.' ) )
+  {
+    p++;
+    while( ( p < end ) && ( *p >= '0' ) && ( *p <= '9' ) )
+    {
+      if( digits == MAX_DIGITS )
+      {
+        return parseNumberSlow( start, end, value );
+      }
+      mantissa = ( mantissa * 10 ) + ( *p - '0' );
+      if( mantissa != 0 )
+      {
+        digits++;
+      }
+      exponent--;
+      found = true;
+      p++;
+    }
+  }
+
+  if( found == false )
+  {
+    return parseNumberSlow( start, end, value );
+  }
+
+  // Exponent
+  if( ( p < end ) && ( ( *p == 'e' ) || ( *p == 'E' ) ) )
+  {
+    p++;
+    bool negativeExponent = false;
+    if( ( p < end ) && ( ( *p == '-' ) || ( *p == '+' ) ) )
+    {
+      negativeExponent = ( *p == '-' );
+      p++;
+    }
+    int e = 0;
+    bool expFound = false;
+    while( ( p < end ) && ( *p >= '0' ) && ( *p <= '9' ) )
+    {
+      if( e < 10000 )
+      {
+        e = ( e * 10 ) + ( *p - '0' );
+      }
+      expFound = true;
+      p++;
+    }
+    if( expFound == false )
+    {
+      return parseNumberSlow( start, end, value );
+    }
+    exponent += negativeExponent ? -e : e;
+  }
+
+  // Must be followed by a separator
+  if( ( p < end ) && !isSpace( *p ) )
+  {
+    return parseNumberSlow( start, end, value );
+  }
+
+  if( ( exponent < -22 ) || ( exponent > 22 ) )
+  {
+    return parseNumberSlow( start, end, value );
+  }
+
+  double v = static_cast<double>( mantissa );
+  if( exponent < 0 )
+  {
+    v /= powersOf10[ -exponent ];
+  }
+  else
+  {
+    v *= powersOf10[ exponent ];
+  }
+
+  // Rounding the double to a float can differ from rounding the decimal
+  // value if the double landed exactly half way between two floats, i.e.
+  // the 29 bits that a float drops are 1 followed by zeros. The values
+  // here are all well within the range of normal floats.
+  UINT64 bits;
+  memcpy( &bits, &v, sizeof( bits ) );
+  if( ( bits & 0x1fffffffu ) == 0x10000000u )
+  {
+    return parseNumberSlow( start, end, value );
+  }
+  value = static_cast<float>( negative ? -v : v );
+
+  return p;
+}
+
+// --------------------------------------------------------------------
+
+// Data sections smaller than this are not worth starting threads for
+static const ptrdiff_t PARALLEL_PARSE_MIN_BYTES = 1 << 20;
+
+// Problems found while converting grid data
+static const int ROW_SHORT = 1;     // line has too few values
+static const int ROW_LONG = 2;      // line has too many values
+static const int ROW_INVALID = 3;   // value is not a number
+static const int ROW_EOF = 4;       // file ended before the grid was full
+
+// Thrown by the row readers, "position" is where the problem was found
+struct dataError {
+  int status;
+  const char* position;
+};
+
+// --------------------------------------------------------------------
+
+// Find the start of each non-blank line in the data section.
+// Returns true if there is exactly one line per grid row
+static bool findDataLines( const char* p, const char* end, unsigned int rows,
+                           vector<const char*>& lines )
+{
+  lines.clear();
+  lines.reserve( rows );
+  while( p < end )
+  {
+    p = skipSpace( p, end );
+    if( p >= end )
+    {
+      break;
+    }
+    if( lines.size() == rows )
+    {
+      return false;
+    }
+    lines.push_back( p );
+    const char* lineEnd = static_cast<const char*>( memchr( p, '\n', end - p ) );
+    p = ( lineEnd == NULL ) ? end : lineEnd + 1;
+  }
+  return ( lines.size() == rows );
+}
+
+// --------------------------------------------------------------------
+
+// A text file read a window at a time, e.g. by "readDifference". The file
+// stays mapped and its lines are only found once.
+struct gridSource {
+  mappedFile file;
+  bool opened;
+  bool scanned;
+  bool linesFound;
+  vector<const char*> lines;
+
+  gridSource( void ) : opened( false ), scanned( false ), linesFound( false ) {}
+};
+
+// Find the data lines, or reuse the ones found by an earlier read of the source
+static bool findSourceLines( const char* p, const char* end, unsigned int rows,
+                             struct gridSource* source, vector<const char*>& lines )
+{
+  if( source == NULL )
+  {
+    return findDataLines( p, end, rows, lines );
+  }
+  if( source->scanned == false )
+  {
+    source->linesFound = findDataLines( p, end, rows, source->lines );
+    source->scanned = true;
+  }
+  return source->linesFound;
+}
+
+// --------------------------------------------------------------------
+
+// Step over "count" values without converting them
+static inline const char* skipValues( const char* p, const char* end, UINT64 count, int status )
+{
+  for( UINT64 i=0; i<count; i++ )
+  {
+    p = skipSpace( p, end );
+    if( p >= end )
+    {
+      struct dataError e = { status, p };
+      throw e;
+    }
+    p = skipToken( p, end );
+  }
+  return p;
+}
+
+// --------------------------------------------------------------------
+
+// Convert "count" values into "row"
+static inline const char* readValues( const char* p, const char* end, float* row,
+                                      unsigned int count, int status )
+{
+  for( unsigned int c=0; c<count; c++ )
+  {
+    p = skipSpace( p, end );
+    if( p >= end )
+    {
+      struct dataError e = { status, p };
+      throw e;
+    }
+    const char* next = parseNumber( p, end, row[c] );
+    if( next == NULL )
+    {
+      struct dataError e = { ROW_INVALID, p };
+      throw e;
+    }
+    p = next;
+  }
+  return p;
+}
+
+// --------------------------------------------------------------------
+
+// Convert part of a line containing exactly "total" values. The first
+// "skip" values are ignored and the next "count" are stored in "row".
+// Throws dataError if the line doesn't match
+static void parseRow( const char* p, const char* end, unsigned int skip, unsigned int count,
+                      unsigned int total, float* row )
+{
+  const char* lineEnd = static_cast<const char*>( memchr( p, '\n', end - p ) );
+  if( lineEnd == NULL )
+  {
+    lineEnd = end;
+  }
+
+  p = skipValues( p, lineEnd, skip, ROW_SHORT );
+  p = readValues( p, lineEnd, row, count, ROW_SHORT );
+  p = skipValues( p, lineEnd, total - skip - count, ROW_SHORT );
+
+  p = skipSpace( p, lineEnd );
+  if( p < lineEnd )
+  {
+    struct dataError e = { ROW_LONG, p };
+    throw e;
+  }
+}
+
+// ====================================================================
+// Byte order helpers
+
+static void putLE( unsigned char* p, UINT64 value, int bytes )
+{
+  for( int i=0; i<bytes; i++ )
+  {
+    p[i] = static_cast<unsigned char>( value >> ( 8 * i ) );
+  }
+}
+
+// --------------------------------------------------------------------
+
+static UINT64 getLE( const unsigned char* p, int bytes )
+{
+  UINT64 value = 0;
+  for( int i=0; i<bytes; i++ )
+  {
+    value |= static_cast<UINT64>( p[i] ) << ( 8 * i );
+  }
+  return value;
+}
+
+// ====================================================================
+// Gzip support
+
+// Buffer allocated by lodepng
+typedef unique_ptr<unsigned char, void (*)( void* )> inflatedBuffer;
+
+static bool isGzip( const char* data, size_t size )
+{
+  return ( size >= 2 ) && ( static_cast<unsigned char>( data[0] ) == 0x1f )
+                       && ( static_cast<unsigned char>( data[1] ) == 0x8b );
+}
+
+// --------------------------------------------------------------------
+
+// Decompress a single member gzip file ( RFC 1952 ) using the inflate
+// code in lodepng. If "limit" is non zero, decompression stops once at
+// least "limit" bytes are available and the trailer isn't checked.
+// Throws invalid_argument on error.
+static inflatedBuffer gunzip( const char* data, size_t size, size_t limit, size_t& outSize )
+{
+  const unsigned char* in = reinterpret_cast<const unsigned char*>( data );
+  if( ( size < 18 ) || ( in[2] != 8 ) )
+  {
+    throw invalid_argument( "Unsupported gzip file" );
+  }
+
+  // Skip the optional header fields
+  unsigned char flags = in[3];
+  size_t pos = 10;
+  if( flags & 0x04 )
+  {
+    // FEXTRA
+    pos += 2 + in[ pos ] + ( in[ pos + 1 ] << 8 );
+  }
+  if( flags & 0x08 )
+  {
+    // FNAME, zero terminated
+    while( ( pos < size ) && ( in[ pos ] != 0 ) ) pos++;
+    pos++;
+  }
+  if( flags & 0x10 )
+  {
+    // FCOMMENT, zero terminated
+    while( ( pos < size ) && ( in[ pos ] != 0 ) ) pos++;
+    pos++;
+  }
+  if( flags & 0x02 )
+  {
+    // FHCRC
+    pos += 2;
+  }
+  if( pos + 8 > size )
+  {
+    throw invalid_argument( "Truncated gzip file" );
+  }
+
+  LodePNGDecompressSettings settings;
+  lodepng_decompress_settings_init( &settings );
+  settings.max_output_size = limit;
+
+  unsigned char* out = NULL;
+  outSize = 0;
+  unsigned error = lodepng_inflate( &out, &outSize, in + pos, size - pos - 8, &settings );
+  inflatedBuffer buffer( out, free );
+  // 109 is the "max_output_size" error, the data so far is still valid
+  if( ( error != 0 ) && !( ( limit != 0 ) && ( error == 109 ) ) )
+  {
+    throw invalid_argument( string( "Error decompressing file: " ) + lodepng_error_text( error ) );
+  }
+
+  if( limit == 0 )
+  {
+    const unsigned char* trailer = in + size - 8;
+    if( ( lodepng_crc32( out, outSize ) != getLE( trailer, 4 ) )
+     || ( static_cast<UINT32>( outSize ) != getLE( trailer + 4, 4 ) ) )
+    {
+      throw invalid_argument( "Gzip checksum mismatch ( multi-member files are not supported )" );
+    }
+  }
+
+  return buffer;
+}
+
+// ====================================================================
+// Windows
+
+bool lidar::clipWindow( const struct lidarWindow* window, struct lidarWindow& clipped )
+{
+  if( window == NULL )
+  {
+    clipped.col = 0;
+    clipped.row = 0;
+    clipped.ncols = ncols;
+    clipped.nrows = nrows;
+    return ( ( ncols > 0 ) && ( nrows > 0 ) );
+  }
+
+  if( ( window->col >= ncols ) || ( window->row >= nrows )
+   || ( window->ncols == 0 ) || ( window->nrows == 0 ) )
+  {
+    return false;
+  }
+
+  // The corner coordinates are whole metres so move the window start
+  // back, if necessary, to a cell that lies on a whole metre
+  unsigned int step = 1;
+  for( unsigned int k=1; k<=1000; k++ )
+  {
+    double d = k * static_cast<double>( cellsize );
+    if( fabs( d - floor( d + 0.5 ) ) < 1e-4 )
+    {
+      step = k;
+      break;
+    }
+  }
+  clipped.col = ( window->col / step ) * step;
+  clipped.row = ( window->row / step ) * step;
+
+  UINT64 lastCol = static_cast<UINT64>( window->col ) + window->ncols;
+  UINT64 lastRow = static_cast<UINT64>( window->row ) + window->nrows;
+  clipped.ncols = static_cast<unsigned int>( min<UINT64>( lastCol, ncols ) - clipped.col );
+  clipped.nrows = static_cast<unsigned int>( min<UINT64>( lastRow, nrows ) - clipped.row );
+
+  return true;
+}
+
+// --------------------------------------------------------------------
+
+unsigned int lidar::cellsToMetres( unsigned int cells )
+{
+  return static_cast<unsigned int>( floor( ( cells * static_cast<double>( cellsize ) ) + 0.5 ) );
+}
+
+// --------------------------------------------------------------------
+
+void lidar::allocateWindow( const struct lidarWindow& window )
+{
+  // Partial blocks at the north and east edges still produce a cell
+  allocate( ( window.ncols + decimation - 1 ) / decimation,
+            ( window.nrows + decimation - 1 ) / decimation );
+  xllcorner += cellsToMetres( window.col );
+  yllcorner += cellsToMetres( window.row );
+  cellsize *= decimation;
+}
+
+// ====================================================================
+// Decimation
+
+void lidar::setDecimation( unsigned int factor, enum lidarPooling pooling )
+{
+  decimation = ( factor == 0 ) ? 1 : factor;
+  decimationPooling = pooling;
+}
+
+// --------------------------------------------------------------------
+
+void lidar::setPointCloudOptions( float size, enum lidarBinning rule )
+{
+  binCellsize = size;
+  binning = rule;
+}
+
+// --------------------------------------------------------------------
+
+void lidar::buildRows( unsigned int first, unsigned int last, const struct lidarWindow& window,
+                       const function<void( unsigned int, float* )>& fetch )
+{
+  if( decimation <= 1 )
+  {
+    for( unsigned int r=last; r-- > first; )
+    {
+      fetch( r, getRow( r ) );
+      scanRow( r, rowStatistics[r] );
+    }
+    return;
+  }
+
+  vector<float> block( static_cast<size_t>( decimation ) * window.ncols );
+  for( unsigned int r=last; r-- > first; )
+  {
+    unsigned int firstRow = r * decimation;
+    unsigned int count = min( decimation, window.nrows - firstRow );
+    // North first
+    for( unsigned int k=count; k-- > 0; )
+    {
+      fetch( firstRow + k, &block[ k * window.ncols ] );
+    }
+    poolBlock( block.data(), count, window.ncols, getRow( r ) );
+    scanRow( r, rowStatistics[r] );
+  }
+}
+
+// --------------------------------------------------------------------
+
+void lidar::poolBlock( const float* block, unsigned int count, unsigned int width, float* row )
+{
+  for( unsigned int c=0; c<ncols; c++ )
+  {
+    unsigned int firstCol = c * decimation;
+    unsigned int n = min( decimation, width - firstCol );
+
+    if( decimationPooling == POOL_NEAREST )
+    {
+      // Cell nearest the centre of the block
+      unsigned int y = min( decimation / 2, count - 1 );
+      unsigned int x = min( decimation / 2, n - 1 );
+      row[c] = block[ ( y * width ) + firstCol + x ];
+    }
+    else
+    {
+      double sum = 0.0;
+      float maximum = 0.0;
+      unsigned int valid = 0;
+      for( unsigned int y=0; y<count; y++ )
+      {
+        const float* v = block + ( y * width ) + firstCol;
+        for( unsigned int x=0; x<n; x++ )
+        {
+          if( v[x] != NODATA_value )
+          {
+            if( ( valid == 0 ) || ( v[x] > maximum ) )
+            {
+              maximum = v[x];
+            }
+            sum += v[x];
+            valid++;
+          }
+        }
+      }
+
+      if( valid == 0 )
+      {
+        row[c] = NODATA_value;
+      }
+      else if( decimationPooling == POOL_MAX )
+      {
+        row[c] = maximum;
+      }
+      else
+      {
+        row[c] = static_cast<float>( sum / valid );
+      }
+    }
+  }
+}
+
+// --------------------------------------------------------------------
+
+void lidar::parseHeader( const char*& p, const char* end, string& inputLine )
+{
+  bool ncols_found = false;
+  bool nrows_found = false;
+  bool xllcorner_found = false;
+  bool yllcorner_found = false;
+  bool cellsize_found = false;
+  bool NODATA_value_found = false;
+
+  for( int i=0; i<6; i++ )
+  {
+    if( p >= end )
+    {
+      throw invalid_argument( "Unexpected end of file in header" );
+    }
+    const char* lineEnd = static_cast<const char*>( memchr( p, '\n', end - p ) );
+    if( lineEnd == NULL )
+    {
+      lineEnd = end;
+    }
+    inputLine.assign( p, lineEnd );
+    p = ( lineEnd < end ) ? lineEnd + 1 : end;
+
+    vector<string> params = split( inputLine, ' ' );
+    // convert to upper case for case insensitive comparison
+    std::transform(params.at(0).begin(), params.at(0).end(),params.at(0).begin(), ::toupper);
+    if( params.at(0) == "NCOLS" )
+    {
+      if( ncols_found == true )
+      {
+        throw invalid_argument( "Duplicate \"ncols\" header line" );
+      }
+      else
+      {
+        ncols = stoi( params.at(1) );
+        ncols_found = true;
+      }
+    }
+    else if( params.at(0) == "NROWS" )
+    {
+      if( nrows_found == true )
+      {
+        throw invalid_argument( "Duplicate \"nrows\" header line" );
+      }
+      else
+      {
+        nrows = stoi( params.at(1) );
+        nrows_found = true;
+      }
+    }
+    else if( params.at(0) == "XLLCORNER" )
+    {
+      if( xllcorner_found == true )
+      {
+        throw invalid_argument( "Duplicate \"xllcorner\" header line" );
+      }
+      else
+      {
+        xllcorner = stoi( params.at(1) );
+        xllcorner_found = true;
+      }
+    }
+    else if( params.at(0) == "YLLCORNER" )
+    {
+      if( yllcorner_found == true )
+      {
+        throw invalid_argument( "Duplicate \"yllcorner\" header line" );
+      }
+      else
+      {
+        yllcorner = stoi( params.at(1) );
+        yllcorner_found = true;
+      }
+    }
+    else if( params.at(0) == "CELLSIZE" )
+    {
+      if( cellsize_found == true )
+      {
+        throw invalid_argument( "Duplicate \"cellsize\" header line" );
+      }
+      else
+      {
+        cellsize = stof( params.at(1) );
+        cellsize_found = true;
+      }
+    }
+    else if( params.at(0) == "NODATA_VALUE" )
+    {
+      if( NODATA_value_found == true )
+      {
+        throw invalid_argument( "Duplicate \"NODATA_value\" header line" );
+      }
+      else
+      {
+        NODATA_value = stof( params.at(1) );
+        NODATA_value_found = true;
+      }
+    }
+    else
+    {
+      throw invalid_argument( "Unknown header type: " + params.at(0) );
+    }
+  }
+}
+
+// --------------------------------------------------------------------
+
+void lidar::parseTiffHeader( const char* data, size_t size, geoTiff& tiff )
+{
+  struct returnResult res = tiff.open( data, size );
+  if( res.result == false )
+  {
+    throw invalid_argument( res.reason );
+  }
+
+  // Cells must be square and the corner coordinates are whole metres
+  if( fabs( tiff.getPixelWidth() - tiff.getPixelHeight() ) > 1e-6 )
+  {
+    throw invalid_argument( "GeoTIFF pixels are not square" );
+  }
+  double south = tiff.getTop() - ( tiff.getHeight() * tiff.getPixelHeight() );
+  if( ( tiff.getLeft() < 0.0 ) || ( south < 0.0 ) )
+  {
+    throw invalid_argument( "GeoTIFF corner coordinates are negative" );
+  }
+
+  ncols = tiff.getWidth();
+  nrows = tiff.getHeight();
+  xllcorner = static_cast<unsigned int>( floor( tiff.getLeft() + 0.5 ) );
+  yllcorner = static_cast<unsigned int>( floor( south + 0.5 ) );
+  cellsize = static_cast<float>( tiff.getPixelWidth() );
+  // NaN can't be used as a NODATA value so NaN cells are converted
+  NODATA_value = ( ( tiff.hasNoData() == true ) && !std::isnan( tiff.getNoData() ) )
+               ? static_cast<float>( tiff.getNoData() ) : -9999.0f;
+}
+
+// --------------------------------------------------------------------
+
+void lidar::parseLasHeader( const char* data, size_t size, lidarLas& las )
+{
+  struct returnResult res = las.open( data, size );
+  if( res.result == false )
+  {
+    throw invalid_argument( res.reason );
+  }
+
+  if( ( las.getMinX() < 0.0 ) || ( las.getMinY() < 0.0 ) )
+  {
+    throw invalid_argument( "LAS coordinates are negative" );
+  }
+  if( !( binCellsize > 0.0f ) )
+  {
+    throw invalid_argument( "Invalid point cloud cell size" );
+  }
+
+  // The corner coordinates are whole metres
+  xllcorner = static_cast<unsigned int>( floor( las.getMinX() ) );
+  yllcorner = static_cast<unsigned int>( floor( las.getMinY() ) );
+  cellsize = binCellsize;
+  ncols = static_cast<unsigned int>( floor( ( las.getMaxX() - xllcorner ) / cellsize ) ) + 1;
+  nrows = static_cast<unsigned int>( floor( ( las.getMaxY() - yllcorner ) / cellsize ) ) + 1;
+  NODATA_value = -9999.0f;
+}
+
 // ====================================================================
 // File IO
 
-struct returnResult lidar::readFromFile( const string fileName )
+struct returnResult lidar::readFromFile( const string fileName )
+{
+  return readGrid( fileName, NULL );
+}
+
+// --------------------------------------------------------------------
+
+struct returnResult lidar::readFromFile( const string fileName, const struct lidarWindow& window )
+{
+  return readGrid( fileName, &window );
+}
+
+// --------------------------------------------------------------------
+
+struct returnResult lidar::readFromFile( const string fileName, double minX, double minY,
+                                         double maxX, double maxY )
+{
+  // Need the grid position to convert to a window
+  struct returnResult res = readHeader( fileName );
+  if( res.result == false )
+  {
+    return res;
+  }
+
+  // Cells that overlap the box
+  double firstCol = floor( ( minX - xllcorner ) / cellsize );
+  double firstRow = floor( ( minY - yllcorner ) / cellsize );
+  double lastCol = ceil( ( maxX - xllcorner ) / cellsize );
+  double lastRow = ceil( ( maxY - yllcorner ) / cellsize );
+  firstCol = max( firstCol, 0.0 );
+  firstRow = max( firstRow, 0.0 );
+  lastCol = min( lastCol, static_cast<double>( ncols ) );
+  lastRow = min( lastRow, static_cast<double>( nrows ) );
+  if( ( minX > maxX ) || ( minY > maxY ) || ( firstCol >= lastCol ) || ( firstRow >= lastRow ) )
+  {
+    res.result = false;
+    res.reason = "Area is outside the grid: " + fileName;
+    return res;
+  }
+
+  struct lidarWindow window;
+  window.col = static_cast<unsigned int>( firstCol );
+  window.row = static_cast<unsigned int>( firstRow );
+  window.ncols = static_cast<unsigned int>( lastCol - firstCol );
+  window.nrows = static_cast<unsigned int>( lastRow - firstRow );
+  return readGrid( fileName, &window );
+}
+
+// --------------------------------------------------------------------
+
+// Bytes read by readHeader to identify the file type
+static const size_t HEADER_PREFIX_SIZE = 4096;
+
+// Rows of each file read at a time by "readDifference", before decimation.
+// A multiple of 1000 keeps the start of each band on a whole metre.
+static const unsigned int DIFFERENCE_BAND_ROWS = 1000;
+
+// Gzip compressed and LAS files have to be decompressed or gridded
+// completely to read any part of them
+static bool readsWhole( const string fileName )
+{
+  ifstream inputFile( fileName.c_str(), ios::in | ios::binary );
+  string prefix( HEADER_PREFIX_SIZE, '\0' );
+  inputFile.read( &prefix[0], HEADER_PREFIX_SIZE );
+  prefix.resize( inputFile.gcount() );
+  return ( isGzip( prefix.data(), prefix.size() ) == true )
+      || ( lidarLas::isLas( prefix.data(), prefix.size() ) == true );
+}
+
+struct returnResult lidar::readDifference( const string fileName, const string baseFileName )
+{
+  struct returnResult res = { true, "" };
+
+  // Both files are read with this grid's options
+  lidar top;
+  lidar base;
+  for( lidar* g : { &top, &base } )
+  {
+    g->setCacheEnabled( cacheEnabled );
+    g->setDecimation( decimation, decimationPooling );
+    g->setPointCloudOptions( binCellsize, binning );
+  }
+
+  res = top.readHeader( fileName );
+  if( res.result == false )
+  {
+    return res;
+  }
+  res = base.readHeader( baseFileName );
+  if( res.result == false )
+  {
+    return res;
+  }
+  if( ( top.ncols != base.ncols ) || ( top.nrows != base.nrows )
+   || ( top.xllcorner != base.xllcorner ) || ( top.yllcorner != base.yllcorner )
+   || ( fabs( top.cellsize - base.cellsize ) > 1e-6 ) )
+  {
+    res.result = false;
+    res.reason = "Grids are not aligned: " + fileName + " " + baseFileName;
+    return res;
+  }
+
+  unsigned int fileCols = top.ncols;
+  unsigned int fileRows = top.nrows;
+  struct lidarWindow all = { 0, 0, fileCols, fileRows };
+  try
+  {
+    release();
+    xllcorner = top.xllcorner;
+    yllcorner = top.yllcorner;
+    cellsize = top.cellsize;
+    NODATA_value = top.NODATA_value;
+    allocateWindow( all );
+  }
+  catch( const std::bad_alloc& )
+  {
+    release();
+    res.result = false;
+    res.reason = "Failed to allocate memory for " + fileName;
+    return res;
+  }
+
+  // Files that can't be read in bands are read once, completely
+  bool topWhole = readsWhole( fileName );
+  bool baseWhole = readsWhole( baseFileName );
+  if( topWhole == true )
+  {
+    res = top.readFromFile( fileName );
+  }
+  if( ( res.result == true ) && ( baseWhole == true ) )
+  {
+    res = base.readFromFile( baseFileName );
+  }
+  if( res.result == false )
+  {
+    release();
+    return res;
+  }
+
+  float noData = NODATA_value;
+  float baseNoData = base.NODATA_value;
+  bool banded = ( topWhole == false ) || ( baseWhole == false );
+  unsigned int bandRows = ( banded == true ) ? DIFFERENCE_BAND_ROWS * decimation : fileRows;
+  // Text files are mapped and their lines found once, not for every band
+  struct gridSource topSource;
+  struct gridSource baseSource;
+  for( unsigned int first=0; first<fileRows; first+=bandRows )
+  {
+    struct lidarWindow band = { 0, first, fileCols, min( bandRows, fileRows - first ) };
+    if( topWhole == false )
+    {
+      res = top.readGrid( fileName, &band, &topSource );
+    }
+    if( ( res.result == true ) && ( baseWhole == false ) )
+    {
+      res = base.readGrid( baseFileName, &band, &baseSource );
+    }
+    if( res.result == false )
+    {
+      release();
+      return res;
+    }
+
+    // Position of the band in this grid, and in any file read completely
+    unsigned int offset = 0;
+    unsigned int rows = nrows;
+    if( banded == true )
+    {
+      const lidar& part = ( topWhole == false ) ? top : base;
+      offset = static_cast<unsigned int>(
+        floor( ( ( static_cast<double>( part.yllcorner ) - yllcorner ) / cellsize ) + 0.5 ) );
+      rows = min( part.nrows, nrows - offset );
+    }
+    unsigned int topOffset = ( topWhole == true ) ? offset : 0;
+    unsigned int baseOffset = ( baseWhole == true ) ? offset : 0;
+    parallelFor( rows, defaultThreadCount(), [&]( unsigned int r0, unsigned int r1 )
+    {
+      for( unsigned int r=r0; r<r1; r++ )
+      {
+        const float* a = top.getRow( topOffset + r );
+        const float* b = base.getRow( baseOffset + r );
+        float* out = getRow( offset + r );
+        // Branch free so the compiler can vectorise it
+        for( unsigned int c=0; c<ncols; c++ )
+        {
+          out[c] = ( ( a[c] == noData ) | ( b[c] == baseNoData ) ) ? noData : a[c] - b[c];
+        }
+      }
+    } );
+  }
+
+  updateStatistics();
+  return res;
+}
+
+// --------------------------------------------------------------------
+
+struct returnResult lidar::readGrid( const string fileName, const struct lidarWindow* window,
+                                     struct gridSource* source )
 {
   struct returnResult res = { true, "" };
 
-  // Open file for reading.
-  ifstream inputFile;
+  // Use the binary copy if there is an up to date one
+  if( ( cacheEnabled == true ) && ( readCache( fileName, window ) == true ) )
+  {
+    return res;
+  }
+
+  // Map the whole file, the data is then parsed in place
+  mappedFile localFile;
+  mappedFile& inputFile = ( source != NULL ) ? source->file : localFile;
   string inputLine;
-  inputFile.exceptions( ifstream::failbit | ifstream::badbit | ifstream::eofbit );
+  if( ( source == NULL ) || ( source->opened == false ) )
+  {
+    res = inputFile.open( fileName );
+    if( res.result == false )
+    {
+      return res;
+    }
+    if( source != NULL )
+    {
+      source->opened = true;
+    }
+  }
+
+  bool partial = false;
+  inflatedBuffer inflated( NULL, free );
   try
   {
-    inputFile.open( fileName.c_str(), ios::in );
+    const char* p = inputFile.data();
+    const char* end = p + inputFile.size();
+
+    // Compressed files are decompressed in memory and parsed from there
+    if( isGzip( p, inputFile.size() ) == true )
+    {
+      inputLine = "<gzip>";
+      size_t size;
+      inflated = gunzip( p, inputFile.size(), 0, size );
+      p = reinterpret_cast<const char*>( inflated.get() );
+      end = p + size;
+      // The decompressed data only lasts for this call
+      if( source == NULL )
+      {
+        inputFile.close();
+      }
+      source = NULL;
+    }
+
+    // GeoTIFF files are decoded a strip or tile at a time and LAS files
+    // are gridded, otherwise read the first 6 lines to get the header
+    // information
+    geoTiff tiff;
+    lidarLas las;
+    bool isTiff = geoTiff::isTiff( p, end - p );
+    bool isLas = lidarLas::isLas( p, end - p );
+    if( isTiff == true )
+    {
+      inputLine = "<GeoTIFF>";
+      parseTiffHeader( p, end - p, tiff );
+    }
+    else if( isLas == true )
+    {
+      inputLine = "<LAS>";
+      parseLasHeader( p, end - p, las );
+    }
+    else
+    {
+      parseHeader( p, end, inputLine );
+    }
+    unsigned int fileCols = ncols;
+    unsigned int fileRows = nrows;
 
-    // Read the first 6 lines to get the header information
+    // Work out which part of the grid is wanted
+    struct lidarWindow w;
+    if( clipWindow( window, w ) == false )
+    {
+      inputLine = "<window>";
+      throw invalid_argument( "Window is outside the grid" );
+    }
+    // Only the complete, full resolution grid goes in the cache. Gridded
+    // point clouds depend on the gridding options so aren't cached.
+    partial = ( w.ncols != fileCols ) || ( w.nrows != fileRows ) || ( decimation > 1 )
+           || ( isLas == true );
 
-    bool ncols_found = false;
-    bool nrows_found = false;
-    bool xllcorner_found = false;
-    bool yllcorner_found = false;
-    bool cellsize_found = false;
-    bool NODATA_value_found = false;
+    // Now read the rest of the data
+    allocateWindow( w );
 
-    for( int i=0; i<6; i++ )
+    // Normally each grid row is on its own line, in which case the lines
+    // are located first, rows outside the window are skipped without
+    // converting them and the rest are converted in parallel. If the layout
+    // is anything else the values are read as one whitespace separated stream.
+    bool parsed = false;
+    unsigned int threads = defaultThreadCount();
+    vector<const char*> fileLines;
+    vector<const char*>& lines = ( source != NULL ) ? source->lines : fileLines;
+    if( isLas == true )
     {
-      getline( inputFile, inputLine );
-      vector<string> params = split( inputLine, ' ' );
-      // convert to upper case for case insensitive comparison
-      std::transform(params.at(0).begin(), params.at(0).end(),params.at(0).begin(), ::toupper);
-      if( params.at(0) == "NCOLS" )
+      las.binPoints( *this, binning );
+      parallelFor( nrows, threads, [&]( unsigned int first, unsigned int last )
       {
-        if( ncols_found == true )
+        for( unsigned int r=first; r<last; r++ )
         {
-          throw invalid_argument( "Duplicate \"ncols\" header line" );
+          scanRow( r, rowStatistics[r] );
         }
-        else
-        {
-          ncols = stoi( params.at(1) );
-          ncols_found = true;
-        }
-      }
-      else if( params.at(0) == "NROWS" )
+      } );
+      parsed = true;
+    }
+    else if( isTiff == true )
+    {
+      parallelFor( nrows, threads, [&]( unsigned int first, unsigned int last )
       {
-        if( nrows_found == true )
+        struct geoTiffCache cache;
+        buildRows( first, last, w, [&]( unsigned int r, float* row )
         {
-          throw invalid_argument( "Duplicate \"nrows\" header line" );
-        }
-        else
+          // TIFF rows run north to south
+          tiff.readRow( fileRows - 1 - ( w.row + r ), w.col, w.ncols, row, cache );
+          for( unsigned int c=0; c<w.ncols; c++ )
+          {
+            if( std::isnan( row[c] ) )
+            {
+              row[c] = NODATA_value;
+            }
+          }
+        } );
+      } );
+      parsed = true;
+    }
+    else if( ( ( partial == true ) || ( ( threads > 1 ) && ( ( end - p ) >= PARALLEL_PARSE_MIN_BYTES ) ) )
+     && findSourceLines( p, end, fileRows, source, lines ) )
+    {
+      try
+      {
+        parallelFor( nrows, threads, [&]( unsigned int first, unsigned int last )
         {
-          nrows = stoi( params.at(1) );
-          nrows_found = true;
-        }
+          buildRows( first, last, w, [&]( unsigned int r, float* row )
+          {
+            // Arrange so that up = north
+            parseRow( lines[ fileRows - 1 - ( w.row + r ) ], end, w.col, w.ncols, fileCols, row );
+          } );
+        } );
+        parsed = true;
       }
-      else if( params.at(0) == "XLLCORNER" )
+      catch( const dataError& e )
       {
-        if( xllcorner_found == true )
-        {
-          throw invalid_argument( "Duplicate \"xllcorner\" header line" );
-        }
-        else
+        if( e.status == ROW_INVALID )
         {
-          xllcorner = stoi( params.at(1) );
-          xllcorner_found = true;
+          inputLine.assign( e.position, skipToken( e.position, end ) );
+          throw invalid_argument( "Invalid data value" );
         }
+        // Rows that are too long or short mean values wrap across lines
       }
-      else if( params.at(0) == "YLLCORNER" )
+    }
+
+    if( parsed == false )
+    {
+      // Values are whitespace separated so line breaks don't matter and
+      // the numbers can be converted straight from the file contents
+      try
       {
-        if( yllcorner_found == true )
-        {
-          throw invalid_argument( "Duplicate \"yllcorner\" header line" );
-        }
-        else
+        // Skip the rows north of the window
+        p = skipValues( p, end, static_cast<UINT64>( fileRows - w.row - w.nrows ) * fileCols, ROW_EOF );
+        // Rows are requested north first, i.e. in file order
+        buildRows( 0, nrows, w, [&]( unsigned int, float* row )
         {
-          yllcorner = stoi( params.at(1) );
-          yllcorner_found = true;
-        }
+          p = skipValues( p, end, w.col, ROW_EOF );
+          p = readValues( p, end, row, w.ncols, ROW_EOF );
+          p = skipValues( p, end, fileCols - w.col - w.ncols, ROW_EOF );
+        } );
       }
-      else if( params.at(0) == "CELLSIZE" )
+      catch( const dataError& e )
       {
-        if( cellsize_found == true )
-        {
-          throw invalid_argument( "Duplicate \"cellsize\" header line" );
-        }
-        else
+        if( e.status == ROW_INVALID )
         {
-          cellsize = stof( params.at(1) );
-          cellsize_found = true;
+          inputLine.assign( e.position, skipToken( e.position, end ) );
+          throw invalid_argument( "Invalid data value" );
         }
+        inputLine = "<end of file>";
+        throw invalid_argument( "Insufficient data values in file" );
+      }
+    }
+
+    // Combine the per row statistics gathered while reading
+    finishStatistics();
+
+  }
+  catch( const std::invalid_argument& e )
+  {
+    res.result = false;
+    res.reason = "Error parsing line: " + inputLine + "\n" + e.what();
+  }
+  catch( const std::bad_alloc& )
+  {
+    res.result = false;
+    res.reason = "Failed to allocate memory for " + fileName;
+  }
+  catch(...)
+  {
+    // Report any parsing failures here
+    res.result = false;
+    res.reason = "Error parsing line: " + inputLine;
+  }
+
+  // The cache always holds the complete grid
+  if( ( res.result == true ) && ( cacheEnabled == true ) && ( partial == false ) )
+  {
+    // Not being able to write the cache isn't an error, the text file
+    // will just be parsed again next time
+    writeCache( fileName );
+  }
+
+  return res;
+}
+
+// --------------------------------------------------------------------
+
+struct returnResult lidar::readHeader( const string fileName )
+{
+  struct returnResult res = { true, "" };
+
+  // Only the header lines are read, any existing grid is discarded
+  release();
+
+  ifstream inputFile;
+  string inputLine;
+  inputFile.open( fileName.c_str(), ios::in | ios::binary );
+  if( !inputFile )
+  {
+    res.result = false;
+    res.reason = "Error opening file: " + fileName;
+    return res;
+  }
+
+  // A fixed amount is read so that binary files aren't searched for line
+  // ends, it is plenty for the six ASC header lines
+  string header( HEADER_PREFIX_SIZE, '\0' );
+  inputFile.read( &header[0], HEADER_PREFIX_SIZE );
+  header.resize( inputFile.gcount() );
+
+  try
+  {
+    if( isGzip( header.data(), header.size() ) == true )
+    {
+      // Only decompress enough to cover the header
+      inputFile.close();
+      mappedFile compressed;
+      res = compressed.open( fileName );
+      if( res.result == false )
+      {
+        return res;
       }
-      else if( params.at(0) == "NODATA_VALUE" )
+      inputLine = "<gzip>";
+      size_t size;
+      inflatedBuffer inflated = gunzip( compressed.data(), compressed.size(), 4096, size );
+      header.assign( reinterpret_cast<const char*>( inflated.get() ), size );
+    }
+    else if( geoTiff::isTiff( header.data(), header.size() ) == true )
+    {
+      // The image directory can be anywhere in the file
+      inputFile.close();
+      mappedFile tiffFile;
+      res = tiffFile.open( fileName );
+      if( res.result == false )
       {
-        if( NODATA_value_found == true )
-        {
-          throw invalid_argument( "Duplicate \"NODATA_value\" header line" );
-        }
-        else
+        return res;
+      }
+      inputLine = "<GeoTIFF>";
+      geoTiff tiff;
+      parseTiffHeader( tiffFile.data(), tiffFile.size(), tiff );
+      return res;
+    }
+    else if( lidarLas::isLas( header.data(), header.size() ) == true )
+    {
+      inputFile.close();
+      mappedFile lasFile;
+      res = lasFile.open( fileName );
+      if( res.result == false )
+      {
+        return res;
+      }
+      inputLine = "<LAS>";
+      lidarLas las;
+      parseLasHeader( lasFile.data(), lasFile.size(), las );
+      return res;
+    }
+
+    const char* p = header.data();
+    parseHeader( p, p + header.size(), inputLine );
+  }
+  catch( const std::invalid_argument& e )
+  {
+    res.result = false;
+    res.reason = "Error parsing line: " + inputLine + "\n" + e.what();
+  }
+  catch(...)
+  {
+    res.result = false;
+    res.reason = "Error parsing line: " + inputLine;
+  }
+
+  return res;
+}
+
+// ====================================================================
+// Binary cache
+//
+// Sidecar file layout, all values little endian:
+//   0  char[8]  magic "LIDARGC" + NUL
+//   8  uint32   format version
+//   12 uint32   size of header in bytes ( data offset )
+//   16 uint64   size of source file in bytes
+//   24 int64    source modification time, seconds
+//   32 int64    source modification time, nanoseconds
+//   40 uint32   ncols
+//   44 uint32   nrows
+//   48 uint32   xllcorner
+//   52 uint32   yllcorner
+//   56 float32  cellsize
+//   60 float32  NODATA_value
+//   64 float32  ncols * nrows values, south row first
+
+static const char CACHE_MAGIC[8] = { 'L', 'I', 'D', 'A', 'R', 'G', 'C', '\0' };
+static const UINT32 CACHE_VERSION = 1;
+static const UINT32 CACHE_HEADER_SIZE = 64;
+
+// --------------------------------------------------------------------
+
+static bool hostIsLittleEndian( void )
+{
+  const UINT32 test = 1;
+  return ( *reinterpret_cast<const unsigned char*>( &test ) == 1 );
+}
+
+// --------------------------------------------------------------------
+
+static UINT32 floatBits( float f )
+{
+  UINT32 u;
+  memcpy( &u, &f, sizeof( u ) );
+  return u;
+}
+
+// --------------------------------------------------------------------
+
+static float bitsFloat( UINT32 u )
+{
+  float f;
+  memcpy( &f, &u, sizeof( f ) );
+  return f;
+}
+
+// --------------------------------------------------------------------
+
+static string cacheFileName( const string fileName )
+{
+  return fileName + ".lgc";
+}
+
+// --------------------------------------------------------------------
+
+// Fill in the source file details that the cache is keyed on
+static bool cacheKey( const string fileName, unsigned char* header )
+{
+  struct stat info;
+  if( stat( fileName.c_str(), &info ) != 0 )
+  {
+    return false;
+  }
+  putLE( header + 16, static_cast<UINT64>( info.st_size ), 8 );
+  putLE( header + 24, static_cast<UINT64>( info.st_mtim.tv_sec ), 8 );
+  putLE( header + 32, static_cast<UINT64>( info.st_mtim.tv_nsec ), 8 );
+  return true;
+}
+
+// --------------------------------------------------------------------
+
+bool lidar::readCache( const string fileName, const struct lidarWindow* window )
+{
+  unsigned char key[ CACHE_HEADER_SIZE ];
+  if( cacheKey( fileName, key ) == false )
+  {
+    return false;
+  }
+
+  mappedFile cacheFile;
+  struct returnResult r = cacheFile.open( cacheFileName( fileName ) );
+  if( ( r.result == false ) || ( cacheFile.size() < CACHE_HEADER_SIZE ) )
+  {
+    return false;
+  }
+
+  const unsigned char* header = reinterpret_cast<const unsigned char*>( cacheFile.data() );
+  if( ( memcmp( header, CACHE_MAGIC, sizeof( CACHE_MAGIC ) ) != 0 )
+   || ( getLE( header + 8, 4 ) != CACHE_VERSION )
+   || ( memcmp( header + 16, key + 16, 24 ) != 0 ) )
+  {
+    // Different format or the source file has changed
+    return false;
+  }
+
+  UINT64 dataOffset = getLE( header + 12, 4 );
+  unsigned int columns = getLE( header + 40, 4 );
+  unsigned int rows = getLE( header + 44, 4 );
+  if( cacheFile.size() != dataOffset + ( static_cast<UINT64>( columns ) * rows * sizeof( float ) ) )
+  {
+    return false;
+  }
+
+  release();
+  ncols = columns;
+  nrows = rows;
+  xllcorner = getLE( header + 48, 4 );
+  yllcorner = getLE( header + 52, 4 );
+  cellsize = bitsFloat( getLE( header + 56, 4 ) );
+  NODATA_value = bitsFloat( getLE( header + 60, 4 ) );
+
+  struct lidarWindow w;
+  if( clipWindow( window, w ) == false )
+  {
+    // Let the text reader report the error
+    return false;
+  }
+  try
+  {
+    allocateWindow( w );
+  }
+  catch( const std::bad_alloc& )
+  {
+    return false;
+  }
+
+  const unsigned char* data = header + dataOffset;
+  bool native = hostIsLittleEndian();
+  parallelFor( nrows, defaultThreadCount(), [&]( unsigned int first, unsigned int last )
+  {
+    buildRows( first, last, w, [&]( unsigned int r, float* row )
+    {
+      const unsigned char* src = data + ( ( ( static_cast<size_t>( w.row + r ) * columns ) + w.col ) * sizeof( float ) );
+      if( native == true )
+      {
+        memcpy( row, src, w.ncols * sizeof( float ) );
+      }
+      else
+      {
+        for( unsigned int c=0; c<w.ncols; c++ )
         {
-          NODATA_value = stof( params.at(1) );
-          NODATA_value_found = true;
+          row[c] = bitsFloat( getLE( src + ( c * sizeof( float ) ), 4 ) );
         }
       }
-      else
+    } );
+  } );
+  finishStatistics();
+
+  return true;
+}
+
+// --------------------------------------------------------------------
+
+bool lidar::writeCache( const string fileName )
+{
+  unsigned char header[ CACHE_HEADER_SIZE ];
+  memset( header, 0, sizeof( header ) );
+  if( cacheKey( fileName, header ) == false )
+  {
+    return false;
+  }
+  memcpy( header, CACHE_MAGIC, sizeof( CACHE_MAGIC ) );
+  putLE( header + 8, CACHE_VERSION, 4 );
+  putLE( header + 12, CACHE_HEADER_SIZE, 4 );
+  putLE( header + 40, ncols, 4 );
+  putLE( header + 44, nrows, 4 );
+  putLE( header + 48, xllcorner, 4 );
+  putLE( header + 52, yllcorner, 4 );
+  putLE( header + 56, floatBits( cellsize ), 4 );
+  putLE( header + 60, floatBits( NODATA_value ), 4 );
+
+  // Write to a temporary file and rename so that a partially written
+  // cache is never picked up
+  string cacheName = cacheFileName( fileName );
+  string tempName = cacheName + ".tmp";
+  ofstream outputFile( tempName.c_str(), ios::out | ios::binary | ios::trunc );
+  if( !outputFile )
+  {
+    return false;
+  }
+  outputFile.write( reinterpret_cast<const char*>( header ), sizeof( header ) );
+
+  bool native = hostIsLittleEndian();
+  vector<unsigned char> buffer( ncols * sizeof( float ) );
+  for( unsigned int r=0; r<nrows; r++ )
+  {
+    const float* row = getRow( r );
+    if( native == true )
+    {
+      outputFile.write( reinterpret_cast<const char*>( row ), ncols * sizeof( float ) );
+    }
+    else
+    {
+      for( unsigned int c=0; c<ncols; c++ )
       {
-        throw invalid_argument( "Unknown header type: " + params.at(0) );
+        putLE( &buffer[ c * sizeof( float ) ], floatBits( row[c] ), 4 );
       }
+      outputFile.write( reinterpret_cast<const char*>( buffer.data() ), buffer.size() );
     }
+  }
+  outputFile.close();
 
-    // Now read the rest of the data
-    // Dynamically allocate the memory for the array
-    values = new float*[ nrows ];
-    if( values == NULL )
+  if( !outputFile || ( rename( tempName.c_str(), cacheName.c_str() ) != 0 ) )
+  {
+    remove( tempName.c_str() );
+    return false;
+  }
+
+  return true;
+}
+
+// --------------------------------------------------------------------
+
+void lidar::setCacheEnabled( bool enable )
+{
+  cacheEnabled = enable;
+}
+
+// ====================================================================
+// Statistics
+
+void lidar::scanRow( unsigned int r, struct rowStatistics_t& stats )
+{
+  const float* row = getRow( r );
+  UINT64* mask = &nodataMask[ r * maskStride ];
+
+  stats.minimum = 0.0;
+  stats.maximum = 0.0;
+  stats.sum = 0.0;
+  stats.valid = 0;
+
+  for( unsigned int w=0; w<maskStride; w++ )
+  {
+    unsigned int first = w * 64;
+    unsigned int last = min( first + 64, ncols );
+    UINT64 bits = 0;
+    for( unsigned int c=first; c<last; c++ )
     {
-      throw logic_error( "Failed to create \"values\" array" );
+      float v = row[c];
+      if( v == NODATA_value )
+      {
+        bits |= static_cast<UINT64>( 1 ) << ( c - first );
+      }
+      else
+      {
+        if( ( stats.valid == 0 ) || ( v < stats.minimum ) )
+        {
+          stats.minimum = v;
+        }
+        if( ( stats.valid == 0 ) || ( v > stats.maximum ) )
+        {
+          stats.maximum = v;
+        }
+        stats.sum += v;
+        stats.valid++;
+      }
     }
-    for( unsigned int i=0; i<nrows; i++ )
+    mask[w] = bits;
+  }
+}
+
+// --------------------------------------------------------------------
+
+void lidar::finishStatistics( void )
+{
+  UINT64 valid = 0;
+  double sum = 0.0;
+  minValue = NODATA_value;
+  maxValue = NODATA_value;
+  for( auto& s : rowStatistics )
+  {
+    if( s.valid > 0 )
     {
-      values[i] = new float[ ncols ];
-      if( values[i] == NULL )
+      if( ( valid == 0 ) || ( s.minimum < minValue ) )
+      {
+        minValue = s.minimum;
+      }
+      if( ( valid == 0 ) || ( s.maximum > maxValue ) )
       {
-        throw logic_error( "Failed to create row array: " + i );
+        maxValue = s.maximum;
       }
+      sum += s.sum;
+      valid += s.valid;
     }
+  }
+  meanValue = ( valid > 0 ) ? ( sum / valid ) : NODATA_value;
+  nodataCount = ( static_cast<UINT64>( ncols ) * nrows ) - valid;
+  statisticsValid = true;
+}
+
+// --------------------------------------------------------------------
 
-    // Read data a row at a time
-    vector<string> p;
-    unsigned int count = 0;
-    // Arrange so that up = north
-    for( int r=nrows-1; r>=0; r-- )
-    //for( unsigned int r=0; r<nrows; r++ )
+void lidar::updateStatistics( void )
+{
+  if( values == NULL )
+  {
+    return;
+  }
+  parallelFor( nrows, defaultThreadCount(), [&]( unsigned int first, unsigned int last )
+  {
+    for( unsigned int r=first; r<last; r++ )
     {
-      for( unsigned int c=0; c<ncols; c++ )
-      {
-        // Not sure if we can assume that each row of data is on one line
-        // If no data available then get another line
-        if( p.empty() )
-        {
-          getline ( inputFile, inputLine );
-          p = split( inputLine, ' ' );
-        }
-        values[r][c] = stof( p.front() );
-        p.erase( p.begin() );
-        count++;
-      }
+      scanRow( r, rowStatistics[r] );
     }
+  } );
+  finishStatistics();
+}
 
-    /* Debug to print values read
-    for( unsigned int r=nrows-1; r!=0; r-- )
-    {
-      for( unsigned int c=0; c<ncols; c++ )
-      {
-        cout << values[r][c] << " ";
-      }
-      cout << endl;
-    }*/
+// --------------------------------------------------------------------
 
-  }
-  catch (const ifstream::failure& e)
+float lidar::getMinValue( void )
+{
+  if( statisticsValid == false )
   {
-    // File opening failures
-    res.result = false;
-    res.reason = "Error processing file: " + fileName + "\n" + e.what();
+    updateStatistics();
   }
-  catch( const std::invalid_argument& e )
+  return minValue;
+}
+
+// --------------------------------------------------------------------
+
+float lidar::getMaxValue( void )
+{
+  if( statisticsValid == false )
   {
-    res.result = false;
-    res.reason = "Error parsing line: " + inputLine + "\n" + e.what();
+    updateStatistics();
   }
-  catch(...)
+  return maxValue;
+}
+
+// --------------------------------------------------------------------
+
+double lidar::getMeanValue( void )
+{
+  if( statisticsValid == false )
   {
-    // Report any parsing failures here
-    res.result = false;
-    res.reason = "Error parsing line: " + inputLine;
+    updateStatistics();
   }
+  return meanValue;
+}
 
-  return res;
+// --------------------------------------------------------------------
+
+UINT64 lidar::getNODATACount( void )
+{
+  if( statisticsValid == false )
+  {
+    updateStatistics();
+  }
+  return nodataCount;
 }
 
 // ====================================================================
@@ -271,9 +1917,9 @@ bool lidar::getValue( unsigned int col, unsigned int row, float &value )
 {
   bool res = true;
 
-  if( ( col < ncols ) && ( row < nrows ) )
+  if( ( col < ncols ) && ( row < nrows ) && ( values != NULL ) )
   {
-    value = values[row][col];
+    value = values[ ( row * rowStride ) + col ];
   }
   else
   {
@@ -289,9 +1935,19 @@ bool lidar::setValue( unsigned int col, unsigned int row, float value )
 {
   bool res = true;
 
-  if( ( col < ncols ) && ( row < nrows ) )
+  if( ( col < ncols ) && ( row < nrows ) && ( values != NULL ) )
   {
-    values[row][col] = value;
+    values[ ( row * rowStride ) + col ] = value;
+    UINT64 bit = static_cast<UINT64>( 1 ) << ( col % 64 );
+    if( value == NODATA_value )
+    {
+      nodataMask[ ( row * maskStride ) + ( col / 64 ) ] |= bit;
+    }
+    else
+    {
+      nodataMask[ ( row * maskStride ) + ( col / 64 ) ] &= ~bit;
+    }
+    statisticsValid = false;
   }
   else
   {
@@ -300,3 +1956,626 @@ bool lidar::setValue( unsigned int col, unsigned int row, float value )
 
   return res;
 }
+
+// ====================================================================
+// Gap filling
+//
+// Holes are filled with a membrane ( harmonic ) surface that meets the
+// surrounding data. A pyramid of grids is built by averaging 2 x 2 blocks
+// of known cells until a level has no holes. Working back down, holes at
+// each level start from an interpolation of the level above and are then
+// relaxed towards the mean of their neighbours. Each level is a quarter
+// of the size of the one below so the total work is O(N).
+
+// Number of relaxation passes at each pyramid level
+static const unsigned int FILL_PASSES = 8;
+
+struct fillLevel {
+  unsigned int cols;
+  unsigned int rows;
+  vector<float> value;
+  vector<unsigned char> known;
+};
+
+// --------------------------------------------------------------------
+
+// One dimensional squared Euclidean distance transform of "f" ( 0 for
+// data, FILL_FAR otherwise ), P. Felzenszwalb & D. Huttenlocher,
+// "Distance Transforms of Sampled Functions". Results go in "d", "v" and
+// "z" are work space of n and n + 1 entries.
+static const double FILL_FAR = 1e20;
+
+static void distanceTransform( const double* f, unsigned int n, double* d, unsigned int* v, double* z )
+{
+  // Intersection of the parabolas rooted at q and p
+  auto intersect = [&]( unsigned int q, unsigned int p )
+  {
+    return ( ( f[q] + ( static_cast<double>( q ) * q ) ) - ( f[p] + ( static_cast<double>( p ) * p ) ) )
+           / ( 2.0 * ( static_cast<double>( q ) - p ) );
+  };
+
+  // Lower envelope of the parabolas
+  unsigned int k = 0;
+  v[0] = 0;
+  z[0] = -FILL_FAR;
+  z[1] = FILL_FAR;
+  for( unsigned int q=1; q<n; q++ )
+  {
+    double s = intersect( q, v[k] );
+    while( s <= z[k] )
+    {
+      k--;
+      s = intersect( q, v[k] );
+    }
+    k++;
+    v[k] = q;
+    z[k] = s;
+    z[k+1] = FILL_FAR;
+  }
+
+  k = 0;
+  for( unsigned int q=0; q<n; q++ )
+  {
+    while( z[k+1] < q )
+    {
+      k++;
+    }
+    double dq = static_cast<double>( q ) - v[k];
+    d[q] = ( dq * dq ) + f[ v[k] ];
+  }
+}
+
+// --------------------------------------------------------------------
+
+UINT64 lidar::fillGaps( unsigned int maxDistance )
+{
+  if( values == NULL )
+  {
+    return 0;
+  }
+  unsigned int threads = defaultThreadCount();
+
+  // Level 0 is a copy of the grid
+  vector<struct fillLevel> levels( 1 );
+  levels[0].cols = ncols;
+  levels[0].rows = nrows;
+  levels[0].value.resize( static_cast<size_t>( ncols ) * nrows );
+  levels[0].known.resize( levels[0].value.size() );
+  vector<UINT64> rowHoles( nrows, 0 );
+  parallelFor( nrows, threads, [&]( unsigned int first, unsigned int last )
+  {
+    for( unsigned int r=first; r<last; r++ )
+    {
+      const float* row = getRow( r );
+      for( unsigned int c=0; c<ncols; c++ )
+      {
+        size_t i = ( static_cast<size_t>( r ) * ncols ) + c;
+        levels[0].value[i] = row[c];
+        levels[0].known[i] = ( row[c] != NODATA_value );
+        rowHoles[r] += ( row[c] == NODATA_value );
+      }
+    }
+  } );
+  UINT64 holes = 0;
+  for( auto h : rowHoles )
+  {
+    holes += h;
+  }
+  if( ( holes == 0 ) || ( holes == levels[0].value.size() ) )
+  {
+    // Nothing to fill, or nothing to fill it from
+    return 0;
+  }
+
+  // Restrict until there are no holes left
+  while( holes > 0 )
+  {
+    struct fillLevel& fine = levels.back();
+    struct fillLevel coarse;
+    coarse.cols = ( fine.cols + 1 ) / 2;
+    coarse.rows = ( fine.rows + 1 ) / 2;
+    coarse.value.assign( static_cast<size_t>( coarse.cols ) * coarse.rows, 0.0f );
+    coarse.known.assign( coarse.value.size(), 0 );
+    rowHoles.assign( coarse.rows, 0 );
+    parallelFor( coarse.rows, threads, [&]( unsigned int first, unsigned int last )
+    {
+      for( unsigned int r=first; r<last; r++ )
+      {
+        for( unsigned int c=0; c<coarse.cols; c++ )
+        {
+          float sum = 0.0f;
+          unsigned int n = 0;
+          for( unsigned int y=r*2; y<min( ( r * 2 ) + 2, fine.rows ); y++ )
+          {
+            for( unsigned int x=c*2; x<min( ( c * 2 ) + 2, fine.cols ); x++ )
+            {
+              size_t i = ( static_cast<size_t>( y ) * fine.cols ) + x;
+              if( fine.known[i] )
+              {
+                sum += fine.value[i];
+                n++;
+              }
+            }
+          }
+          size_t j = ( static_cast<size_t>( r ) * coarse.cols ) + c;
+          if( n > 0 )
+          {
+            coarse.value[j] = sum / n;
+            coarse.known[j] = 1;
+          }
+          else
+          {
+            rowHoles[r]++;
+          }
+        }
+      }
+    } );
+    holes = 0;
+    for( auto h : rowHoles )
+    {
+      holes += h;
+    }
+    levels.push_back( std::move( coarse ) );
+  }
+
+  // Interpolate and relax back down the pyramid
+  for( size_t k=levels.size()-1; k-- > 0; )
+  {
+    struct fillLevel& fine = levels[k];
+    const struct fillLevel& coarse = levels[k+1];
+    parallelFor( fine.rows, threads, [&]( unsigned int first, unsigned int last )
+    {
+      for( unsigned int r=first; r<last; r++ )
+      {
+        // Position of the cell centre in the coarse grid
+        float fy = min( max( ( ( r + 0.5f ) / 2.0f ) - 0.5f, 0.0f ), coarse.rows - 1.0f );
+        unsigned int y0 = static_cast<unsigned int>( fy );
+        unsigned int y1 = min( y0 + 1, coarse.rows - 1 );
+        float ty = fy - y0;
+        for( unsigned int c=0; c<fine.cols; c++ )
+        {
+          size_t i = ( static_cast<size_t>( r ) * fine.cols ) + c;
+          if( fine.known[i] )
+          {
+            continue;
+          }
+          float fx = min( max( ( ( c + 0.5f ) / 2.0f ) - 0.5f, 0.0f ), coarse.cols - 1.0f );
+          unsigned int x0 = static_cast<unsigned int>( fx );
+          unsigned int x1 = min( x0 + 1, coarse.cols - 1 );
+          float tx = fx - x0;
+          const float* a = &coarse.value[ static_cast<size_t>( y0 ) * coarse.cols ];
+          const float* b = &coarse.value[ static_cast<size_t>( y1 ) * coarse.cols ];
+          fine.value[i] = ( ( 1.0f - ty ) * ( ( ( 1.0f - tx ) * a[x0] ) + ( tx * a[x1] ) ) )
+                        + ( ty * ( ( ( 1.0f - tx ) * b[x0] ) + ( tx * b[x1] ) ) );
+        }
+      }
+    } );
+
+    // Red / black Gauss-Seidel, cells of one colour only have neighbours
+    // of the other colour so each half pass can run in parallel
+    for( unsigned int pass=0; pass<FILL_PASSES*2; pass++ )
+    {
+      unsigned int colour = pass % 2;
+      parallelFor( fine.rows, threads, [&]( unsigned int first, unsigned int last )
+      {
+        for( unsigned int r=first; r<last; r++ )
+        {
+          for( unsigned int c=( r + colour ) % 2; c<fine.cols; c+=2 )
+          {
+            size_t i = ( static_cast<size_t>( r ) * fine.cols ) + c;
+            if( fine.known[i] )
+            {
+              continue;
+            }
+            float sum = 0.0f;
+            unsigned int n = 0;
+            if( c > 0 )
+            {
+              sum += fine.value[ i - 1 ];
+              n++;
+            }
+            if( c + 1 < fine.cols )
+            {
+              sum += fine.value[ i + 1 ];
+              n++;
+            }
+            if( r > 0 )
+            {
+              sum += fine.value[ i - fine.cols ];
+              n++;
+            }
+            if( r + 1 < fine.rows )
+            {
+              sum += fine.value[ i + fine.cols ];
+              n++;
+            }
+            if( n > 0 )
+            {
+              fine.value[i] = sum / n;
+            }
+          }
+        }
+      } );
+    }
+  }
+
+  // Optionally only keep cells near the data, using the distance to the
+  // nearest data cell ( squared, in cells )
+  vector<double> distance;
+  if( maxDistance > 0 )
+  {
+    distance.resize( levels[0].value.size() );
+    // Columns first
+    parallelFor( ncols, threads, [&]( unsigned int first, unsigned int last )
+    {
+      vector<double> f( nrows ), d( nrows ), z( nrows + 1 );
+      vector<unsigned int> v( nrows );
+      for( unsigned int c=first; c<last; c++ )
+      {
+        for( unsigned int r=0; r<nrows; r++ )
+        {
+          f[r] = levels[0].known[ ( static_cast<size_t>( r ) * ncols ) + c ] ? 0.0 : FILL_FAR;
+        }
+        distanceTransform( f.data(), nrows, d.data(), v.data(), z.data() );
+        for( unsigned int r=0; r<nrows; r++ )
+        {
+          distance[ ( static_cast<size_t>( r ) * ncols ) + c ] = d[r];
+        }
+      }
+    } );
+    // Then rows
+    parallelFor( nrows, threads, [&]( unsigned int first, unsigned int last )
+    {
+      vector<double> d( ncols ), z( ncols + 1 );
+      vector<unsigned int> v( ncols );
+      for( unsigned int r=first; r<last; r++ )
+      {
+        double* f = &distance[ static_cast<size_t>( r ) * ncols ];
+        distanceTransform( f, ncols, d.data(), v.data(), z.data() );
+        std::copy( d.begin(), d.end(), f );
+      }
+    } );
+  }
+
+  // Copy the filled cells back
+  double limit = static_cast<double>( maxDistance ) * maxDistance;
+  rowHoles.assign( nrows, 0 );
+  parallelFor( nrows, threads, [&]( unsigned int first, unsigned int last )
+  {
+    for( unsigned int r=first; r<last; r++ )
+    {
+      float* row = getRow( r );
+      for( unsigned int c=0; c<ncols; c++ )
+      {
+        size_t i = ( static_cast<size_t>( r ) * ncols ) + c;
+        if( ( levels[0].known[i] == 0 ) && ( distance.empty() || ( distance[i] <= limit ) ) )
+        {
+          row[c] = levels[0].value[i];
+          rowHoles[r]++;
+        }
+      }
+    }
+  } );
+  UINT64 filled = 0;
+  for( auto h : rowHoles )
+  {
+    filled += h;
+  }
+
+  updateStatistics();
+  return filled;
+}
+
+// ====================================================================
+// Resampling
+//
+// The taps ( source cells and weights ) of every output column and row
+// are worked out once, so the inner loop is just a weighted sum.
+
+// Catmull-Rom cubic convolution weights for an offset "t" from cell i,
+// for cells i - 1 to i + 2
+static void cubicWeights( float t, float* w )
+{
+  float t2 = t * t;
+  float t3 = t2 * t;
+  w[0] = ( -0.5f * t3 ) + t2 - ( 0.5f * t );
+  w[1] = ( 1.5f * t3 ) - ( 2.5f * t2 ) + 1.0f;
+  w[2] = ( -1.5f * t3 ) + ( 2.0f * t2 ) + ( 0.5f * t );
+  w[3] = ( 0.5f * t3 ) - ( 0.5f * t2 );
+}
+
+// Taps along one axis. "position" is in source cells, 0 being the centre
+// of the first cell. Returns false if the position is outside the grid.
+static bool resampleTaps( double position, unsigned int count, unsigned int taps,
+                          unsigned int* index, float* weight )
+{
+  if( ( position < -0.5 ) || ( position > count - 0.5 ) )
+  {
+    return false;
+  }
+  double base = floor( position );
+  float t = static_cast<float>( position - base );
+  int first = static_cast<int>( base ) - ( ( taps == 4 ) ? 1 : 0 );
+  if( taps == 4 )
+  {
+    cubicWeights( t, weight );
+  }
+  else
+  {
+    weight[0] = 1.0f - t;
+    weight[1] = t;
+  }
+  for( unsigned int k=0; k<taps; k++ )
+  {
+    int i = first + static_cast<int>( k );
+    index[k] = static_cast<unsigned int>( min( max( i, 0 ), static_cast<int>( count ) - 1 ) );
+  }
+  return true;
+}
+
+// --------------------------------------------------------------------
+
+lidar lidar::resample( float size, unsigned int xll, unsigned int yll, unsigned int columns,
+                       unsigned int rows, enum lidarInterpolation method ) const
+{
+  if( !( size > 0.0f ) )
+  {
+    throw invalid_argument( "Cell size must be greater than 0" );
+  }
+  lidar result( columns, rows, xll, yll, size, NODATA_value );
+  if( ( values == NULL ) || ( columns == 0 ) || ( rows == 0 ) )
+  {
+    return result;
+  }
+
+  // Bilinear taps are always needed for cells next to NODATA
+  const unsigned int taps = ( method == INTERPOLATE_BICUBIC ) ? 4 : 2;
+  vector<unsigned int> colIndex( columns * taps ), colLinear( columns * 2 );
+  vector<float> colWeight( columns * taps ), colLinearWeight( columns * 2 );
+  vector<unsigned char> colInside( columns );
+  for( unsigned int c=0; c<columns; c++ )
+  {
+    double x = ( ( ( xll + ( ( c + 0.5 ) * size ) ) - xllcorner ) / cellsize ) - 0.5;
+    colInside[c] = resampleTaps( x, ncols, taps, &colIndex[ c * taps ], &colWeight[ c * taps ] );
+    resampleTaps( x, ncols, 2, &colLinear[ c * 2 ], &colLinearWeight[ c * 2 ] );
+  }
+
+  parallelFor( rows, defaultThreadCount(), [&]( unsigned int first, unsigned int last )
+  {
+    unsigned int rowIndex[4], rowLinear[2];
+    float rowWeight[4], rowLinearWeight[2];
+    for( unsigned int r=first; r<last; r++ )
+    {
+      double y = ( ( ( yll + ( ( r + 0.5 ) * size ) ) - yllcorner ) / cellsize ) - 0.5;
+      if( resampleTaps( y, nrows, taps, rowIndex, rowWeight ) == false )
+      {
+        continue;
+      }
+      resampleTaps( y, nrows, 2, rowLinear, rowLinearWeight );
+      float* out = result.getRow( r );
+
+      for( unsigned int c=0; c<columns; c++ )
+      {
+        if( colInside[c] == 0 )
+        {
+          continue;
+        }
+
+        float sum = 0.0f;
+        bool complete = true;
+        for( unsigned int j=0; ( j<taps ) && complete; j++ )
+        {
+          const float* src = getRow( rowIndex[j] );
+          float rowSum = 0.0f;
+          for( unsigned int k=0; k<taps; k++ )
+          {
+            float v = src[ colIndex[ ( c * taps ) + k ] ];
+            if( v == NODATA_value )
+            {
+              complete = false;
+              break;
+            }
+            rowSum += colWeight[ ( c * taps ) + k ] * v;
+          }
+          sum += rowWeight[j] * rowSum;
+        }
+        if( complete == true )
+        {
+          out[c] = sum;
+          continue;
+        }
+
+        // Bilinear over the cells that have data
+        sum = 0.0f;
+        float weight = 0.0f;
+        for( unsigned int j=0; j<2; j++ )
+        {
+          const float* src = getRow( rowLinear[j] );
+          for( unsigned int k=0; k<2; k++ )
+          {
+            float v = src[ colLinear[ ( c * 2 ) + k ] ];
+            float w = rowLinearWeight[j] * colLinearWeight[ ( c * 2 ) + k ];
+            if( v != NODATA_value )
+            {
+              sum += w * v;
+              weight += w;
+            }
+          }
+        }
+        if( weight >= 0.5f )
+        {
+          out[c] = sum / weight;
+        }
+      }
+    }
+  } );
+
+  result.updateStatistics();
+  return result;
+}
+
+// --------------------------------------------------------------------
+
+lidar lidar::resample( float size, enum lidarInterpolation method ) const
+{
+  if( !( size > 0.0f ) )
+  {
+    throw invalid_argument( "Cell size must be greater than 0" );
+  }
+  double columns = floor( ( ( ncols * static_cast<double>( cellsize ) ) / size ) + 1e-6 );
+  double rows = floor( ( ( nrows * static_cast<double>( cellsize ) ) / size ) + 1e-6 );
+  if( ( columns > UINT_MAX ) || ( rows > UINT_MAX ) )
+  {
+    throw invalid_argument( "Resampled grid is too large" );
+  }
+  return resample( size, xllcorner, yllcorner, static_cast<unsigned int>( columns ),
+                   static_cast<unsigned int>( rows ), method );
+}
+
+// --------------------------------------------------------------------
+
+bool lidar::interpolate( double x, double y, float& value ) const
+{
+  unsigned int colIndex[2], rowIndex[2];
+  float colWeight[2], rowWeight[2];
+  if( ( values == NULL )
+   || ( resampleTaps( ( ( x - xllcorner ) / cellsize ) - 0.5, ncols, 2, colIndex, colWeight ) == false )
+   || ( resampleTaps( ( ( y - yllcorner ) / cellsize ) - 0.5, nrows, 2, rowIndex, rowWeight ) == false ) )
+  {
+    return false;
+  }
+
+  float sum = 0.0f;
+  float weight = 0.0f;
+  for( unsigned int j=0; j<2; j++ )
+  {
+    const float* src = getRow( rowIndex[j] );
+    for( unsigned int k=0; k<2; k++ )
+    {
+      float v = src[ colIndex[k] ];
+      float w = rowWeight[j] * colWeight[k];
+      if( v != NODATA_value )
+      {
+        sum += w * v;
+        weight += w;
+      }
+    }
+  }
+  if( weight < 0.5f )
+  {
+    return false;
+  }
+  value = sum / weight;
+  return true;
+}
+
+// ====================================================================
+// Profiles
+
+vector<struct lidarProfilePoint> lidar::profilePoints( const vector< pair<double, double> >& polyline,
+                                                       double step )
+{
+  vector<struct lidarProfilePoint> points;
+  struct lidarProfilePoint p = { 0.0, 0.0, 0.0, 0.0f, 0.0f, false };
+  if( ( polyline.empty() == true ) || ( step <= 0.0 ) )
+  {
+    return points;
+  }
+
+  // Distance at the start of the current segment and of the next point
+  double start = 0.0;
+  double next = 0.0;
+  for( size_t i=1; i<polyline.size(); i++ )
+  {
+    double dx = polyline[i].first - polyline[ i - 1 ].first;
+    double dy = polyline[i].second - polyline[ i - 1 ].second;
+    double length = sqrt( ( dx * dx ) + ( dy * dy ) );
+    while( next < start + length )
+    {
+      double t = ( next - start ) / length;
+      p.distance = next;
+      p.x = polyline[ i - 1 ].first + ( t * dx );
+      p.y = polyline[ i - 1 ].second + ( t * dy );
+      points.push_back( p );
+      next = step * points.size();
+    }
+    start += length;
+  }
+
+  // Always finish at the end of the line
+  p.distance = start;
+  p.x = polyline.back().first;
+  p.y = polyline.back().second;
+  points.push_back( p );
+
+  return points;
+}
+
+// --------------------------------------------------------------------
+
+void lidar::sampleProfiles( vector< vector<struct lidarProfilePoint> >& profiles ) const
+{
+  if( values == NULL )
+  {
+    return;
+  }
+
+  parallelFor( profiles.size(), defaultThreadCount(), [&]( unsigned int first, unsigned int last )
+  {
+    for( unsigned int i=first; i<last; i++ )
+    {
+      for( auto& p : profiles[i] )
+      {
+        // The four cells around the point, 0 being the centre of the first cell
+        double x = ( ( p.x - xllcorner ) / cellsize ) - 0.5;
+        double y = ( ( p.y - yllcorner ) / cellsize ) - 0.5;
+        double col = floor( x );
+        double row = floor( y );
+        if( ( col < -1.0 ) || ( row < -1.0 ) || ( col >= ncols ) || ( row >= nrows ) )
+        {
+          continue;
+        }
+        float tx = static_cast<float>( x - col );
+        float ty = static_cast<float>( y - row );
+        for( int j=0; j<2; j++ )
+        {
+          double r = row + j;
+          if( ( r < 0.0 ) || ( r >= nrows ) )
+          {
+            continue;
+          }
+          const float* src = getRow( static_cast<unsigned int>( r ) );
+          for( int k=0; k<2; k++ )
+          {
+            double c = col + k;
+            if( ( c < 0.0 ) || ( c >= ncols ) )
+            {
+              continue;
+            }
+            float v = src[ static_cast<unsigned int>( c ) ];
+            if( v != NODATA_value )
+            {
+              float w = ( j ? ty : 1.0f - ty ) * ( k ? tx : 1.0f - tx );
+              p.z += w * v;
+              p.weight += w;
+            }
+          }
+        }
+      }
+    }
+  } );
+}
+
+// --------------------------------------------------------------------
+
+void lidar::finishProfiles( vector< vector<struct lidarProfilePoint> >& profiles )
+{
+  for( auto& profile : profiles )
+  {
+    for( auto& p : profile )
+    {
+      p.valid = ( p.weight >= 0.5f );
+      p.z = p.valid ? p.z / p.weight : 0.0f;
+    }
+  }
+}
@@ -20,9 +20,74 @@
 #include "util.hpp"
 #include <string>
 #include <vector>
+#include <cstddef>
+#include <functional>
 
 using namespace std;
 
+class geoTiff;
+class lidarLas;
+struct gridSource;
+
+/// Alignment ( in bytes ) of the grid buffer and of the start of every row
+///
+const size_t LIDAR_ALIGNMENT = 64;
+
+/// Part of a grid, in grid coordinates, i.e. row 0 is the southern edge
+///
+struct lidarWindow {
+  unsigned int col;
+  unsigned int row;
+  unsigned int ncols;
+  unsigned int nrows;
+};
+
+/// How cells are combined when a grid is decimated while reading
+///
+enum lidarPooling {
+  POOL_NEAREST,   ///< cell nearest the centre of the block
+  POOL_MEAN,      ///< mean of the cells that have data
+  POOL_MAX        ///< highest cell that has data
+};
+
+/// How the points in a cell are combined when a point cloud is gridded
+///
+enum lidarBinning {
+  BIN_MIN,          ///< lowest point
+  BIN_MAX,          ///< highest point
+  BIN_MEAN,         ///< mean height of the points
+  BIN_LAST_RETURN   ///< lowest of the last returns, i.e. ground where visible
+};
+
+/// Interpolation used when a grid is resampled
+///
+enum lidarInterpolation {
+  INTERPOLATE_BILINEAR,   ///< 2 x 2 cells
+  INTERPOLATE_BICUBIC     ///< 4 x 4 cells, Catmull-Rom spline
+};
+
+/// A point on an elevation profile
+///
+struct lidarProfilePoint {
+  double distance;    // along the line from its start
+  double x;
+  double y;
+  float z;
+  float weight;       // interpolation weight of the cells sampled so far
+  bool valid;         // false if there is no data at the point
+};
+
+/// View of a contiguous run of grid values, e.g. one row
+///
+struct lidarSpan {
+  float* data;
+  unsigned int size;
+
+  float* begin( void ) const { return data; }
+  float* end( void ) const { return data + size; }
+  float& operator[]( unsigned int i ) const { return data[i]; }
+};
+
 /// Class to read LiDAR images from the website -
 ///  http://lle.gov.wales/catalogue/item/LidarCompositeDataset/?lang=en
 ///
@@ -37,18 +102,253 @@ class lidar
   float cellsize;
   float NODATA_value;
   // Data
-  float** values;
+  // One aligned block, row "r" starts at values + ( r * rowStride )
+  float* values;
+  size_t rowStride;
+
+  // Binary sidecar cache
+  bool cacheEnabled;
+
+  // Decimation applied while reading
+  unsigned int decimation;
+  enum lidarPooling decimationPooling;
+
+  // Gridding of point cloud files
+  float binCellsize;
+  enum lidarBinning binning;
+
+  // NODATA bitmap, bit ( col % 64 ) of word ( row * maskStride ) + ( col / 64 )
+  // is set if the cell has no data
+  vector<UINT64> nodataMask;
+  size_t maskStride;
+
+  // Statistics, gathered a row at a time while the grid is filled
+  struct rowStatistics_t {
+    float minimum;
+    float maximum;
+    double sum;
+    unsigned int valid;
+  };
+  vector<struct rowStatistics_t> rowStatistics;
+  bool statisticsValid;
+  float minValue;
+  float maxValue;
+  double meanValue;
+  UINT64 nodataCount;
+
+  /// Update the NODATA bitmap and statistics for one row
+  ///
+  void scanRow( unsigned int r, struct rowStatistics_t& stats );
+
+  /// Combine the per row statistics into the grid statistics
+  ///
+  void finishStatistics( void );
+
+  /// Load the grid from the binary sidecar of "fileName" if it exists and
+  /// matches the current size and modification time of "fileName"
+  /// @return true if the grid was loaded
+  ///
+  bool readCache( const string fileName, const struct lidarWindow* window );
+
+  /// Write the grid to the binary sidecar of "fileName"
+  /// @return true if the sidecar was written
+  ///
+  bool writeCache( const string fileName );
+
+  /// Release any existing grid and allocate a new one. Contents are undefined.
+  /// Throws bad_alloc on failure.
+  ///
+  void allocate( unsigned int columns, unsigned int rows );
+
+  /// Release the grid memory
+  ///
+  void release( void );
+
+  /// Parse the six header lines starting at "p". Throws invalid_argument
+  /// on any error.
+  /// @param[in,out] p : start of header, updated to the start of the data
+  /// @param[in] end : end of the file data
+  /// @param[out] inputLine : last line read, for error reporting
+  ///
+  void parseHeader( const char*& p, const char* end, string& inputLine );
+
+  /// Set the header values from a GeoTIFF file. Throws invalid_argument
+  /// if the file can't be represented as a grid.
+  /// @param[in] data : file contents
+  /// @param[in] size : number of bytes in "data"
+  /// @param[out] tiff : decoder for the file
+  ///
+  void parseTiffHeader( const char* data, size_t size, geoTiff& tiff );
+
+  /// Set the header values for gridding a LAS point cloud, the grid covers
+  /// the bounds of the points at the current point cloud cell size.
+  /// Throws invalid_argument on any error.
+  /// @param[in] data : file contents
+  /// @param[in] size : number of bytes in "data"
+  /// @param[out] las : reader for the file
+  ///
+  void parseLasHeader( const char* data, size_t size, lidarLas& las );
+
+  /// Read all, or part, of a LiDAR file
+  /// @param[in] fileName : path to file
+  /// @param[in] window : part of the grid to read, NULL for all of it
+  /// @param[in] source : if not NULL, keeps the file mapped and the lines
+  ///                     found between calls that read the same file
+  /// @return Success/fail & error message
+  ///
+  struct returnResult readGrid( const string fileName, const struct lidarWindow* window,
+                                struct gridSource* source = NULL );
+
+  /// Limit a window to the current grid size. The start of the window is
+  /// moved back if needed so that its corner lies on a whole metre.
+  /// @param[in] window : requested window, NULL for the whole grid
+  /// @param[out] clipped : window to read
+  /// @return false if the window doesn't overlap the grid
+  ///
+  bool clipWindow( const struct lidarWindow* window, struct lidarWindow& clipped );
+
+  /// Convert a number of cells to a distance rounded to whole metres
+  ///
+  unsigned int cellsToMetres( unsigned int cells );
+
+  /// Allocate the grid for a window of the current grid, allowing for
+  /// decimation, and update the header values to match
+  ///
+  void allocateWindow( const struct lidarWindow& window );
+
+  /// Fill grid rows first to last - 1, working north to south. Window rows
+  /// are obtained, north first, from "fetch" and decimated as required.
+  /// @param[in] first : first grid row
+  /// @param[in] last : one past the last grid row
+  /// @param[in] window : window being read
+  /// @param[in] fetch : fetch( r, values ) stores window row "r" in "values"
+  ///
+  void buildRows( unsigned int first, unsigned int last, const struct lidarWindow& window,
+                  const function<void( unsigned int, float* )>& fetch );
+
+  /// Combine a block of window rows into one grid row
+  /// @param[in] block : "count" rows of "width" values, row 0 southernmost
+  /// @param[in] count : number of rows in the block
+  /// @param[in] width : number of values in each row
+  /// @param[out] row : grid row
+  ///
+  void poolBlock( const float* block, unsigned int count, unsigned int width, float* row );
 
 public:
 
+  // Construction
+  // ============
+  /// Class constructor, creates an empty grid
+  ///
+  lidar( void );
+
+  /// Class constructor, creates a grid with every value set to NODATA.
+  /// Throws bad_alloc if the memory can't be allocated.
+  /// @param[in] columns : number of columns
+  /// @param[in] rows : number of rows
+  /// @param[in] xll : X coordinate of the lower left hand corner
+  /// @param[in] yll : Y coordinate of the lower left hand corner
+  /// @param[in] size : data resolution ( in m )
+  /// @param[in] noData : value indicating no data for a point
+  ///
+  lidar( unsigned int columns, unsigned int rows, unsigned int xll, unsigned int yll,
+         float size, float noData );
+
+  /// Move constructor, takes ownership of the other grid
+  ///
+  lidar( lidar&& other );
+
+  /// Move assignment, takes ownership of the other grid
+  ///
+  lidar& operator=( lidar&& other );
+
+  /// Class destructor, releases the grid memory
+  ///
+  ~lidar( void );
+
+  // Grids can be large so copies must be explicit
+  lidar( const lidar& ) = delete;
+  lidar& operator=( const lidar& ) = delete;
+
+
   // File IO
   // =======
-  /// Read a LiDAR image from a disk file.
+  /// Read a LiDAR image from a disk file. Gzip compressed files ( e.g.
+  /// ".asc.gz" ) are decompressed in memory. LAS point cloud files are
+  /// gridded, see "setPointCloudOptions".
   /// @param[in] fileName : path to file
   /// @return Success/fail & error message
   ///
   struct returnResult readFromFile( const string fileName );
 
+  /// Read part of a LiDAR image from a disk file. Rows outside the window
+  /// are skipped without being converted and only the window is stored.
+  /// The window is clipped to the grid, and its start may be moved back so
+  /// that the new lower left hand corner lies on a whole metre.
+  /// @param[in] fileName : path to file
+  /// @param[in] window : part of the grid to read, row 0 is the southern edge
+  /// @return Success/fail & error message
+  ///
+  struct returnResult readFromFile( const string fileName, const struct lidarWindow& window );
+
+  /// Read the part of a LiDAR image that covers an area. Every cell that
+  /// overlaps the area is read, see above for how the window is adjusted.
+  /// @param[in] fileName : path to file
+  /// @param[in] minX : western edge of area
+  /// @param[in] minY : southern edge of area
+  /// @param[in] maxX : eastern edge of area
+  /// @param[in] maxY : northern edge of area
+  /// @return Success/fail & error message
+  ///
+  struct returnResult readFromFile( const string fileName, double minX, double minY,
+                                    double maxX, double maxY );
+
+  /// Read the difference of two grids that cover the same cells, e.g. a
+  /// surface model minus a terrain model gives the height of buildings and
+  /// trees. The files are read a band of rows at a time so neither is
+  /// completely in memory, except for gzip compressed and LAS files which
+  /// have to be decoded completely so are read once in full. Cells that
+  /// are NODATA in either file are NODATA.
+  /// Decimation and point cloud options apply to both files.
+  /// @param[in] fileName : path to file, e.g. the surface model
+  /// @param[in] baseFileName : path to the file to subtract, e.g. the terrain model
+  /// @return Success/fail & error message
+  ///
+  struct returnResult readDifference( const string fileName, const string baseFileName );
+
+  /// Enable / disable the binary cache. When enabled, "readFromFile" writes
+  /// a binary copy of the grid next to the source file ( "<file>.lgc" ) and
+  /// uses it instead of the text file on later reads, for as long as the
+  /// source file's size and modification time are unchanged.
+  /// @param[in] enable : true to use the cache
+  ///
+  void setCacheEnabled( bool enable );
+
+  /// Reduce the resolution of the grid while reading. Each block of
+  /// factor x factor cells becomes one cell, the cell size is multiplied
+  /// by "factor" and blocks at the north and east edges may be partial.
+  /// Applies to later calls of "readFromFile".
+  /// @param[in] factor : reduction factor, 1 to read at full resolution
+  /// @param[in] pooling : how the cells in a block are combined
+  ///
+  void setDecimation( unsigned int factor, enum lidarPooling pooling );
+
+  /// Set how LAS point cloud files are gridded by "readFromFile". Decimation
+  /// of a point cloud multiplies the cell size, the points are then binned
+  /// directly at the lower resolution.
+  /// @param[in] size : cell size ( in m ), default 1
+  /// @param[in] rule : how the points in a cell are combined, default BIN_MAX
+  ///
+  void setPointCloudOptions( float size, enum lidarBinning rule );
+
+  /// Read only the header of a LiDAR file. The header values are available
+  /// as normal but no grid data is loaded, so "getValue" / "setValue" fail
+  /// until the file is read in full.
+  /// @param[in] fileName : path to file
+  /// @return Success/fail & error message
+  ///
+  struct returnResult readHeader( const string fileName );
+
   // Information
   // ===========
   /// Return the non-data elements of the file in a printable format
@@ -104,6 +404,154 @@ public:
   ///
   bool setValue( unsigned int col, unsigned int row, float value );
 
+  // Statistics
+  // ==========
+  // These are gathered while a file is read so normally cost nothing.
+  // After "setValue" they are recalculated on the next request.
+
+  /// Get the lowest value in the grid, ignoring NODATA
+  /// @return Minimum value, NODATA value if there is no data
+  ///
+  float getMinValue( void );
+
+  /// Get the highest value in the grid, ignoring NODATA
+  /// @return Maximum value, NODATA value if there is no data
+  ///
+  float getMaxValue( void );
+
+  /// Get the mean of the values in the grid, ignoring NODATA
+  /// @return Mean value, NODATA value if there is no data
+  ///
+  double getMeanValue( void );
+
+  /// Get the number of cells that have no data
+  /// @return Number of NODATA cells
+  ///
+  UINT64 getNODATACount( void );
+
+  /// Recalculate the statistics and NODATA bitmap from the grid, needed
+  /// after changing the grid through "getRow" / "getRowSpan"
+  ///
+  void updateStatistics( void );
+
+  /// Check whether a cell has no data. No range checking is done.
+  /// @param[in] col : column number
+  /// @param[in] row : row number
+  /// @return true if the cell has no data
+  ///
+  bool isNODATA( unsigned int col, unsigned int row ) const
+  {
+    return ( nodataMask[ ( row * maskStride ) + ( col / 64 ) ] >> ( col % 64 ) ) & 1;
+  }
+
+  /// Get the NODATA bitmap. Bit ( col % 64 ) of word
+  /// ( row * getNODATAMaskStride() ) + ( col / 64 ) is set for NODATA cells.
+  /// @return Packed bitmap
+  ///
+  const vector<UINT64>& getNODATAMask( void ) const { return nodataMask; }
+
+  /// Get the number of words in each row of the NODATA bitmap
+  /// @return Row stride ( in words )
+  ///
+  size_t getNODATAMaskStride( void ) const { return maskStride; }
+
+  // Processing
+  // ==========
+  /// Fill NODATA cells with a smooth surface that meets the surrounding
+  /// data, e.g. for water bodies and building voids. Runs in O(N) time
+  /// using a multigrid scheme. Throws bad_alloc if the work space can't
+  /// be allocated.
+  /// @param[in] maxDistance : only fill cells within this many cells of
+  ///                          the nearest data, 0 to fill every cell
+  /// @return Number of cells filled
+  ///
+  UINT64 fillGaps( unsigned int maxDistance );
+
+  /// Create a new grid by resampling this one. Cells of the new grid that
+  /// fall outside this grid are NODATA. Bilinear interpolation uses the
+  /// cells that have data, as long as they carry at least half the weight.
+  /// Bicubic interpolation falls back to bilinear next to NODATA.
+  /// Throws invalid_argument if the cell size isn't positive and bad_alloc
+  /// if the new grid can't be allocated.
+  /// @param[in] size : cell size of the new grid ( in m )
+  /// @param[in] xll : X coordinate of the lower left hand corner of the new grid
+  /// @param[in] yll : Y coordinate of the lower left hand corner of the new grid
+  /// @param[in] columns : number of columns in the new grid
+  /// @param[in] rows : number of rows in the new grid
+  /// @param[in] method : interpolation method
+  /// @return New grid
+  ///
+  lidar resample( float size, unsigned int xll, unsigned int yll, unsigned int columns,
+                  unsigned int rows, enum lidarInterpolation method ) const;
+
+  /// Create a new grid covering the same area at a different cell size,
+  /// see above. Also throws invalid_argument if the new grid would have
+  /// too many rows or columns.
+  /// @param[in] size : cell size of the new grid ( in m )
+  /// @param[in] method : interpolation method
+  /// @return New grid
+  ///
+  lidar resample( float size, enum lidarInterpolation method ) const;
+
+  /// Bilinear interpolation at a point, using the cells that have data as
+  /// long as they carry at least half the weight
+  /// @param[in] x : X coordinate, same units as the grid corner
+  /// @param[in] y : Y coordinate
+  /// @param[out] value : interpolated value
+  /// @return false if the point is outside the grid or has no data
+  ///
+  bool interpolate( double x, double y, float& value ) const;
+
+  /// Lay out the points of an elevation profile along a polyline, one
+  /// every "step" along the line plus the end of the line. The points have
+  /// no values until a grid is sampled.
+  /// @param[in] polyline : X, Y coordinates of the line's vertices
+  /// @param[in] step : distance between points
+  /// @return The profile points
+  ///
+  static vector<struct lidarProfilePoint> profilePoints( const vector< pair<double, double> >& polyline,
+                                                         double step );
+
+  /// Add the cells of the grid to the bilinear interpolation at each
+  /// profile point. A set of profiles can be passed to each tile of a
+  /// survey in turn, points near the edge of a tile are interpolated from
+  /// the cells of the tiles either side. Profiles are shared between
+  /// threads. Call "finishProfiles" once every grid has been sampled.
+  /// @param[in] profiles : profiles to sample
+  ///
+  void sampleProfiles( vector< vector<struct lidarProfilePoint> >& profiles ) const;
+
+  /// Work out the elevation of each profile point from the cells sampled.
+  /// Points are valid if the cells with data carry at least half the weight.
+  /// @param[in] profiles : profiles to finish
+  ///
+  static void finishProfiles( vector< vector<struct lidarProfilePoint> >& profiles );
+
+  // Direct access
+  // =============
+  /// Get a pointer to the start of a row. The row is LIDAR_ALIGNMENT aligned
+  /// and holds getNoColumns() values. No range checking is done.
+  /// @param[in] row : row number
+  /// @return Pointer to the first value in the row
+  ///
+  float* getRow( unsigned int row ) { return values + ( row * rowStride ); }
+  const float* getRow( unsigned int row ) const { return values + ( row * rowStride ); }
+
+  /// Get a row as a span. No range checking is done.
+  /// @param[in] row : row number
+  /// @return View of the values in the row
+  ///
+  struct lidarSpan getRowSpan( unsigned int row )
+  {
+    struct lidarSpan s = { getRow( row ), ncols };
+    return s;
+  }
+
+  /// Get the distance between the start of consecutive rows
+  /// @return Row stride ( in values, not bytes )
+  ///
+  size_t getRowStride( void ) const { return rowStride; }
+
 };
 
 #endif
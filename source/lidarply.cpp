@@ -152,3 +152,33 @@ unsigned int lidarply::addVertex( float x, float y, float z, unsigned int red, u
   return vertElement->addVertex( data );
 
 }
+
+// --------------------------------------------------------------------
+
+unsigned int lidarply::addEdge( unsigned int vertex1, unsigned int vertex2 )
+{
+  // The edge element is only in the file if it is used
+  if( edgeElementIndex == -1 )
+  {
+    plyElementSep* newElement = new plyElementSep( "edge" );
+    newElement->setCount( 0 );
+    struct returnResult r = newElement->addProperty( "vertex1", "int" );
+    if( r.result == false )
+    {
+      throw invalid_argument( "Failed to add property: Reason: " + r.reason );
+    }
+    r = newElement->addProperty( "vertex2", "int" );
+    if( r.result == false )
+    {
+      throw invalid_argument( "Failed to add property: Reason: " + r.reason );
+    }
+    elements.push_back( newElement );
+    edgeElementIndex = elements.size() - 1;
+  }
+
+  vector<UINT64> data;
+  data.push_back( packAscii( to_string( vertex1 ), "int" ) );
+  data.push_back( packAscii( to_string( vertex2 ), "int" ) );
+  plyElementSep *edgeElement = dynamic_cast<plyElementSep *>( elements.at( edgeElementIndex ) );
+  return edgeElement->addVertex( data );
+}
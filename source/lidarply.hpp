@@ -35,11 +35,19 @@ using namespace std;
 ///     - List type as int
 ///     - List name - "vertex_index"
 ///     - Data element type as int
+///   - Edge ( only created if edges are added )
+///     - vertex1, vertex2 as int types
 ///
 
 class lidarply : public ply
 {
 
+protected:
+
+  /// Index of the edge element, -1 until the first edge is added
+  ///
+  int edgeElementIndex = -1;
+
 public:
 
   /// Class constructor, creates blank vertex and face elements
@@ -57,6 +65,13 @@ public:
   ///
   unsigned int addVertex( float x, float y, float z, unsigned int red, unsigned int green, unsigned int blue );
 
+  /// Add an edge, i.e. a line between two vertices
+  /// @param[in] vertex1 : index of the first vertex
+  /// @param[in] vertex2 : index of the second vertex
+  /// @return The index of the new edge
+  ///
+  unsigned int addEdge( unsigned int vertex1, unsigned int vertex2 );
+
 };
 
 #endif
@@ -0,0 +1,295 @@
+// lidarterrain.cpp - Hillshade, slope and aspect of LiDAR grids
+// Copyright (C) 2018 John Davies
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Horn, B.K.P. "Hill shading and the reflectance map", Proceedings of the
+// IEEE, 69(1), 1981
+
+#include "lidarterrain.hpp"
+#include "lodepng.h"
+#include <string>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+static const float DEGREES = 180.0f / static_cast<float>( M_PI );
+
+// ====================================================================
+// Constructor
+
+lidarTerrain::lidarTerrain( void )
+{
+  sunAzimuth = 315.0;
+  sunAltitude = 45.0;
+  zFactor = 1.0;
+}
+
+// ====================================================================
+// Options
+
+void lidarTerrain::setSun( float azimuth, float altitude )
+{
+  sunAzimuth = azimuth;
+  sunAltitude = altitude;
+}
+
+// --------------------------------------------------------------------
+
+void lidarTerrain::setZFactor( float factor )
+{
+  zFactor = factor;
+}
+
+// ====================================================================
+// Gradients
+
+void lidarTerrain::gradients( lidar& dem, const function<void( unsigned int, const float*, const float*,
+                                                               const float* )>& output ) const
+{
+  unsigned int cols = dem.getNoColumns();
+  unsigned int rows = dem.getNoRows();
+  float noData = dem.getNODATA_value();
+  float scale = zFactor / ( 8.0f * dem.getCellsize() );
+  if( ( cols == 0 ) || ( rows == 0 ) )
+  {
+    return;
+  }
+
+  parallelFor( rows, defaultThreadCount(), [&]( unsigned int first, unsigned int last )
+  {
+    // Rows padded by one cell at each end
+    vector<float> north( cols + 2 ), centre( cols + 2 ), south( cols + 2 );
+    vector<float> dx( cols ), dy( cols );
+    auto load = [&]( unsigned int r, vector<float>& row )
+    {
+      const float* src = dem.getRow( r );
+      std::copy( src, src + cols, row.begin() + 1 );
+      row[0] = row[1];
+      row[ cols + 1 ] = row[ cols ];
+      return std::find( row.begin(), row.end(), noData ) != row.end();
+    };
+
+    for( unsigned int r=first; r<last; r++ )
+    {
+      bool gaps = load( min( r + 1, rows - 1 ), north );
+      gaps |= load( r, centre );
+      gaps |= load( ( r > 0 ) ? r - 1 : 0, south );
+
+      // Straight through, this loop is vectorised by the compiler
+      const float* n = north.data();
+      const float* m = centre.data();
+      const float* s = south.data();
+      for( unsigned int c=0; c<cols; c++ )
+      {
+        dx[c] = ( ( n[c+2] + ( 2.0f * m[c+2] ) + s[c+2] ) - ( n[c] + ( 2.0f * m[c] ) + s[c] ) ) * scale;
+        dy[c] = ( ( n[c] + ( 2.0f * n[c+1] ) + n[c+2] ) - ( s[c] + ( 2.0f * s[c+1] ) + s[c+2] ) ) * scale;
+      }
+
+      // Then redo the cells next to NODATA
+      if( gaps == true )
+      {
+        for( unsigned int c=0; c<cols; c++ )
+        {
+          float z = m[c+1];
+          if( z == noData )
+          {
+            continue;
+          }
+          float k[9] = { n[c], n[c+1], n[c+2], m[c], z, m[c+2], s[c], s[c+1], s[c+2] };
+          bool missing = false;
+          for( auto& v : k )
+          {
+            if( v == noData )
+            {
+              v = z;
+              missing = true;
+            }
+          }
+          if( missing == true )
+          {
+            dx[c] = ( ( k[2] + ( 2.0f * k[5] ) + k[8] ) - ( k[0] + ( 2.0f * k[3] ) + k[6] ) ) * scale;
+            dy[c] = ( ( k[0] + ( 2.0f * k[1] ) + k[2] ) - ( k[6] + ( 2.0f * k[7] ) + k[8] ) ) * scale;
+          }
+        }
+      }
+
+      output( r, dx.data(), dy.data(), m + 1 );
+    }
+  } );
+}
+
+// ====================================================================
+// Kernels
+
+lidar lidarTerrain::hillshade( lidar& dem ) const
+{
+  lidar result( dem.getNoColumns(), dem.getNoRows(), dem.getXllcorner(), dem.getYllcorner(),
+                dem.getCellsize(), dem.getNODATA_value() );
+  float noData = dem.getNODATA_value();
+
+  // Direction of the sun as a unit vector ( east, north, up )
+  float azimuth = sunAzimuth / DEGREES;
+  float altitude = sunAltitude / DEGREES;
+  float lx = sin( azimuth ) * cos( altitude );
+  float ly = cos( azimuth ) * cos( altitude );
+  float lz = sin( altitude );
+
+  gradients( dem, [&]( unsigned int r, const float* dx, const float* dy, const float* z )
+  {
+    float* out = result.getRow( r );
+    for( unsigned int c=0; c<result.getNoColumns(); c++ )
+    {
+      // Surface normal is ( -dx, -dy, 1 )
+      float shade = ( lz - ( dx[c] * lx ) - ( dy[c] * ly ) )
+                  / sqrt( 1.0f + ( dx[c] * dx[c] ) + ( dy[c] * dy[c] ) );
+      out[c] = ( z[c] == noData ) ? noData : 255.0f * max( shade, 0.0f );
+    }
+  } );
+
+  result.updateStatistics();
+  return result;
+}
+
+// --------------------------------------------------------------------
+
+lidar lidarTerrain::slope( lidar& dem ) const
+{
+  lidar result( dem.getNoColumns(), dem.getNoRows(), dem.getXllcorner(), dem.getYllcorner(),
+                dem.getCellsize(), dem.getNODATA_value() );
+  float noData = dem.getNODATA_value();
+
+  gradients( dem, [&]( unsigned int r, const float* dx, const float* dy, const float* z )
+  {
+    float* out = result.getRow( r );
+    for( unsigned int c=0; c<result.getNoColumns(); c++ )
+    {
+      float s = atan( sqrt( ( dx[c] * dx[c] ) + ( dy[c] * dy[c] ) ) ) * DEGREES;
+      out[c] = ( z[c] == noData ) ? noData : s;
+    }
+  } );
+
+  result.updateStatistics();
+  return result;
+}
+
+// --------------------------------------------------------------------
+
+lidar lidarTerrain::aspect( lidar& dem ) const
+{
+  lidar result( dem.getNoColumns(), dem.getNoRows(), dem.getXllcorner(), dem.getYllcorner(),
+                dem.getCellsize(), dem.getNODATA_value() );
+  float noData = dem.getNODATA_value();
+
+  gradients( dem, [&]( unsigned int r, const float* dx, const float* dy, const float* z )
+  {
+    float* out = result.getRow( r );
+    for( unsigned int c=0; c<result.getNoColumns(); c++ )
+    {
+      if( ( z[c] == noData ) || ( ( dx[c] == 0.0f ) && ( dy[c] == 0.0f ) ) )
+      {
+        out[c] = noData;
+        continue;
+      }
+      // Downhill direction
+      float a = atan2( -dx[c], -dy[c] ) * DEGREES;
+      out[c] = ( a < 0.0f ) ? a + 360.0f : a;
+    }
+  } );
+
+  result.updateStatistics();
+  return result;
+}
+
+// ====================================================================
+// Output
+
+// Grey level of a value, 0 - 255 ( minimum > maximum inverts the scale )
+static unsigned char greyLevel( float v, float minimum, float maximum )
+{
+  float range = maximum - minimum;
+  float t = ( range != 0.0f ) ? ( v - minimum ) / range : 0.0f;
+  return static_cast<unsigned char>( ( min( max( t, 0.0f ), 1.0f ) * 255.0f ) + 0.5f );
+}
+
+// --------------------------------------------------------------------
+
+struct returnResult lidarTerrain::writePng( lidar& grid, float minimum, float maximum,
+                                            const string fileName )
+{
+  struct returnResult res = { true, "" };
+
+  unsigned int cols = grid.getNoColumns();
+  unsigned int rows = grid.getNoRows();
+  float noData = grid.getNODATA_value();
+
+  // Grey + alpha, the first image row is the northern edge
+  vector<unsigned char> image( static_cast<size_t>( cols ) * rows * 2 );
+  parallelFor( rows, defaultThreadCount(), [&]( unsigned int first, unsigned int last )
+  {
+    for( unsigned int r=first; r<last; r++ )
+    {
+      const float* row = grid.getRow( r );
+      unsigned char* out = &image[ static_cast<size_t>( rows - 1 - r ) * cols * 2 ];
+      for( unsigned int c=0; c<cols; c++ )
+      {
+        bool valid = ( row[c] != noData );
+        out[ c * 2 ] = valid ? greyLevel( row[c], minimum, maximum ) : 0;
+        out[ ( c * 2 ) + 1 ] = valid ? 255 : 0;
+      }
+    }
+  } );
+
+  unsigned error = lodepng::encode( fileName, image, cols, rows, LCT_GREY_ALPHA );
+  if( error )
+  {
+    res.result = false;
+    res.reason = "Error writing file: " + fileName + "\n" + lodepng_error_text( error );
+  }
+
+  return res;
+}
+
+// --------------------------------------------------------------------
+
+struct returnResult lidarTerrain::toImage( lidar& grid, float minimum, float maximum,
+                                           lidarImage& image )
+{
+  struct returnResult res = { true, "" };
+
+  unsigned int cols = grid.getNoColumns();
+  unsigned int rows = grid.getNoRows();
+  float noData = grid.getNODATA_value();
+  if( ( image.getXSize() != cols ) || ( image.getYSize() != rows ) )
+  {
+    res.result = false;
+    res.reason = "Image size mismatch";
+    return res;
+  }
+
+  for( unsigned int r=0; r<rows; r++ )
+  {
+    const float* row = grid.getRow( r );
+    for( unsigned int c=0; c<cols; c++ )
+    {
+      // NODATA cells are mid grey, as for points without an overlay
+      unsigned char grey = ( row[c] != noData ) ? greyLevel( row[c], minimum, maximum ) : 128;
+      image.setPixel( c, r, grey, grey, grey );
+    }
+  }
+
+  return res;
+}
@@ -0,0 +1,111 @@
+// lidarterrain.hpp - header file for lidarterrain
+// Copyright (C) 2018 John Davies
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LIDARTERRAIN_H
+#define LIDARTERRAIN_H
+
+#include "util.hpp"
+#include "lidarlib.hpp"
+#include "lidarimage.hpp"
+#include <string>
+#include <functional>
+
+using namespace std;
+
+/// Terrain analysis of LiDAR grids - hillshade, slope and aspect. The
+/// gradient at each cell comes from its 3 x 3 neighbourhood using Horn's
+/// method. Neighbours off the edge of the grid repeat the edge cells and
+/// NODATA neighbours are replaced by the centre cell. NODATA cells stay
+/// NODATA. Results are new grids with the same size and position as the
+/// elevation grid.
+///
+
+class lidarTerrain
+{
+  float sunAzimuth;
+  float sunAltitude;
+  float zFactor;
+
+  /// Work out the gradient of every cell in the grid and pass each row
+  /// of gradients to "output"
+  /// @param[in] dem : elevation grid
+  /// @param[in] output : output( row, dzdx, dzdy, centre ) for each row,
+  ///                     dzdx is the eastwards and dzdy the northwards gradient
+  ///
+  void gradients( lidar& dem, const function<void( unsigned int, const float*, const float*,
+                                                   const float* )>& output ) const;
+
+public:
+
+  /// Constructor, the sun is in the north west at 45 degrees
+  ///
+  lidarTerrain( void );
+
+  /// Set the position of the sun for hillshading
+  /// @param[in] azimuth : direction of the sun, degrees clockwise from north
+  /// @param[in] altitude : height of the sun, degrees above the horizon
+  ///
+  void setSun( float azimuth, float altitude );
+
+  /// Set the vertical exaggeration
+  /// @param[in] factor : heights are multiplied by "factor", default 1
+  ///
+  void setZFactor( float factor );
+
+  /// Shaded relief
+  /// @param[in] dem : elevation grid
+  /// @return Brightness of each cell, 0 - 255
+  ///
+  lidar hillshade( lidar& dem ) const;
+
+  /// Steepness
+  /// @param[in] dem : elevation grid
+  /// @return Slope of each cell, in degrees
+  ///
+  lidar slope( lidar& dem ) const;
+
+  /// Direction of the slope
+  /// @param[in] dem : elevation grid
+  /// @return Direction each cell faces, degrees clockwise from north.
+  ///         Flat cells are NODATA.
+  ///
+  lidar aspect( lidar& dem ) const;
+
+  /// Write a grid as a grey scale PNG image, north at the top. NODATA
+  /// cells are transparent.
+  /// @param[in] grid : grid to write
+  /// @param[in] minimum : value shown as black
+  /// @param[in] maximum : value shown as white
+  /// @param[in] fileName : path to file
+  /// @return Success/fail & error message
+  ///
+  static struct returnResult writePng( lidar& grid, float minimum, float maximum,
+                                       const string fileName );
+
+  /// Copy a grid to a grey scale image, e.g. to use as an overlay without
+  /// writing a PNG file. The image must be the same size as the grid.
+  /// @param[in] grid : grid to copy
+  /// @param[in] minimum : value shown as black
+  /// @param[in] maximum : value shown as white
+  /// @param[out] image : image to fill
+  /// @return Success/fail & error message
+  ///
+  static struct returnResult toImage( lidar& grid, float minimum, float maximum,
+                                      lidarImage& image );
+
+};
+
+#endif
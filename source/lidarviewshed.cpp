@@ -0,0 +1,166 @@
+// lidarviewshed.cpp - Viewsheds of LiDAR grids
+// Copyright (C) 2018 John Davies
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Franklin, W.R. and Ray, C. "Higher isn't necessarily better: visibility
+// algorithms and experiments", 6th International Symposium on Spatial
+// Data Handling, 1994
+
+#include "lidarviewshed.hpp"
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+// Horizon angle before anything has been seen. Finite so that it can be
+// interpolated.
+static const float NO_HORIZON = -1e30f;
+
+// ====================================================================
+// Constructor
+
+lidarViewshed::lidarViewshed( void )
+{
+  observerHeight = 1.7;
+  targetHeight = 0.0;
+}
+
+// ====================================================================
+// Options
+
+void lidarViewshed::setHeights( float observer, float target )
+{
+  observerHeight = observer;
+  targetHeight = target;
+}
+
+// ====================================================================
+// Viewshed
+
+struct returnResult lidarViewshed::compute( lidar& dem, double x, double y, lidar& visibility ) const
+{
+  struct returnResult res = { true, "" };
+
+  unsigned int cols = dem.getNoColumns();
+  unsigned int rows = dem.getNoRows();
+  float cellsize = dem.getCellsize();
+  float noData = dem.getNODATA_value();
+
+  // Cell containing the observer
+  double col = floor( ( x - dem.getXllcorner() ) / cellsize );
+  double row = floor( ( y - dem.getYllcorner() ) / cellsize );
+  if( ( col < 0.0 ) || ( row < 0.0 ) || ( col >= cols ) || ( row >= rows ) )
+  {
+    res.result = false;
+    res.reason = "Observer is outside the grid";
+    return res;
+  }
+  unsigned int oc = static_cast<unsigned int>( col );
+  unsigned int orow = static_cast<unsigned int>( row );
+  float groundZ = dem.getRow( orow )[ oc ];
+  if( groundZ == noData )
+  {
+    res.result = false;
+    res.reason = "Observer is on a NODATA cell";
+    return res;
+  }
+  float eyeZ = groundZ + observerHeight;
+
+  try
+  {
+    visibility = lidar( cols, rows, dem.getXllcorner(), dem.getYllcorner(), cellsize, noData );
+  }
+  catch( const std::bad_alloc& )
+  {
+    res.result = false;
+    res.reason = "Failed to allocate memory for the viewshed";
+    return res;
+  }
+  visibility.getRow( orow )[ oc ] = 1.0f;
+
+  // Each octant is described by the signs of the major and minor steps
+  // and whether the major axis is Y. Cells on the axes and diagonals are
+  // in two octants, so only one of them writes each of those cells.
+  struct octant {
+    int sx;
+    int sy;
+    bool swap;
+  };
+  const struct octant octants[8] = {
+    {  1,  1, false }, {  1,  1, true }, { -1,  1, true }, { -1,  1, false },
+    { -1, -1, false }, { -1, -1, true }, {  1, -1, true }, {  1, -1, false }
+  };
+
+  parallelFor( 8, defaultThreadCount(), [&]( unsigned int first, unsigned int last )
+  {
+    for( unsigned int o=first; o<last; o++ )
+    {
+      const struct octant& oct = octants[o];
+      // Number of rings and cells across each ring before leaving the grid
+      unsigned int xMax = ( oct.sx > 0 ) ? cols - 1 - oc : oc;
+      unsigned int yMax = ( oct.sy > 0 ) ? rows - 1 - orow : orow;
+      unsigned int majorMax = oct.swap ? yMax : xMax;
+      unsigned int minorMax = oct.swap ? xMax : yMax;
+
+      // Highest angle ( as a gradient ) to the horizon up to and including
+      // each cell of the previous and current rings
+      vector<float> previous( minorMax + 2, NO_HORIZON );
+      vector<float> current( minorMax + 2, NO_HORIZON );
+      for( unsigned int i=1; i<=majorMax; i++ )
+      {
+        unsigned int jMax = min( i, minorMax );
+        for( unsigned int j=0; j<=jMax; j++ )
+        {
+          unsigned int c = oc + ( oct.sx * static_cast<int>( oct.swap ? j : i ) );
+          unsigned int r = orow + ( oct.sy * static_cast<int>( oct.swap ? i : j ) );
+
+          // The line of sight crosses the previous ring between two cells
+          float horizon = NO_HORIZON;
+          if( i > 1 )
+          {
+            float along = static_cast<float>( j ) * ( i - 1 ) / i;
+            unsigned int j0 = static_cast<unsigned int>( along );
+            float f = along - j0;
+            horizon = ( f > 0.0f ) ? ( previous[ j0 ] * ( 1.0f - f ) ) + ( previous[ j0 + 1 ] * f )
+                                   : previous[ j0 ];
+          }
+
+          float z = dem.getRow( r )[c];
+          bool owner = ( j < i ) ? ( ( j > 0 ) || ( oct.swap ? oct.sx > 0 : oct.sy > 0 ) )
+                                 : ( oct.swap == false );
+          if( z == noData )
+          {
+            // Gaps don't hide anything
+            current[j] = horizon;
+            continue;
+          }
+          float distance = cellsize * sqrt( static_cast<float>( ( i * i ) + ( j * j ) ) );
+          float gradient = ( z - eyeZ ) / distance;
+          if( owner == true )
+          {
+            float target = ( z + targetHeight - eyeZ ) / distance;
+            visibility.getRow( r )[c] = ( target >= horizon ) ? 1.0f : 0.0f;
+          }
+          current[j] = max( horizon, gradient );
+        }
+        previous.swap( current );
+      }
+    }
+  } );
+
+  visibility.updateStatistics();
+  return res;
+}
@@ -0,0 +1,63 @@
+// lidarviewshed.hpp - header file for lidarviewshed
+// Copyright (C) 2018 John Davies
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LIDARVIEWSHED_H
+#define LIDARVIEWSHED_H
+
+#include "util.hpp"
+#include "lidarlib.hpp"
+
+using namespace std;
+
+/// Viewshed, i.e. which cells of a LiDAR grid can be seen from a point.
+/// The grid is swept outwards from the observer one ring of cells at a
+/// time ( the "XDraw" method ). The highest angle to the horizon along the
+/// line of sight to each cell is interpolated from the two cells it passes
+/// between in the previous ring, so every cell is visited once. The eight
+/// octants around the observer are swept in parallel.
+///
+
+class lidarViewshed
+{
+  float observerHeight;
+  float targetHeight;
+
+public:
+
+  /// Constructor, the observer is 1.7m above the ground and targets are
+  /// on the ground
+  ///
+  lidarViewshed( void );
+
+  /// Set the heights above the ground
+  /// @param[in] observer : height of the observer
+  /// @param[in] target : height of the points being looked at
+  ///
+  void setHeights( float observer, float target );
+
+  /// Work out which cells are visible
+  /// @param[in] dem : elevation grid
+  /// @param[in] x : X coordinate of the observer, same units as the grid corner
+  /// @param[in] y : Y coordinate of the observer
+  /// @param[out] visibility : 1 for visible cells, 0 for hidden cells, NODATA where
+  ///                          the elevation grid has no data
+  /// @return Success/fail & error message
+  ///
+  struct returnResult compute( lidar& dem, double x, double y, lidar& visibility ) const;
+
+};
+
+#endif
@@ -0,0 +1,223 @@
+// lidarvolume.cpp - Cut and fill volumes of LiDAR grids
+// Copyright (C) 2018 John Davies
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "lidarvolume.hpp"
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+// Independent partial sums per row, so the additions don't have to wait
+// for each other
+static const unsigned int LANES = 8;
+
+// Add to a running total, keeping the rounding error in "compensation"
+static void kahanAdd( double& sum, double& compensation, double value )
+{
+  double y = value - compensation;
+  double t = sum + y;
+  compensation = ( t - sum ) - y;
+  sum = t;
+}
+
+// ====================================================================
+// Constructor
+
+lidarVolume::lidarVolume( void )
+{
+  reset();
+}
+
+// --------------------------------------------------------------------
+
+void lidarVolume::reset( void )
+{
+  cut = 0.0;
+  cutCompensation = 0.0;
+  fill = 0.0;
+  fillCompensation = 0.0;
+  cutArea = 0.0;
+  fillArea = 0.0;
+  area = 0.0;
+}
+
+// ====================================================================
+// Volumes
+
+void lidarVolume::accumulate( lidar& surface, const function<void( unsigned int, float* )>& base,
+                              lidar* differences )
+{
+  unsigned int cols = surface.getNoColumns();
+  unsigned int rows = surface.getNoRows();
+  float noData = surface.getNODATA_value();
+  double cellArea = static_cast<double>( surface.getCellsize() ) * surface.getCellsize();
+
+  if( differences != NULL )
+  {
+    *differences = lidar( cols, rows, surface.getXllcorner(), surface.getYllcorner(),
+                          surface.getCellsize(), noData );
+  }
+
+  struct rowTotals {
+    double cut;
+    double fill;
+    UINT64 cutCells;
+    UINT64 fillCells;
+    UINT64 cells;
+  };
+  vector<struct rowTotals> totals( rows );
+
+  parallelFor( rows, defaultThreadCount(), [&]( unsigned int first, unsigned int last )
+  {
+    vector<float> baseRow( cols );
+    for( unsigned int r=first; r<last; r++ )
+    {
+      base( r, baseRow.data() );
+      const float* s = surface.getRow( r );
+      const float* b = baseRow.data();
+      float* out = ( differences != NULL ) ? differences->getRow( r ) : NULL;
+
+      double cutLane[ LANES ] = { 0.0 };
+      double fillLane[ LANES ] = { 0.0 };
+      UINT64 cutCount[ LANES ] = { 0 };
+      UINT64 fillCount[ LANES ] = { 0 };
+      UINT64 count[ LANES ] = { 0 };
+      auto cell = [&]( unsigned int c, unsigned int l )
+      {
+        bool valid = ( s[c] != noData ) & ( b[c] != noData );
+        float d = valid ? s[c] - b[c] : 0.0f;
+        cutLane[l] += max( d, 0.0f );
+        fillLane[l] += max( -d, 0.0f );
+        cutCount[l] += ( d > 0.0f );
+        fillCount[l] += ( d < 0.0f );
+        count[l] += valid;
+        if( out != NULL )
+        {
+          out[c] = valid ? d : noData;
+        }
+      };
+      unsigned int c = 0;
+      for( ; c + LANES <= cols; c += LANES )
+      {
+        for( unsigned int l=0; l<LANES; l++ )
+        {
+          cell( c + l, l );
+        }
+      }
+      for( ; c<cols; c++ )
+      {
+        cell( c, 0 );
+      }
+
+      struct rowTotals t = { 0.0, 0.0, 0, 0, 0 };
+      for( unsigned int l=0; l<LANES; l++ )
+      {
+        t.cut += cutLane[l];
+        t.fill += fillLane[l];
+        t.cutCells += cutCount[l];
+        t.fillCells += fillCount[l];
+        t.cells += count[l];
+      }
+      totals[r] = t;
+    }
+  } );
+
+  // Combine the rows in order
+  for( auto& t : totals )
+  {
+    kahanAdd( cut, cutCompensation, t.cut * cellArea );
+    kahanAdd( fill, fillCompensation, t.fill * cellArea );
+    cutArea += t.cutCells * cellArea;
+    fillArea += t.fillCells * cellArea;
+    area += t.cells * cellArea;
+  }
+
+  if( differences != NULL )
+  {
+    differences->updateStatistics();
+  }
+}
+
+// --------------------------------------------------------------------
+
+struct returnResult lidarVolume::add( lidar& surface, lidar& base, lidar* differences )
+{
+  struct returnResult res = { true, "" };
+
+  if( ( surface.getNoColumns() != base.getNoColumns() ) || ( surface.getNoRows() != base.getNoRows() )
+   || ( surface.getXllcorner() != base.getXllcorner() ) || ( surface.getYllcorner() != base.getYllcorner() )
+   || ( fabs( surface.getCellsize() - base.getCellsize() ) > 1e-6 ) )
+  {
+    res.result = false;
+    res.reason = "Grids are not aligned";
+    return res;
+  }
+
+  float noData = surface.getNODATA_value();
+  float baseNoData = base.getNODATA_value();
+  unsigned int cols = base.getNoColumns();
+  try
+  {
+    accumulate( surface, [&]( unsigned int r, float* values )
+    {
+      const float* row = base.getRow( r );
+      for( unsigned int c=0; c<cols; c++ )
+      {
+        values[c] = ( row[c] == baseNoData ) ? noData : row[c];
+      }
+    }, differences );
+  }
+  catch( const std::bad_alloc& )
+  {
+    res.result = false;
+    res.reason = "Failed to allocate memory for the differences";
+  }
+
+  return res;
+}
+
+// --------------------------------------------------------------------
+
+struct returnResult lidarVolume::add( lidar& surface, double level, double dzdx, double dzdy,
+                                      lidar* differences )
+{
+  struct returnResult res = { true, "" };
+
+  unsigned int cols = surface.getNoColumns();
+  double cellsize = surface.getCellsize();
+  double x0 = surface.getXllcorner() + ( 0.5 * cellsize );
+  double y0 = surface.getYllcorner() + ( 0.5 * cellsize );
+  try
+  {
+    accumulate( surface, [&]( unsigned int r, float* values )
+    {
+      // Height of the plane at the centre of each cell
+      double z = level + ( dzdx * x0 ) + ( dzdy * ( y0 + ( r * cellsize ) ) );
+      for( unsigned int c=0; c<cols; c++ )
+      {
+        values[c] = static_cast<float>( z + ( dzdx * c * cellsize ) );
+      }
+    }, differences );
+  }
+  catch( const std::bad_alloc& )
+  {
+    res.result = false;
+    res.reason = "Failed to allocate memory for the differences";
+  }
+
+  return res;
+}
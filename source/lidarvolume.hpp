@@ -0,0 +1,106 @@
+// lidarvolume.hpp - header file for lidarvolume
+// Copyright (C) 2018 John Davies
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LIDARVOLUME_H
+#define LIDARVOLUME_H
+
+#include "util.hpp"
+#include "lidarlib.hpp"
+#include <vector>
+#include <functional>
+
+using namespace std;
+
+/// Cut and fill volumes between a surface and a base, either a second
+/// grid or a plane. Cut is where the surface is above the base ( material
+/// to remove ), fill is where it is below. Totals build up over calls to
+/// "add" so a survey can be processed a tile at a time. Rows are summed in
+/// parallel and the row totals are combined in order with compensated
+/// ( Kahan ) summation, so the result doesn't depend on the number of
+/// threads.
+///
+
+class lidarVolume
+{
+  double cut;
+  double cutCompensation;
+  double fill;
+  double fillCompensation;
+  double cutArea;
+  double fillArea;
+  double area;
+
+  /// Sum the differences of every row and add them to the totals
+  /// @param[in] surface : upper surface
+  /// @param[in] base : base( row, values ) fills "values" with the base height
+  ///                   of each cell in the row, NODATA where there is none
+  /// @param[in] differences : if not NULL, set to surface - base for each cell
+  ///
+  void accumulate( lidar& surface, const function<void( unsigned int, float* )>& base,
+                   lidar* differences );
+
+public:
+
+  /// Constructor, all totals zero
+  ///
+  lidarVolume( void );
+
+  /// Set all the totals back to zero
+  ///
+  void reset( void );
+
+  /// Add the volumes between two grids that cover the same cells
+  /// @param[in] surface : upper surface, e.g. the later survey
+  /// @param[in] base : base surface, e.g. the earlier survey
+  /// @param[out] differences : if not NULL, set to surface - base for each cell
+  /// @return Success/fail & error message
+  ///
+  struct returnResult add( lidar& surface, lidar& base, lidar* differences = NULL );
+
+  /// Add the volumes between a grid and a plane
+  /// @param[in] surface : upper surface
+  /// @param[in] level : height of the plane at X = 0, Y = 0
+  /// @param[in] dzdx : gradient of the plane in the X direction
+  /// @param[in] dzdy : gradient of the plane in the Y direction
+  /// @param[out] differences : if not NULL, set to surface - plane for each cell
+  /// @return Success/fail & error message
+  ///
+  struct returnResult add( lidar& surface, double level, double dzdx = 0.0, double dzdy = 0.0,
+                           lidar* differences = NULL );
+
+  /// @return Volume of the surface above the base
+  ///
+  double getCut( void ) { return cut; }
+
+  /// @return Volume of the surface below the base
+  ///
+  double getFill( void ) { return fill; }
+
+  /// @return Area where the surface is above the base
+  ///
+  double getCutArea( void ) { return cutArea; }
+
+  /// @return Area where the surface is below the base
+  ///
+  double getFillArea( void ) { return fillArea; }
+
+  /// @return Area where both the surface and base have data
+  ///
+  double getArea( void ) { return area; }
+
+};
+
+#endif
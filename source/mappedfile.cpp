@@ -0,0 +1,137 @@
+// mappedfile.cpp - Read only memory mapped view of a disk file
+// Copyright (C) 2018 John Davies
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "mappedfile.hpp"
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+// ====================================================================
+// Constructor / destructor
+
+mappedFile::mappedFile( void )
+{
+  fileData = NULL;
+  fileSize = 0;
+  isMapped = false;
+}
+
+// --------------------------------------------------------------------
+
+mappedFile::~mappedFile( void )
+{
+  close();
+}
+
+// ====================================================================
+// File IO
+
+struct returnResult mappedFile::open( const string fileName )
+{
+  struct returnResult res = { true, "" };
+
+  close();
+
+  int fd = ::open( fileName.c_str(), O_RDONLY );
+  if( fd < 0 )
+  {
+    res.result = false;
+    res.reason = "Error opening file: " + fileName + "\n" + strerror( errno );
+    return res;
+  }
+
+  struct stat info;
+  if( fstat( fd, &info ) != 0 )
+  {
+    res.result = false;
+    res.reason = "Error reading file size: " + fileName + "\n" + strerror( errno );
+    ::close( fd );
+    return res;
+  }
+  fileSize = info.st_size;
+
+  if( fileSize == 0 )
+  {
+    // Nothing to map, leave as an empty view
+    ::close( fd );
+    return res;
+  }
+
+  void* p = mmap( NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0 );
+  if( p != MAP_FAILED )
+  {
+    // Data is read front to back so let the kernel read ahead
+    madvise( p, fileSize, MADV_SEQUENTIAL );
+    fileData = static_cast<const char*>( p );
+    isMapped = true;
+  }
+  else
+  {
+    // Mapping not supported ( e.g. a pipe ) so read in one block
+    char* buffer = new char[ fileSize ];
+    size_t total = 0;
+    while( total < fileSize )
+    {
+      ssize_t n = read( fd, buffer + total, fileSize - total );
+      if( n <= 0 )
+      {
+        break;
+      }
+      total += n;
+    }
+    if( total != fileSize )
+    {
+      delete[] buffer;
+      fileSize = 0;
+      res.result = false;
+      res.reason = "Error reading file: " + fileName;
+    }
+    else
+    {
+      fileData = buffer;
+    }
+  }
+  ::close( fd );
+
+  return res;
+}
+
+// --------------------------------------------------------------------
+
+void mappedFile::close( void )
+{
+  if( fileData != NULL )
+  {
+    if( isMapped == true )
+    {
+      munmap( const_cast<char*>( fileData ), fileSize );
+    }
+    else
+    {
+      delete[] fileData;
+    }
+  }
+  fileData = NULL;
+  fileSize = 0;
+  isMapped = false;
+}
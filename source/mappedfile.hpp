@@ -0,0 +1,71 @@
+// mappedfile.hpp - header file for mappedfile
+// Copyright (C) 2018 John Davies
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include "util.hpp"
+#include <string>
+#include <cstddef>
+
+using namespace std;
+
+/// Read only view of a complete disk file. The file is memory mapped
+/// where possible, otherwise it is read into memory in one block.
+/// The mapping is released when the object is destroyed.
+///
+
+class mappedFile
+{
+  const char* fileData;
+  size_t fileSize;
+  bool isMapped;
+
+public:
+
+  /// Constructor, creates an empty view
+  ///
+  mappedFile( void );
+
+  /// Destructor, releases the mapping / buffer
+  ///
+  ~mappedFile( void );
+
+  /// Map a disk file
+  /// @param[in] fileName : path to file
+  /// @return Success/fail & error message
+  ///
+  struct returnResult open( const string fileName );
+
+  /// Release the current file
+  ///
+  void close( void );
+
+  /// @return Pointer to the start of the file contents
+  ///
+  const char* data( void ) const { return fileData; }
+
+  /// @return Number of bytes in the file
+  ///
+  size_t size( void ) const { return fileSize; }
+
+private:
+  mappedFile( const mappedFile& );
+  mappedFile& operator=( const mappedFile& );
+
+};
+
+#endif
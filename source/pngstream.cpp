@@ -0,0 +1,708 @@
+// pngstream.cpp - Row by row decoder for PNG files
+// Copyright (C) 2018 John Davies
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <stdexcept>
+#include "pngstream.hpp"
+#include "lodepng.h"
+using namespace std;
+
+// Size of the deflate history window
+#define WINDOW_SIZE 32768
+#define WINDOW_MASK ( WINDOW_SIZE - 1 )
+
+// Base values and extra bits for length and distance codes ( RFC 1951 3.2.5 )
+static const unsigned short lengthBase[29] = {
+  3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+  35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const unsigned char lengthExtra[29] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const unsigned short distanceBase[30] = {
+  1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+  257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const unsigned char distanceExtra[30] = {
+  0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+  7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+// Order of the code length code lengths in a dynamic block header
+static const unsigned char codeLengthOrder[19] = {
+  16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+// ====================================================================
+// Inflate - constructor
+
+inflateStream::inflateStream( void )
+{
+  window.assign( WINDOW_SIZE, 0 );
+  reset();
+}
+
+// --------------------------------------------------------------------
+
+void inflateStream::addInput( const unsigned char* data, size_t size )
+{
+  input.push_back( make_pair( data, size ) );
+}
+
+// --------------------------------------------------------------------
+
+void inflateStream::reset( void )
+{
+  inputBlock = 0;
+  inputPos = 0;
+  bitBuffer = 0;
+  bitCount = 0;
+  paddingBits = 0;
+  outputCount = 0;
+  started = false;
+  inBlock = false;
+  storedBlock = false;
+  finalBlock = false;
+  finished = false;
+  storedRemaining = 0;
+  matchLength = 0;
+  matchDistance = 0;
+}
+
+// ====================================================================
+// Inflate - bit input
+
+void inflateStream::fillBits( unsigned int count )
+{
+  while( bitCount < count )
+  {
+    while( ( inputBlock < input.size() ) && ( inputPos >= input[ inputBlock ].second ) )
+    {
+      inputBlock++;
+      inputPos = 0;
+    }
+
+    // Past the end is read as zeros, an error if they are used
+    UINT64 value = 0;
+    if( inputBlock < input.size() )
+    {
+      value = input[ inputBlock ].first[ inputPos++ ];
+    }
+    else
+    {
+      paddingBits += 8;
+    }
+    bitBuffer |= value << bitCount;
+    bitCount += 8;
+  }
+}
+
+// --------------------------------------------------------------------
+
+unsigned int inflateStream::getBits( unsigned int count )
+{
+  if( count == 0 )
+  {
+    return 0;
+  }
+  fillBits( count );
+  unsigned int value = static_cast<unsigned int>( bitBuffer & ( ( 1ULL << count ) - 1 ) );
+  bitBuffer >>= count;
+  bitCount -= count;
+  if( bitCount < paddingBits )
+  {
+    throw invalid_argument( "Compressed image data is truncated" );
+  }
+  return value;
+}
+
+// ====================================================================
+// Inflate - Huffman codes
+
+void inflateStream::buildTable( struct huffmanTable& table, const unsigned char* lengths, unsigned int count )
+{
+  memset( table.count, 0, sizeof( table.count ) );
+  for( unsigned int i=0; i<count; i++ )
+  {
+    table.count[ lengths[i] ]++;
+  }
+  table.count[0] = 0;
+
+  // Check that the lengths make a valid prefix code
+  int left = 1;
+  for( unsigned int length=1; length<16; length++ )
+  {
+    left = ( left << 1 ) - table.count[ length ];
+    if( left < 0 )
+    {
+      throw invalid_argument( "Invalid Huffman code in image data" );
+    }
+  }
+
+  // Symbols in code order
+  unsigned short offsets[16];
+  offsets[1] = 0;
+  for( unsigned int length=1; length<15; length++ )
+  {
+    offsets[ length + 1 ] = offsets[ length ] + table.count[ length ];
+  }
+  for( unsigned int i=0; i<count; i++ )
+  {
+    if( lengths[i] != 0 )
+    {
+      table.symbol[ offsets[ lengths[i] ]++ ] = i;
+    }
+  }
+
+  // Lookup table for the short codes, indexed by the next 9 bits of input
+  // ( codes are stored most significant bit first )
+  memset( table.fast, 0, sizeof( table.fast ) );
+  unsigned int code = 0;
+  unsigned int index = 0;
+  for( unsigned int length=1; length<=9; length++ )
+  {
+    code = ( code + table.count[ length - 1 ] ) << 1;
+    for( unsigned int i=0; i<table.count[ length ]; i++ )
+    {
+      unsigned int reversed = 0;
+      for( unsigned int bit=0; bit<length; bit++ )
+      {
+        reversed |= ( ( ( code + i ) >> bit ) & 1 ) << ( length - 1 - bit );
+      }
+      unsigned short entry = static_cast<unsigned short>( ( table.symbol[ index + i ] << 4 ) | length );
+      for( unsigned int k=reversed; k<512; k+=( 1 << length ) )
+      {
+        table.fast[k] = entry;
+      }
+    }
+    index += table.count[ length ];
+  }
+}
+
+// --------------------------------------------------------------------
+
+unsigned int inflateStream::decodeSymbol( const struct huffmanTable& table )
+{
+  fillBits( 15 );
+  unsigned short entry = table.fast[ bitBuffer & 511 ];
+  if( entry != 0 )
+  {
+    getBits( entry & 15 );
+    return entry >> 4;
+  }
+
+  // Longer codes, a bit at a time
+  UINT64 bits = bitBuffer;
+  int code = 0;
+  int first = 0;
+  int index = 0;
+  for( unsigned int length=1; length<16; length++ )
+  {
+    code |= static_cast<int>( bits & 1 );
+    bits >>= 1;
+    int count = table.count[ length ];
+    if( code - count < first )
+    {
+      getBits( length );
+      return table.symbol[ index + ( code - first ) ];
+    }
+    index += count;
+    first = ( first + count ) << 1;
+    code <<= 1;
+  }
+  throw invalid_argument( "Invalid Huffman code in image data" );
+}
+
+// --------------------------------------------------------------------
+
+void inflateStream::readBlockHeader( void )
+{
+  finalBlock = ( getBits( 1 ) == 1 );
+  unsigned int type = getBits( 2 );
+  unsigned char lengths[ 286 + 30 ];
+
+  if( type == 0 )
+  {
+    // Stored, starts at the next byte
+    getBits( bitCount % 8 );
+    unsigned int length = getBits( 16 );
+    unsigned int check = getBits( 16 );
+    if( length != ( ~check & 0xFFFF ) )
+    {
+      throw invalid_argument( "Invalid stored block in image data" );
+    }
+    storedRemaining = length;
+    matchLength = 0;
+  }
+  else if( type == 1 )
+  {
+    // Fixed Huffman codes
+    memset( lengths, 8, 144 );
+    memset( lengths + 144, 9, 112 );
+    memset( lengths + 256, 7, 24 );
+    memset( lengths + 280, 8, 8 );
+    buildTable( literals, lengths, 288 );
+    memset( lengths, 5, 30 );
+    buildTable( distances, lengths, 30 );
+  }
+  else if( type == 2 )
+  {
+    // Dynamic Huffman codes
+    unsigned int literalCount = getBits( 5 ) + 257;
+    unsigned int distanceCount = getBits( 5 ) + 1;
+    unsigned int codeCount = getBits( 4 ) + 4;
+    if( ( literalCount > 286 ) || ( distanceCount > 30 ) )
+    {
+      throw invalid_argument( "Invalid block header in image data" );
+    }
+
+    unsigned char codeLengths[19];
+    memset( codeLengths, 0, sizeof( codeLengths ) );
+    for( unsigned int i=0; i<codeCount; i++ )
+    {
+      codeLengths[ codeLengthOrder[i] ] = getBits( 3 );
+    }
+    struct huffmanTable codes;
+    buildTable( codes, codeLengths, 19 );
+
+    unsigned int total = literalCount + distanceCount;
+    unsigned int i = 0;
+    while( i < total )
+    {
+      unsigned int symbol = decodeSymbol( codes );
+      unsigned char value = 0;
+      unsigned int repeat = 1;
+      if( symbol < 16 )
+      {
+        value = symbol;
+      }
+      else if( symbol == 16 )
+      {
+        if( i == 0 )
+        {
+          throw invalid_argument( "Invalid block header in image data" );
+        }
+        value = lengths[ i - 1 ];
+        repeat = 3 + getBits( 2 );
+      }
+      else if( symbol == 17 )
+      {
+        repeat = 3 + getBits( 3 );
+      }
+      else
+      {
+        repeat = 11 + getBits( 7 );
+      }
+      if( i + repeat > total )
+      {
+        throw invalid_argument( "Invalid block header in image data" );
+      }
+      memset( lengths + i, value, repeat );
+      i += repeat;
+    }
+    if( lengths[256] == 0 )
+    {
+      throw invalid_argument( "Invalid block header in image data" );
+    }
+    buildTable( literals, lengths, literalCount );
+    buildTable( distances, lengths + literalCount, distanceCount );
+  }
+  else
+  {
+    throw invalid_argument( "Invalid block type in image data" );
+  }
+  inBlock = true;
+  storedBlock = ( type == 0 );
+}
+
+// ====================================================================
+// Inflate - output
+
+size_t inflateStream::read( unsigned char* out, size_t count )
+{
+  size_t produced = 0;
+
+  if( started == false )
+  {
+    // zlib header, deflate with no preset dictionary
+    unsigned int method = getBits( 8 );
+    unsigned int flags = getBits( 8 );
+    if( ( ( method & 15 ) != 8 ) || ( ( ( method << 8 ) | flags ) % 31 != 0 ) || ( ( flags & 32 ) != 0 ) )
+    {
+      throw invalid_argument( "Invalid zlib header in image data" );
+    }
+    started = true;
+  }
+
+  while( ( produced < count ) && ( finished == false ) )
+  {
+    if( matchLength > 0 )
+    {
+      // Copy from earlier output
+      while( ( matchLength > 0 ) && ( produced < count ) )
+      {
+        unsigned char value = window[ ( outputCount - matchDistance ) & WINDOW_MASK ];
+        window[ outputCount & WINDOW_MASK ] = value;
+        outputCount++;
+        out[ produced++ ] = value;
+        matchLength--;
+      }
+    }
+    else if( inBlock == false )
+    {
+      if( finalBlock == true )
+      {
+        finished = true;
+      }
+      else
+      {
+        readBlockHeader();
+      }
+    }
+    else if( storedBlock == true )
+    {
+      if( storedRemaining == 0 )
+      {
+        inBlock = false;
+      }
+      else
+      {
+        unsigned char value = getBits( 8 );
+        window[ outputCount & WINDOW_MASK ] = value;
+        outputCount++;
+        out[ produced++ ] = value;
+        storedRemaining--;
+      }
+    }
+    else
+    {
+      unsigned int symbol = decodeSymbol( literals );
+      if( symbol < 256 )
+      {
+        window[ outputCount & WINDOW_MASK ] = symbol;
+        outputCount++;
+        out[ produced++ ] = symbol;
+      }
+      else if( symbol == 256 )
+      {
+        inBlock = false;
+      }
+      else
+      {
+        symbol -= 257;
+        if( symbol >= 29 )
+        {
+          throw invalid_argument( "Invalid length code in image data" );
+        }
+        matchLength = lengthBase[ symbol ] + getBits( lengthExtra[ symbol ] );
+        unsigned int code = decodeSymbol( distances );
+        if( code >= 30 )
+        {
+          throw invalid_argument( "Invalid distance code in image data" );
+        }
+        matchDistance = distanceBase[ code ] + getBits( distanceExtra[ code ] );
+        if( matchDistance > outputCount )
+        {
+          throw invalid_argument( "Invalid distance in image data" );
+        }
+      }
+    }
+  }
+
+  return produced;
+}
+
+// ====================================================================
+// PNG - constructor
+
+pngStream::pngStream( void )
+{
+  width = 0;
+  height = 0;
+  bitDepth = 8;
+  colourType = LCT_RGB;
+  channels = 3;
+  interlaced = false;
+  rowBytes = 0;
+  pixelBytes = 3;
+  nextRow = 0;
+}
+
+// --------------------------------------------------------------------
+
+struct returnResult pngStream::open( string fileName )
+{
+  struct returnResult res = file.open( fileName );
+  if( res.result == false )
+  {
+    return res;
+  }
+  const unsigned char* data = reinterpret_cast<const unsigned char*>( file.data() );
+  const unsigned char* end = data + file.size();
+
+  // Use lodepng to check the signature and read the header
+  LodePNGState state;
+  lodepng_state_init( &state );
+  unsigned error = lodepng_inspect( &width, &height, &state, data, file.size() );
+  colourType = state.info_png.color.colortype;
+  bitDepth = state.info_png.color.bitdepth;
+  interlaced = ( state.info_png.interlace_method != 0 );
+  lodepng_state_cleanup( &state );
+
+  if( error )
+  {
+    res.result = false;
+    res.reason = lodepng_error_text( error );
+    return res;
+  }
+  if( interlaced == true )
+  {
+    res.result = false;
+    res.reason = "Interlaced images can't be read a row at a time";
+    return res;
+  }
+
+  switch( colourType )
+  {
+    case LCT_GREY_ALPHA:
+      channels = 2;
+      break;
+    case LCT_RGB:
+      channels = 3;
+      break;
+    case LCT_RGBA:
+      channels = 4;
+      break;
+    default:
+      channels = 1;
+      break;
+  }
+  unsigned int pixelBits = channels * bitDepth;
+  rowBytes = ( ( static_cast<size_t>( width ) * pixelBits ) + 7 ) / 8;
+  pixelBytes = max( 1u, pixelBits / 8 );
+
+  // Find the palette and the compressed image data, which may be split
+  // over several IDAT chunks
+  inflater = inflateStream();
+  palette.clear();
+  for( const unsigned char* chunk = lodepng_chunk_next_const( data, end ); chunk + 12 <= end;
+       chunk = lodepng_chunk_next_const( chunk, end ) )
+  {
+    unsigned length = lodepng_chunk_length( chunk );
+    if( length > static_cast<size_t>( end - chunk ) - 12 )
+    {
+      res.result = false;
+      res.reason = "PNG chunk extends past the end of the file";
+      return res;
+    }
+    if( lodepng_chunk_type_equals( chunk, "IDAT" ) )
+    {
+      inflater.addInput( lodepng_chunk_data_const( chunk ), length );
+    }
+    else if( lodepng_chunk_type_equals( chunk, "PLTE" ) )
+    {
+      const unsigned char* p = lodepng_chunk_data_const( chunk );
+      palette.assign( p, p + ( length - ( length % 3 ) ) );
+    }
+    else if( lodepng_chunk_type_equals( chunk, "IEND" ) )
+    {
+      break;
+    }
+  }
+
+  if( ( colourType == LCT_PALETTE ) && ( palette.empty() == true ) )
+  {
+    res.result = false;
+    res.reason = "PNG palette is missing";
+    return res;
+  }
+
+  rewind();
+  return res;
+}
+
+// --------------------------------------------------------------------
+
+void pngStream::rewind( void )
+{
+  inflater.reset();
+  current.assign( rowBytes + 1, 0 );
+  previous.assign( rowBytes + 1, 0 );
+  nextRow = 0;
+}
+
+// ====================================================================
+// PNG - rows
+
+struct returnResult pngStream::readRow( unsigned char* rgb )
+{
+  struct returnResult res = { true, "" };
+
+  if( nextRow >= height )
+  {
+    res.result = false;
+    res.reason = "No more rows in image";
+    return res;
+  }
+
+  try
+  {
+    if( inflater.read( current.data(), current.size() ) < current.size() )
+    {
+      throw invalid_argument( "Image data is truncated" );
+    }
+    unfilter();
+  }
+  catch( const invalid_argument& e )
+  {
+    res.result = false;
+    res.reason = e.what();
+    return res;
+  }
+
+  toRGB( rgb );
+  current.swap( previous );
+  nextRow++;
+
+  return res;
+}
+
+// --------------------------------------------------------------------
+
+void pngStream::unfilter( void )
+{
+  unsigned char* row = current.data() + 1;
+  const unsigned char* prior = previous.data() + 1;
+  size_t bpp = pixelBytes;
+
+  switch( current[0] )
+  {
+    case 0:
+      break;
+
+    case 1:
+      // Sub
+      for( size_t i=bpp; i<rowBytes; i++ )
+      {
+        row[i] += row[ i - bpp ];
+      }
+      break;
+
+    case 2:
+      // Up
+      for( size_t i=0; i<rowBytes; i++ )
+      {
+        row[i] += prior[i];
+      }
+      break;
+
+    case 3:
+      // Average
+      for( size_t i=0; i<min( bpp, rowBytes ); i++ )
+      {
+        row[i] += prior[i] >> 1;
+      }
+      for( size_t i=bpp; i<rowBytes; i++ )
+      {
+        row[i] += ( row[ i - bpp ] + prior[i] ) >> 1;
+      }
+      break;
+
+    case 4:
+      // Paeth
+      for( size_t i=0; i<min( bpp, rowBytes ); i++ )
+      {
+        row[i] += prior[i];
+      }
+      for( size_t i=bpp; i<rowBytes; i++ )
+      {
+        int a = row[ i - bpp ];
+        int b = prior[i];
+        int c = prior[ i - bpp ];
+        int pa = abs( b - c );
+        int pb = abs( a - c );
+        int pc = abs( a + b - c - c );
+        row[i] += ( ( pa <= pb ) && ( pa <= pc ) ) ? a : ( ( pb <= pc ) ? b : c );
+      }
+      break;
+
+    default:
+      throw invalid_argument( "Invalid filter type in image data" );
+  }
+}
+
+// --------------------------------------------------------------------
+
+// One sample of a row, scaled to 8 bits ( the high byte of 16 bit values )
+static inline unsigned int sample( const unsigned char* row, size_t index, unsigned int bitDepth )
+{
+  if( bitDepth == 8 )
+  {
+    return row[ index ];
+  }
+  if( bitDepth == 16 )
+  {
+    return row[ index * 2 ];
+  }
+  size_t bit = index * bitDepth;
+  unsigned int maximum = ( 1 << bitDepth ) - 1;
+  unsigned int value = ( row[ bit >> 3 ] >> ( 8 - bitDepth - ( bit & 7 ) ) ) & maximum;
+  return ( value * 255 ) / maximum;
+}
+
+// --------------------------------------------------------------------
+
+void pngStream::toRGB( unsigned char* rgb ) const
+{
+  const unsigned char* row = current.data() + 1;
+
+  if( ( colourType == LCT_RGB ) && ( bitDepth == 8 ) )
+  {
+    memcpy( rgb, row, rowBytes );
+    return;
+  }
+
+  for( size_t x=0; x<width; x++ )
+  {
+    unsigned char* p = rgb + ( x * 3 );
+    if( colourType == LCT_PALETTE )
+    {
+      // Indexes out of the palette are black
+      size_t bit = x * bitDepth;
+      size_t index = ( row[ bit >> 3 ] >> ( 8 - bitDepth - ( bit & 7 ) ) ) & ( ( 1 << bitDepth ) - 1 );
+      if( ( index * 3 ) + 2 < palette.size() )
+      {
+        memcpy( p, &palette[ index * 3 ], 3 );
+      }
+      else
+      {
+        p[0] = p[1] = p[2] = 0;
+      }
+    }
+    else if( ( colourType == LCT_RGB ) || ( colourType == LCT_RGBA ) )
+    {
+      // Any alpha channel is dropped
+      p[0] = sample( row, ( x * channels ), bitDepth );
+      p[1] = sample( row, ( x * channels ) + 1, bitDepth );
+      p[2] = sample( row, ( x * channels ) + 2, bitDepth );
+    }
+    else
+    {
+      p[0] = p[1] = p[2] = sample( row, x * channels, bitDepth );
+    }
+  }
+}
@@ -0,0 +1,175 @@
+// pngstream.hpp - header file for pngstream
+// Copyright (C) 2018 John Davies
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef PNGSTREAM_H
+#define PNGSTREAM_H
+
+#include "util.hpp"
+#include "mappedfile.hpp"
+#include <string>
+#include <vector>
+#include <cstddef>
+
+using namespace std;
+
+/// Incremental decoder for zlib ( RFC 1950 / 1951 ) compressed data that
+/// is already in memory, possibly split into several blocks ( e.g. PNG
+/// IDAT chunks ). Output is produced on request, so only the 32KB history
+/// window is kept rather than the whole decompressed stream.
+///
+
+class inflateStream
+{
+  // Compressed data
+  vector< pair<const unsigned char*, size_t> > input;
+  size_t inputBlock;
+  size_t inputPos;
+  UINT64 bitBuffer;
+  unsigned int bitCount;
+  unsigned int paddingBits;
+
+  // History for back references
+  vector<unsigned char> window;
+  UINT64 outputCount;
+
+  // Canonical Huffman code, codes of up to 9 bits are found by lookup
+  struct huffmanTable {
+    unsigned short fast[512];
+    unsigned short count[16];
+    unsigned short symbol[288];
+  };
+  struct huffmanTable literals;
+  struct huffmanTable distances;
+
+  // Position in the stream
+  bool started;
+  bool inBlock;
+  bool storedBlock;
+  bool finalBlock;
+  bool finished;
+  size_t storedRemaining;
+  unsigned int matchLength;
+  unsigned int matchDistance;
+
+  void fillBits( unsigned int count );
+  unsigned int getBits( unsigned int count );
+  void buildTable( struct huffmanTable& table, const unsigned char* lengths, unsigned int count );
+  unsigned int decodeSymbol( const struct huffmanTable& table );
+  void readBlockHeader( void );
+
+public:
+
+  /// Constructor
+  ///
+  inflateStream( void );
+
+  /// Add a block of compressed data, it must stay in memory while the
+  /// stream is in use
+  /// @param[in] data : compressed data
+  /// @param[in] size : number of bytes in "data"
+  ///
+  void addInput( const unsigned char* data, size_t size );
+
+  /// Start again from the beginning of the compressed data
+  ///
+  void reset( void );
+
+  /// Decompress the next bytes. Throws invalid_argument for corrupt data.
+  /// @param[out] out : buffer for the decompressed bytes
+  /// @param[in] count : number of bytes wanted
+  /// @return Number of bytes decompressed, less than "count" at the end of the stream
+  ///
+  size_t read( unsigned char* out, size_t count );
+
+};
+
+/// Decoder for PNG files that delivers one row at a time as 8 bit RGB
+/// values, so that very large images can be used without holding all of
+/// the pixels ( or the decompressed data ) in memory. Rows are read from
+/// the top of the image down. The chunk layout and header are read using
+/// lodepng. Interlaced images aren't supported as their rows can't be
+/// decoded in order.
+///
+
+class pngStream
+{
+  mappedFile file;
+  inflateStream inflater;
+
+  // Image layout
+  unsigned int width;
+  unsigned int height;
+  unsigned int bitDepth;
+  unsigned int colourType;
+  unsigned int channels;
+  bool interlaced;
+  size_t rowBytes;
+  unsigned int pixelBytes;
+  vector<unsigned char> palette;
+
+  // Filtered rows, with the filter type byte at the start
+  vector<unsigned char> current;
+  vector<unsigned char> previous;
+  unsigned int nextRow;
+
+  void unfilter( void );
+  void toRGB( unsigned char* rgb ) const;
+
+public:
+
+  /// Constructor
+  ///
+  pngStream( void );
+
+  /// Open a PNG file and read the header
+  /// @param[in] fileName : path to file
+  /// @return Success/fail & error message
+  ///
+  struct returnResult open( string fileName );
+
+  /// Decode the next row of the image
+  /// @param[out] rgb : buffer for getWidth() RGB values
+  /// @return Success/fail & error message
+  ///
+  struct returnResult readRow( unsigned char* rgb );
+
+  /// Go back to the top row of the image
+  ///
+  void rewind( void );
+
+  /// @return Image width in pixels
+  ///
+  unsigned int getWidth( void ) const { return width; }
+
+  /// @return Image height in pixels
+  ///
+  unsigned int getHeight( void ) const { return height; }
+
+  /// @return The row that readRow will decode next, 0 is the top row
+  ///
+  unsigned int getNextRow( void ) const { return nextRow; }
+
+  /// @return true if the image is interlaced, and so can't be streamed
+  ///
+  bool isInterlaced( void ) const { return interlaced; }
+
+private:
+  pngStream( const pngStream& );
+  pngStream& operator=( const pngStream& );
+
+};
+
+#endif
@@ -18,6 +18,8 @@
 #include <vector>
 #include <string>
 #include <stdexcept>
+#include <thread>
+#include <exception>
 
 using namespace std;
 
@@ -42,6 +44,80 @@ vector<string> split( const string inputString, char delimiter )
   return params;
 }
 
+// Number of worker threads to use by default, one per hardware thread
+unsigned int defaultThreadCount( void )
+{
+  unsigned int n = thread::hardware_concurrency();
+  return ( n == 0 ) ? 1 : n;
+}
+
+// Split the range [0,count) into contiguous blocks, one per thread, and
+// call work( first, last ) for each block. The first block is run on the
+// calling thread. Any exception thrown by a block is re-thrown here after
+// all the threads have finished.
+void parallelFor( unsigned int count, unsigned int threads,
+                  const function<void( unsigned int, unsigned int )>& work )
+{
+  if( threads > count )
+  {
+    threads = count;
+  }
+  if( threads <= 1 )
+  {
+    if( count > 0 )
+    {
+      work( 0, count );
+    }
+    return;
+  }
+
+  vector<thread> workers;
+  vector<exception_ptr> errors( threads );
+  unsigned int block = count / threads;
+  unsigned int extra = count % threads;
+  unsigned int first = 0;
+  vector<unsigned int> starts;
+  for( unsigned int t=0; t<=threads; t++ )
+  {
+    starts.push_back( first );
+    first += block + ( ( t < extra ) ? 1 : 0 );
+  }
+
+  for( unsigned int t=1; t<threads; t++ )
+  {
+    workers.push_back( thread( [&, t]()
+    {
+      try
+      {
+        work( starts[t], starts[t+1] );
+      }
+      catch(...)
+      {
+        errors[t] = current_exception();
+      }
+    } ) );
+  }
+  try
+  {
+    work( starts[0], starts[1] );
+  }
+  catch(...)
+  {
+    errors[0] = current_exception();
+  }
+  for( auto& w : workers )
+  {
+    w.join();
+  }
+  for( auto& e : errors )
+  {
+    if( e )
+    {
+      rethrow_exception( e );
+    }
+  }
+}
+
 // Utility routines for packing & unpacking data
 // Data stored intenally as little endian
 
@@ -540,7 +616,7 @@ vector<unsigned char> unpackFloatLittleEndian( UINT64 value )
 
 UINT64 packDoubleAscii( string value )
 {
-  float d;
+  double d;
   d = stod( value );
   unsigned char *bytes = reinterpret_cast<unsigned char*>( &d );
   return ( (UINT64)bytes[7] << 56 ) +
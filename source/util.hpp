@@ -20,6 +20,7 @@
 #include <string>
 #include <vector>
 #include <sstream>
+#include <functional>
 
 using namespace std;
 
@@ -46,9 +47,17 @@ struct returnResult {
 // Typedef for 64 bit quantity
 #define UINT64 uint64_t
 
+// Typedef for 32 bit quantity
+#define UINT32 uint32_t
+
 // Utility function
 vector<string> split( const string, char );
 
+// Multi-threading helpers
+unsigned int defaultThreadCount( void );
+void parallelFor( unsigned int count, unsigned int threads,
+                  const function<void( unsigned int, unsigned int )>& work );
+
 // Function prototypes for data conversion utilities
 int getNumberOfBytes( string type );
 